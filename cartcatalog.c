@@ -0,0 +1,589 @@
+/*
+ * Based in f2a by Ulrich Hecht <uli@emulinks.de>
+ * if2a by D. Gauchard <deyv@free.fr>
+ * F2A Ultra support by Vincent Rubiolo <vincent.rubiolo@free.fr>
+ * Licensed under the terms of the GNU Public License version 2
+ */
+
+#include <stdio.h>
+#include <ctype.h>
+#include <stdlib.h>
+#include <string.h>
+#include <assert.h>
+#include <dirent.h>
+#include <sys/stat.h>
+
+#include "cartcatalog.h"
+#include "libf2a.h"
+#include "cartrom.h"
+#include "cartutils.h"
+#include "cartthread.h"
+
+/*///////////////////////////////////////////////////////////////////////////
+
+The catalog remembers, for each ROM file ever added or scanned, what if2a
+needs to know about it to plan an insertion (trimmed size, header name) and
+to recognise it (crc, GameID). An entry is valid as long as the file size
+and modification time have not changed, otherwise the file is loaded again
+and its entry is updated. Times are kept in nanoseconds where the system
+tells them, so that a rom rebuilt within the same second is noticed (the
+crc of a rom is checked again anyway when it is loaded to be burned).
+
+It is a text file, one line per ROM:
+	size mtime trimmed_size crc game_id<TAB>romname<TAB>absolute path
+
+Entries are found through two hash tables (by path, and by contents crc).
+
+///////////////////////////////////////////////////////////////////////////*/
+
+#define CATALOG_NAME		"catalog"
+#define CATALOG_HEADER		"# if2a rom catalog v1\n"
+#define CATALOG_LINELEN		2048
+
+static char*			catalog_file = NULL;
+static int			catalog_loaded = 0;
+static int			catalog_disabled = 0;
+static int			catalog_changed = 0;
+
+static cart_catalog_entry_s*	catalog = NULL;
+static int			catalog_number = 0;
+static int			catalog_max_number = 0;
+
+// hash tables contain index+1 in catalog[], 0 is empty
+static int*			catalog_by_path = NULL;
+static int*			catalog_by_crc = NULL;
+static int			catalog_table_size = 0;
+
+///////////////////////////////////////
+// hash tables
+
+static unsigned int hash_string (const char* s)
+{
+	unsigned int h = 2166136261u;		// fnv-1a
+	while (*s)
+		h = (h ^ (unsigned char)*s++) * 16777619u;
+	return h;
+}
+
+static unsigned int hash_crc (u_int32_t crc, int size)
+{
+	return (crc ^ ((unsigned int)size * 2654435761u)) * 16777619u;
+}
+
+static void catalog_table_insert (int* table, unsigned int hash, int index)
+{
+	unsigned int i;
+	for (i = hash & (catalog_table_size - 1); table[i]; i = (i + 1) & (catalog_table_size - 1));
+	table[i] = index + 1;
+}
+
+static int catalog_table_rebuild (void)
+{
+	int i;
+	int size = 64;
+
+	while (size < 2 * catalog_max_number)
+		size *= 2;
+
+	free(catalog_by_path);
+	free(catalog_by_crc);
+	catalog_by_path = (int*)calloc(size, sizeof(int));
+	catalog_by_crc = (int*)calloc(size, sizeof(int));
+	if (!catalog_by_path || !catalog_by_crc)
+	{
+		printerrno("calloc(%i) for rom catalog", size * (int)sizeof(int));
+		return -1;
+	}
+	catalog_table_size = size;
+
+	for (i = 0; i < catalog_number; i++)
+	{
+		catalog_table_insert(catalog_by_path, hash_string(catalog[i].path), i);
+		catalog_table_insert(catalog_by_crc, hash_crc(catalog[i].crc, catalog[i].size), i);
+	}
+	return 0;
+}
+
+static int catalog_find_path (const char* path)
+{
+	unsigned int i;
+
+	if (!catalog_table_size)
+		return -1;
+	for (i = hash_string(path) & (catalog_table_size - 1); catalog_by_path[i]; i = (i + 1) & (catalog_table_size - 1))
+		if (strcmp(catalog[catalog_by_path[i] - 1].path, path) == 0)
+			return catalog_by_path[i] - 1;
+	return -1;
+}
+
+///////////////////////////////////////
+// entries
+
+// file modification time, in nanoseconds
+static long long catalog_mtime (const struct stat* st)
+{
+#if _WIN32
+	return (long long)st->st_mtime * 1000000000;
+#elif __APPLE__
+	return (long long)st->st_mtimespec.tv_sec * 1000000000 + st->st_mtimespec.tv_nsec;
+#else
+	return (long long)st->st_mtim.tv_sec * 1000000000 + st->st_mtim.tv_nsec;
+#endif
+}
+
+static void catalog_fill (cart_catalog_entry_s* entry, const unsigned char* rom, int size)
+{
+	int crc;
+
+	entry->size = size;
+	entry->trimmed_size = trim_size(rom, size);
+	cart_crc32(rom, &crc, size);
+	entry->crc = crc;
+	entry->game_id = size >= 189? cart_game_id(rom): 0;
+	if (size >= 0xac)
+		romname_r(rom, entry->romname);
+	else
+		entry->romname[0] = 0;
+}
+
+// stores entry (path is taken), replacing the previous one with same path
+static cart_catalog_entry_s* catalog_store (cart_catalog_entry_s* entry)
+{
+	int index;
+
+	if ((index = catalog_find_path(entry->path)) >= 0)
+	{
+		free(catalog[index].path);
+		catalog[index] = *entry;
+		// crc may have changed
+		if (catalog_table_rebuild() < 0)
+			return NULL;
+		catalog_changed = 1;
+		return &catalog[index];
+	}
+
+	if (catalog_number == catalog_max_number)
+	{
+		int max_number = catalog_max_number? 2 * catalog_max_number: 64;
+		cart_catalog_entry_s* bigger;
+		if ((bigger = (cart_catalog_entry_s*)realloc(catalog, max_number * sizeof(cart_catalog_entry_s))) == NULL)
+		{
+			printerrno("realloc(%i) for rom catalog", max_number * (int)sizeof(cart_catalog_entry_s));
+			return NULL;
+		}
+		catalog = bigger;
+		catalog_max_number = max_number;
+		if (catalog_table_rebuild() < 0)
+			return NULL;
+	}
+
+	index = catalog_number++;
+	catalog[index] = *entry;
+	catalog_table_insert(catalog_by_path, hash_string(entry->path), index);
+	catalog_table_insert(catalog_by_crc, hash_crc(entry->crc, entry->size), index);
+	catalog_changed = 1;
+	return &catalog[index];
+}
+
+///////////////////////////////////////
+// catalog file
+
+int cart_catalog_select (const char* file)
+{
+	free(catalog_file);
+	catalog_file = NULL;
+	catalog_disabled = file && strcmp(file, "none") == 0;
+	if (file && !catalog_disabled && (catalog_file = strdup(file)) == NULL)
+	{
+		printerrno("strdup");
+		return -1;
+	}
+	return 0;
+}
+
+static const char* catalog_filename (void)
+{
+	return catalog_file? catalog_file: cart_home_file(CATALOG_NAME);
+}
+
+int cart_catalog_load (void)
+{
+	FILE* f;
+	char line [CATALOG_LINELEN];
+	int lineno = 0;
+
+	if (catalog_loaded || catalog_disabled)
+		return 0;
+	catalog_loaded = 1;
+
+	if ((f = fopen(catalog_filename(), "r")) == NULL)
+		// no catalog yet
+		return 0;
+
+	while (fgets(line, CATALOG_LINELEN, f))
+	{
+		cart_catalog_entry_s entry;
+		char* name;
+		char* path;
+		unsigned int crc, game_id;
+		int len;
+
+		lineno++;
+		if (line[0] == '#')
+			continue;
+		if ((len = strlen(line)) && line[len - 1] == '\n')
+			line[len - 1] = 0;
+
+		if (   sscanf(line, "%i %lli %i %x %x", &entry.size, &entry.mtime, &entry.trimmed_size, &crc, &game_id) != 5
+		    || (name = strchr(line, '\t')) == NULL
+		    || (path = strchr(name + 1, '\t')) == NULL)
+		{
+			printerr("%s:%i: bad catalog line ignored\n", catalog_filename(), lineno);
+			continue;
+		}
+		*path++ = 0;
+		name++;
+		entry.crc = crc;
+		entry.game_id = game_id;
+		strncpy(entry.romname, name, 12);
+		entry.romname[12] = 0;
+		if ((entry.path = strdup(path)) == NULL || catalog_store(&entry) == NULL)
+		{
+			fclose(f);
+			return -1;
+		}
+	}
+	fclose(f);
+
+	catalog_changed = 0;
+	if (cart_verbose > 1)
+		print("Rom catalog '%s' has %i entries\n", catalog_filename(), catalog_number);
+	return 0;
+}
+
+int cart_catalog_save (void)
+{
+	FILE* f;
+	int i;
+	char tmpname [1024];
+
+	if (!catalog_changed || catalog_disabled)
+		return 0;
+
+	snprintf(tmpname, sizeof(tmpname), "%s.new", catalog_filename());
+	if ((f = fopen(tmpname, "w")) == NULL)
+	{
+		printerrno("fopen(%s)", tmpname);
+		return -1;
+	}
+	fputs(CATALOG_HEADER, f);
+	for (i = 0; i < catalog_number; i++)
+		fprintf(f, "%i %lli %i %08x %08x\t%s\t%s\n",
+			catalog[i].size,
+			catalog[i].mtime,
+			catalog[i].trimmed_size,
+			catalog[i].crc,
+			catalog[i].game_id,
+			catalog[i].romname,
+			catalog[i].path);
+	if (fclose(f) != 0)
+	{
+		printerrno("write(%s)", tmpname);
+		return -1;
+	}
+
+#if _WIN32
+	remove(catalog_filename());
+#endif
+	if (rename(tmpname, catalog_filename()) != 0)
+	{
+		printerrno("rename(%s)", tmpname);
+		return -1;
+	}
+
+	catalog_changed = 0;
+	return 0;
+}
+
+///////////////////////////////////////
+// lookups
+
+cart_catalog_entry_s* cart_catalog_lookup (const char* filename)
+{
+	struct stat st;
+	char* path;
+	int index;
+
+	if (catalog_disabled || cart_catalog_load() < 0)
+		return NULL;
+
+	if ((path = cart_absolute_path(filename)) == NULL)
+		return NULL;
+	index = catalog_find_path(path);
+	free(path);
+
+	if (   index < 0
+	    || stat(filename, &st) == -1
+	    || st.st_size != catalog[index].size
+	    || catalog_mtime(&st) != catalog[index].mtime)
+		return NULL;
+
+	return &catalog[index];
+}
+
+int cart_catalog_fill (cart_catalog_entry_s* entry, const char* filename, const unsigned char* rom, int size)
+{
+	struct stat st;
+
+	if (stat(filename, &st) == -1)
+	{
+		printerrno("stat(%s)", filename);
+		return -1;
+	}
+	if (st.st_size != size)
+	{
+		printerr("File '%s' has changed while being read\n", filename);
+		return -1;
+	}
+
+	catalog_fill(entry, rom, size);
+	entry->mtime = catalog_mtime(&st);
+	entry->path = cart_absolute_path(filename);
+	return 0;
+}
+
+cart_catalog_entry_s* cart_catalog_store (cart_catalog_entry_s* entry)
+{
+	static cart_catalog_entry_s unstored;
+
+	if (catalog_disabled || cart_catalog_load() < 0 || entry->path == NULL)
+	{
+		// catalog is not used, entry is only valid until next call
+		free(entry->path);
+		unstored = *entry;
+		unstored.path = NULL;
+		return &unstored;
+	}
+
+	return catalog_store(entry);
+}
+
+cart_catalog_entry_s* cart_catalog_update (const char* filename, const unsigned char* rom, int size)
+{
+	cart_catalog_entry_s entry;
+
+	if (cart_catalog_fill(&entry, filename, rom, size) < 0)
+		return NULL;
+	return cart_catalog_store(&entry);
+}
+
+cart_catalog_entry_s* cart_catalog_find_same (const cart_catalog_entry_s* other)
+{
+	unsigned int i;
+
+	if (!catalog_table_size || !other->path)
+		return NULL;
+	for (i = hash_crc(other->crc, other->size) & (catalog_table_size - 1); catalog_by_crc[i]; i = (i + 1) & (catalog_table_size - 1))
+	{
+		cart_catalog_entry_s* entry = &catalog[catalog_by_crc[i] - 1];
+		if (   entry != other
+		    && entry->crc == other->crc
+		    && entry->size == other->size
+		    && strcmp(entry->path, other->path) != 0)
+			return entry;
+	}
+	return NULL;
+}
+
+///////////////////////////////////////
+// catalog scan (parallel)
+
+typedef struct
+{
+	const char*		filename;
+	char*			allocated;	// filename when found in a directory
+	int			result;		// -1: error, 0: up to date, 1: updated
+	cart_catalog_entry_s	entry;
+} catalog_scan_s;
+
+static int catalog_scan_is_rom (const char* name)
+{
+	const char* ext = strrchr(name, '.');
+	return ext && (   strcasecmp(ext, ".gba") == 0
+	               || strcasecmp(ext, ".agb") == 0
+	               || strcasecmp(ext, ".bin") == 0);
+}
+
+// appends filename, or rom files inside directory filename, to the scan list
+// (allocated is filename when the list has to free it)
+static int catalog_scan_add (const char* filename, char* allocated, catalog_scan_s** scan, int* number, int* max_number)
+{
+	struct stat st;
+
+	if (stat(filename, &st) == -1)
+	{
+		printerrno("stat(%s)", filename);
+		free(allocated);
+		return -1;
+	}
+
+	if (S_ISDIR(st.st_mode))
+	{
+		DIR* dir;
+		struct dirent* dirent;
+
+		if ((dir = opendir(filename)) == NULL)
+		{
+			printerrno("opendir(%s)", filename);
+			return -1;
+		}
+		while ((dirent = readdir(dir)) != NULL)
+		{
+			char* sub;
+			struct stat subst;
+			int ret = 0;
+
+			if (dirent->d_name[0] == '.')
+				continue;
+			if ((sub = (char*)malloc(strlen(filename) + strlen(dirent->d_name) + 2)) == NULL)
+			{
+				printerrno("malloc");
+				closedir(dir);
+				return -1;
+			}
+			sprintf(sub, "%s/%s", filename, dirent->d_name);
+			if (stat(sub, &subst) == 0 && S_ISDIR(subst.st_mode))
+			{
+				ret = catalog_scan_add(sub, NULL, scan, number, max_number);
+				free(sub);
+			}
+			else if (stat(sub, &subst) == 0 && catalog_scan_is_rom(sub))
+				// sub is kept in the list
+				ret = catalog_scan_add(sub, sub, scan, number, max_number);
+			else
+				free(sub);
+			if (ret < 0)
+			{
+				closedir(dir);
+				return -1;
+			}
+		}
+		closedir(dir);
+		return 0;
+	}
+
+	if (*number == *max_number)
+	{
+		catalog_scan_s* bigger;
+		*max_number = *max_number? 2 * *max_number: 64;
+		if ((bigger = (catalog_scan_s*)realloc(*scan, *max_number * sizeof(catalog_scan_s))) == NULL)
+		{
+			printerrno("realloc");
+			free(allocated);
+			return -1;
+		}
+		*scan = bigger;
+	}
+	(*scan)[*number].filename = filename;
+	(*scan)[(*number)++].allocated = allocated;
+	return 0;
+}
+
+static void catalog_scan_job (void* arg, int index)
+{
+	catalog_scan_s* item = &((catalog_scan_s*)arg)[index];
+	struct stat st;
+	unsigned char* rom;
+	int size = 0;
+
+	// catalog is read only while jobs are running
+	if (cart_catalog_lookup(item->filename))
+	{
+		item->result = 0;
+		return;
+	}
+
+	item->result = -1;
+	if (stat(item->filename, &st) == 0 && st.st_size == 0)
+	{
+		printerr("File '%s' is empty\n", item->filename);
+		return;
+	}
+	if ((rom = load_from_file(item->filename, NULL, &size)) == NULL)
+		return;
+	if (cart_catalog_fill(&item->entry, item->filename, rom, size) == 0)
+	{
+		if (item->entry.path)
+			item->result = 1;
+	}
+	free(rom);
+}
+
+static void catalog_scan_free (catalog_scan_s* scan, int number)
+{
+	int i;
+
+	for (i = 0; i < number; i++)
+		free(scan[i].allocated);
+	free(scan);
+}
+
+int cart_catalog_scan (int numfiles, char* files[])
+{
+	catalog_scan_s* scan = NULL;
+	int number = 0, max_number = 0;
+	int i, updated = 0, errors = 0, unscanned = 0;
+
+	if (catalog_disabled)
+	{
+		printerr("Rom catalog is disabled.\n");
+		return -1;
+	}
+	if (cart_catalog_load() < 0)
+		return -1;
+
+	for (i = 0; i < numfiles; i++)
+		if (catalog_scan_add(files[i], NULL, &scan, &number, &max_number) < 0)
+			unscanned++;
+
+	if (cart_verbose)
+		print("Scanning %i files with %i workers...\n", number, MIN(number, cart_thread_count()));
+	if (number && cart_jobs_run(number, catalog_scan_job, scan) < 0)
+	{
+		catalog_scan_free(scan, number);
+		return -1;
+	}
+
+	for (i = 0; i < number; i++)
+	{
+		cart_catalog_entry_s* entry;
+
+		if (scan[i].result < 0)
+			errors++;
+		else if (scan[i].result > 0)
+		{
+			if ((entry = catalog_store(&scan[i].entry)) == NULL)
+				errors++;
+			else
+			{
+				updated++;
+				if (cart_verbose)
+					print("\t%s: '%s' size=0x%x trimmed=0x%x crc=%08x GameID=%08X\n",
+						entry->path,
+						entry->romname,
+						entry->size,
+						entry->trimmed_size,
+						entry->crc,
+						entry->game_id);
+			}
+		}
+	}
+
+	print("Rom catalog: %i files, %i updated, %i up to date, %i errors (%i entries in '%s')\n",
+		number, updated, number - updated - errors, errors, catalog_number, catalog_filename());
+	if (unscanned)
+		printerr("%i argument(s) could not be scanned\n", unscanned);
+	catalog_scan_free(scan, number);
+
+	return cart_catalog_save() < 0 || errors || unscanned? -1: 0;
+}
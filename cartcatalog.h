@@ -0,0 +1,48 @@
+/*
+ * Based in f2a by Ulrich Hecht <uli@emulinks.de>
+ * if2a by D. Gauchard <deyv@free.fr>
+ * F2A Ultra support by Vincent Rubiolo <vincent.rubiolo@free.fr>
+ * Licensed under the terms of the GNU Public License version 2
+ */
+
+// Host side ROM catalog: what is known about ROM files without loading them
+
+#ifndef __CARTCATALOG_H__
+#define __CARTCATALOG_H__
+
+#include "libf2a.h"
+
+typedef struct
+{
+	char*		path;			// absolute file name (catalog key)
+	int		size;			// file size
+	long long	mtime;			// file modification time (ns)
+	int		trimmed_size;		// trim_size() result (not rounded to CART_ROM_BLOCK_SIZE)
+	u_int32_t	crc;			// crc32 of the whole file
+	u_int32_t	game_id;		// f2a ultra GameID
+	char		romname [13];		// name from rom header ("" if none)
+} cart_catalog_entry_s;
+
+int			cart_catalog_select	(const char* file);
+int			cart_catalog_save	(void);
+int			cart_catalog_scan	(int numfiles, char* files[]);
+
+// loads the catalog, must be called before using lookups from workers
+int			cart_catalog_load	(void);
+
+// returns the entry of filename if file has not changed since it was cataloged, NULL otherwise
+cart_catalog_entry_s*	cart_catalog_lookup	(const char* filename);
+
+// (re)catalog filename whose contents are rom[0..size-1]
+// returns the updated entry or NULL if error (file has changed meanwhile)
+cart_catalog_entry_s*	cart_catalog_update	(const char* filename, const unsigned char* rom, int size);
+
+// cart_catalog_update() in two steps: fill (reentrant, returns -1 if error),
+// then store from main thread (entry->path is taken)
+int			cart_catalog_fill	(cart_catalog_entry_s* entry, const char* filename, const unsigned char* rom, int size);
+cart_catalog_entry_s*	cart_catalog_store	(cart_catalog_entry_s* entry);
+
+// returns an entry with same contents as 'other' but another file name, or NULL
+cart_catalog_entry_s*	cart_catalog_find_same	(const cart_catalog_entry_s* other);
+
+#endif // __CARTCATALOG_H__
@@ -15,6 +15,8 @@
 #include "cartio.h"
 #include "cartrom.h"
 #include "cartutils.h"
+#include "cartwear.h"
+#include "cartrate.h"
 
 #include "drivers/cart-f2a/f2aio.h" // DEFAULT_ROMBLOCKSIZE_LOG2
 
@@ -95,6 +97,13 @@ int cart_select_loader (cart_type_e cart_type, const char* binware_file)
 
 void cart_exit (int status)
 {
+	// no worker runs during exit()
+	cart_map_prefetch_release();
+	auto_loadandburn_prefetch_release();
+	if (cart_wear_save() < 0)
+		status = 1;
+	if (cart_rate_save() < 0)
+		status = 1;
 	cartio.linker_release();
 	exit(status);
 }
@@ -123,12 +132,32 @@ int cart_user_multiboot (const char* file)
 
 int cart_read_mem (unsigned char* data, int address, int size)
 {
-	return cartio.read(data, address, size);
+	long long start = cart_time_us();
+	int ret = cartio.read(data, address, size);
+
+	if (ret >= 0 && address >= GBA_ROM && address < GBA_SRAM)
+		cart_rate_count_read(size, cart_time_us() - start);
+	return ret;
+}
+
+// every rom write block programmed is counted
+static int cart_write_and_count (const unsigned char* data, int base, int offset, int size, int blocksize, int first_offset, int overall_size)
+{
+	long long start = cart_time_us();
+
+	if (cartio.direct_write(data, base, offset, size, blocksize, first_offset, overall_size) < 0)
+		return -1;
+	if (base == GBA_ROM && !cart_io_sim)
+	{
+		cart_rate_count_write(size, cart_time_us() - start);
+		cart_wear_count(offset, size);
+	}
+	return 0;
 }
 
 int cart_direct_write (const unsigned char* data, int base, int offset, int size, int blocksize, int first_offset, int overall_size)
 {
-	return cartio.direct_write(data, base, offset, size, blocksize, first_offset, overall_size);
+	return cart_write_and_count(data, base, offset, size, blocksize, first_offset, overall_size);
 }
 
 int cart_read_mem_to_file (const char* file, int address, int size, enum read_type_e read_type)
@@ -203,7 +232,7 @@ int cart_burn (int cart_base, int cart_offset, const unsigned char* rom, int rom
 				print("\n");
 		}
 
-		if (cartio.direct_write(&rom[rom_offset], cart_base, offset_burn, size_burn, CART_WRITE_BLOCK_SIZE, initial_rom_offset, rom_size) < 0)
+		if (cart_write_and_count(&rom[rom_offset], cart_base, offset_burn, size_burn, CART_WRITE_BLOCK_SIZE, initial_rom_offset, rom_size) < 0)
 			return -1;
 
 		rom_offset += chunksize;
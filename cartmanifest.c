@@ -0,0 +1,189 @@
+/*
+ * Based in f2a by Ulrich Hecht <uli@emulinks.de>
+ * if2a by D. Gauchard <deyv@free.fr>
+ * F2A Ultra support by Vincent Rubiolo <vincent.rubiolo@free.fr>
+ * Licensed under the terms of the GNU Public License version 2
+ */
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <ctype.h>
+
+#include "cartmanifest.h"
+#include "libf2a.h"
+#include "cartmap.h"
+#include "cartrom.h"
+
+/*///////////////////////////////////////////////////////////////////////////
+
+A manifest (-V) is the whole wanted contents of the cart, one item per line:
+
+	# comment
+	loader <loader file or internal loader name>
+	<rom file>[,<name in map>] [@<offset>]
+
+Roms not in the manifest are removed from cart, roms in it are kept when
+they are in map with the same name and size (and at their offset if one is
+given), the others are added. Relative file names are relative to the
+directory of the manifest. Everything is done from one map and one burn
+session (see cart_map_sync()).
+
+///////////////////////////////////////////////////////////////////////////*/
+
+#define MANIFEST_LINELEN	1024
+
+static char**		cart_manifest_rom = NULL;	// "file" or "file,romname"
+static int*		cart_manifest_offset = NULL;	// -1: anywhere
+static int		cart_manifest_number = 0;
+static char*		cart_manifest_loader = NULL;
+
+// name relative to the manifest's directory (dirlen chars of path)
+static char* cart_manifest_path (const char* path, int dirlen, const char* name)
+{
+	char* full;
+	int len;
+
+	if (name[0] == '/' || (name[0] && name[1] == ':'))
+		dirlen = 0;
+	len = dirlen + strlen(name) + 1;
+	if ((full = (char*)malloc(len)) == NULL)
+	{
+		printerrno("malloc(%i) for manifest", len);
+		return NULL;
+	}
+	snprintf(full, len, "%.*s%s", dirlen, path, name);
+	return full;
+}
+
+static int cart_manifest_add (char* rom, int offset)
+{
+	char** roms;
+	int* offsets;
+
+	roms = (char**)realloc(cart_manifest_rom, (cart_manifest_number + 1) * sizeof(char*));
+	if (roms)
+		cart_manifest_rom = roms;
+	offsets = (int*)realloc(cart_manifest_offset, (cart_manifest_number + 1) * sizeof(int));
+	if (offsets)
+		cart_manifest_offset = offsets;
+	if (!roms || !offsets)
+	{
+		printerrno("realloc(%i) for manifest", (cart_manifest_number + 1) * (int)sizeof(char*));
+		free(rom);
+		return -1;
+	}
+	cart_manifest_rom[cart_manifest_number] = rom;
+	cart_manifest_offset[cart_manifest_number++] = offset;
+	return 0;
+}
+
+int cart_manifest_load (const char* path, char** loader_file)
+{
+	FILE* f;
+	char line [MANIFEST_LINELEN];
+	const char* slash;
+	int dirlen, lineno = 0, ret = 0;
+
+	if ((f = fopen(path, "r")) == NULL)
+	{
+		printerrno("fopen(%s)", path);
+		return -1;
+	}
+	slash = strrchr(path, '/');
+#if _WIN32
+	if (strrchr(path, '\\') > slash)
+		slash = strrchr(path, '\\');
+#endif
+	dirlen = slash? slash - path + 1: 0;
+
+	while (fgets(line, MANIFEST_LINELEN, f))
+	{
+		char* item = line;
+		char* end;
+		char* at;
+		char* rom;
+		FILE* loader;
+		int offset = -1;
+
+		lineno++;
+		while (isspace(*item))
+			item++;
+		for (end = item + strlen(item); end > item && isspace(end[-1]); end--);
+		*end = 0;
+		if (item[0] == 0 || item[0] == '#')
+			continue;
+
+		if (strncmp(item, "loader", 6) == 0 && isspace(item[6]))
+		{
+			for (item += 7; isspace(*item); item++);
+			free(cart_manifest_loader);
+			if ((cart_manifest_loader = cart_manifest_path(path, dirlen, item)) == NULL)
+			{
+				ret = -1;
+				continue;
+			}
+			// not a file: internal loader name
+			if ((loader = fopen(cart_manifest_loader, "rb")))
+				fclose(loader);
+			else
+				strcpy(cart_manifest_loader, item);
+			continue;
+		}
+
+		// fixed offset
+		if ((at = strrchr(item, '@')) && (at == item || isspace(at[-1])))
+		{
+			offset = strtol(at + 1, &end, 0);
+			if (at[1] == 0 || *end || offset < 0)
+			{
+				printerr("%s:%i: bad offset '%s'\n", path, lineno, at + 1);
+				ret = -1;
+				continue;
+			}
+			for (end = at; end > item && isspace(end[-1]); end--);
+			*end = 0;
+		}
+		if (item[0] == 0 || item[0] == ',')
+		{
+			printerr("%s:%i: rom file is missing\n", path, lineno);
+			ret = -1;
+			continue;
+		}
+
+		if ((rom = cart_manifest_path(path, dirlen, item)) == NULL || cart_manifest_add(rom, offset) < 0)
+			ret = -1;
+	}
+	fclose(f);
+
+	if (ret == 0 && cart_manifest_loader && !*loader_file)
+		*loader_file = cart_manifest_loader;
+	return ret;
+}
+
+int cart_manifest_loader_burned (const binware_s* loader)
+{
+	int size = trim(loader->data, loader->size);
+	unsigned char* data;
+	int ret;
+
+	if ((data = (unsigned char*)malloc(size)) == NULL)
+	{
+		printerrno("malloc(%i) to check loader", size);
+		return -1;
+	}
+	if ((ret = cart_read_mem(data, GBA_ROM, size)) == 0)
+		ret = memcmp(data, loader->data, size) == 0;
+	free(data);
+	return ret;
+}
+
+int cart_manifest_sync (void)
+{
+	return cart_map_sync((const char**)cart_manifest_rom, cart_manifest_offset, cart_manifest_number);
+}
+
+int cart_manifest_prefetch (void)
+{
+	return cart_map_prefetch((const char**)cart_manifest_rom, cart_manifest_number);
+}
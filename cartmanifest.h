@@ -0,0 +1,27 @@
+/*
+ * Based in f2a by Ulrich Hecht <uli@emulinks.de>
+ * if2a by D. Gauchard <deyv@free.fr>
+ * F2A Ultra support by Vincent Rubiolo <vincent.rubiolo@free.fr>
+ * Licensed under the terms of the GNU Public License version 2
+ */
+
+// Cart manifest (-V): the whole wanted contents of the cart
+
+#ifndef __CARTMANIFEST_H__
+#define __CARTMANIFEST_H__
+
+#include "libf2a.h"
+
+// reads manifest file, sets *loader_file to its loader if it is NULL, returns -1 if error
+int		cart_manifest_load		(const char* file, char** loader_file);
+
+// 1 if cart already starts with loader, 0 if not, -1 if error
+int		cart_manifest_loader_burned	(const binware_s* loader);
+
+// cart_map_sync() with the manifest roms
+int		cart_manifest_sync		(void);
+
+// cart_map_prefetch() with the manifest roms
+int		cart_manifest_prefetch		(void);
+
+#endif // __CARTMANIFEST_H__
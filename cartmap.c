@@ -5,15 +5,22 @@
  * Licensed under the terms of the GNU Public License version 2
  */
 
+#include <stdio.h>
 #include <math.h>
 #include <stdlib.h>
 #include <string.h>
 #include <assert.h>
+#include <time.h>
 
 #include "libf2a.h"
 #include "cartmap.h"
 #include "cartrom.h"
 #include "cartutils.h"
+#include "cartcatalog.h"
+#include "cartthread.h"
+#include "cartwear.h"
+#include "cartspace.h"
+#include "cartrate.h"
 
 /*///////////////////////////////////////////////////////////////////////////
 
@@ -34,7 +41,8 @@ first by the function load_cart_map().
 The goal is to insert new roms in the best places so to maximize the biggest
 empty place (called holes).
 In order to do so, what is then done is:
-- find holes (variables cart_map_hole*) (including the removed roms)
+- find holes (variables cart_map_hole*) (including the removed roms), from
+  the free space of the cart (cart_map_space, see cartspace.h)
 - find the best places for new roms (variables cart_map_file*)
 - build an action map (variables cart_map_file* too) this will reflects the
   exact rom map before burning (whole space: kept+added rom and holes).  the
@@ -42,7 +50,8 @@ In order to do so, what is then done is:
   from list.
 - build the new map to burn and replace the old one (variables cart_map_new*)
 - and finally burn everything, chunk by chunk.
-  a chunk is a group of contiguous roms (including map) to burn.
+  a chunk is a group of contiguous roms to burn, the map is burned last
+  (see burn journal).
 
 Some notes:
 
@@ -54,10 +63,16 @@ might be some remaining holes, whose sizes are called holesize(i,j) for each
 hole numbered #i for the placement #j. The placement score is then
 calculated this way:
 	score of placement #j = sum(holesize(i,j)^2), i in 1..nbholes(j)
-All possible placements are tried and the one with the best score is
-retained. That's the way it works now, please tell me if you find out a
-better way. (maybe a rom size sorting when more than one rom is added
-at the same time?)
+The placement with the best score is retained. It is searched by a branch
+and bound placing roms largest first (see cart_map_search()), which finds
+the same best score as trying all possible placements.
+The time needed to burn a placement can be weighted in the score too
+(cart_plan_burn_weight, see cart_map_burn_cost()): roms placed in a hole
+are burned as one chunk, whose borders are rounded to write blocks and
+read back from cart, and the chunk of the map is merged with the roms
+placed right after it. The wear of the write blocks burned can be weighted
+too (cart_plan_wear_weight, see cartwear.c), so that the most programmed
+blocks are avoided.
 The best placement is processed by cart_map_find_best_insertion_for_files().
 
 2) To burn a rom in the cart, one has to respect the cart's constraints
@@ -69,13 +84,29 @@ filesystem but is also able to use roms out from the filesystem). So when a
 chunk has to be burned, it never has the good size or position: the
 borders of the chunk have to be read from the cart to get a good size and
 position to burn. That's the burn_map_chunk()'s job. It is called by
-cart_map_process_changes().
+cart_map_process_changes(), which first merges chunks sharing write blocks
+and reads all their borders in one pass, so that each write block is
+erased and programmed once.
 
 3) When a rom is removed, it is only removed from the map. Its header is not
 wiped out from the cart. It is not a problem. If the header is still valid,
 then the whole rom is still valid. If later something is burned over, the
 header will be affected first and this rom won't show up anymore in the gba
-loader.
+loader. Removed roms are remembered on host side, so that when one of them
+is added again and is still there, it is only put back in map (see
+cart_map_reuse_removed()). Like every host side record about a cart, they
+are kept per cart identity, a random number burned in the locator when the
+cart gets its first IF2A-0003 map (cart_map_identity).
+
+4) The map is burned in IF2A-0003 format (IF2A-0002 maps are still read,
+and converted when burned). Each entry has a crc32: a corrupted entry
+keeps its place under MAP_CORRUPTED_NAME when its offset and size are
+plausible, otherwise the map cannot be changed anymore (the place of a rom
+is unknown). The locator has a generation counter.
+The locator always ends loader+map, but when the table does not fit
+there anymore it is relocated into its own rom blocks, which are an entry
+of the map (MAP_TABLE_NAME), so that it is kept out of holes. See
+cart_map_build_new().
 
 ///////////////////////////////////////////////////////////////////////////*/
 
@@ -85,6 +116,9 @@ unsigned char*	cart_around_map = NULL;
 int		cart_around_map_offset = 0;
 int		cart_around_map_size = 0;
 int		cart_map_location = 0;
+int		cart_map_area_location = 0;	// table space after loader (cart_map_location unless relocated)
+u_int32_t	cart_map_generation = 0;
+u_int32_t	cart_map_identity = 0;
 int		loader_and_cart_map_size = 0;
 
 ///////////
@@ -92,6 +126,7 @@ int		loader_and_cart_map_size = 0;
 int		cart_map_max_number = 0;
 int		cart_map_number = 0;
 cart_map_s*	cart_map = NULL;
+static int	cart_map_lost = 0;		// corrupted entries which could not be kept
 
 /////////////
 // new loader
@@ -103,6 +138,7 @@ int		new_loader_trimmed_size = 0;
 // hole management
 cart_map_s*	cart_map_hole = NULL;
 int		cart_map_hole_number = -1;
+static cart_space_s*	cart_map_space = NULL;
 
 ////////////////////////////////////
 // new burned cart map after changes
@@ -111,6 +147,9 @@ cart_map_s* cart_map_new = NULL;
 int cart_map_new_number = 0;
 int cart_map_new_max_number = 0;
 int cart_map_new_location = 0;
+int cart_map_new_area_location = 0;
+static unsigned char* cart_map_table = NULL;	// relocated table to burn
+static int cart_map_table_index = -1;		// its change_map_file index
 
 ///////////////////////////////////
 // rom insertion in cart management
@@ -130,7 +169,9 @@ typedef struct
 	char romname [MAP_NAMELEN];	// rom name (add, del & keep funcs)
 	char* userromname;		// rom name overwrite if not NULL (add func)
 	int original_size;		// file original size
+	u_int32_t crc;			// file crc32 (from catalog)
 	int size;			// after trim and expand to CART_ROM_BLOCK_SIZE
+	unsigned char* data;		// size bytes ready to burn, NULL: to be loaded when burning
 	
 	// section 2 (needs section 1 to be built)
 	// used to find best placement
@@ -143,10 +184,16 @@ typedef struct
 	map_action_e	action;
 } cart_map_file_s;
 
-cart_map_file_s		cart_map_file[FILE_NUMBER_MAX];
+cart_map_file_s*	cart_map_file = NULL;
 int			cart_map_file_number = 0;
+static int		cart_map_file_max_number = 0;
 static int*		cart_map_hole_remaining_size = NULL;
 
+// roms which have to be at a given offset (see cart_map_sync()), in offset
+// order: each one has an empty hole there
+static cart_map_file_s*	cart_map_fixed = NULL;
+static int		cart_map_fixed_number = 0;
+
 cart_map_file_s*	change_map_file = NULL;
 int			change_map_file_number = 0;
 
@@ -154,6 +201,73 @@ static u_int64_t	cart_map_insertion_best_score = 0;
 
 static int		something_to_be_done = 0;
 
+// memory allowed to keep added roms between planning and burning
+#define PAYLOAD_BUDGET		(64 * 1024 * 1024)
+static int		cart_map_payload_size = 0;	// reserved by preparation jobs first
+static cart_lock_s*	cart_map_payload_lock = NULL;
+
+/////////////////////////////
+// burn journal (host side)
+
+#define JOURNAL_NAME		"journal"
+#define JOURNAL_DATA_NAME	"journal.data"
+#define JOURNAL_HEADER		"# if2a burn journal v1\n"
+#define JOURNAL_LINELEN		1200
+#define JOURNAL_AREA_NAME	"Loader+map"
+
+typedef enum
+{
+	JOURNAL_TODO,
+	JOURNAL_BURNING,	// borders are saved, cart may be erased there
+	JOURNAL_DONE,
+} journal_state_e;
+
+typedef struct
+{
+	int		offset;		// change range
+	int		size;
+	journal_state_e	state;
+	long		borders;	// offset of borders bytes in journal data, -1 if not saved
+	int		first, last;	// items
+} cart_map_journal_chunk_s;
+
+typedef struct
+{
+	cart_map_file_s	file;		// filename (absolute), userromname and data are owned
+	long		data;		// offset of its bytes in journal data, -1: rom file
+} cart_map_journal_item_s;
+
+static cart_map_journal_chunk_s*	cart_map_journal_chunk = NULL;
+static int				cart_map_journal_chunk_number = 0;
+static cart_map_journal_item_s*		cart_map_journal_item = NULL;
+static int				cart_map_journal_item_number = 0;
+static u_int32_t			cart_map_journal_generation = 0;	// of map in cart when planned
+static u_int32_t			cart_map_journal_identity = 0;		// of map to burn
+static u_int32_t			cart_map_journal_table = 0;		// crc32 of its table (see cart_map_table_crc())
+static int				cart_map_journal_new = 0;		// map is created
+static int				cart_map_journal_mbits = 0;
+static int				cart_map_journal_locator = 0;
+
+static void cart_map_journal_free (void)
+{
+	while (cart_map_journal_item_number > 0)
+	{
+		cart_map_file_s* file = &cart_map_journal_item[--cart_map_journal_item_number].file;
+		free((char*)file->filename);
+		if (file->userromname)
+			free(file->userromname);
+		if (file->data)
+			free(file->data);
+	}
+	if (cart_map_journal_item)
+		free(cart_map_journal_item);
+	cart_map_journal_item = NULL;
+	if (cart_map_journal_chunk)
+		free(cart_map_journal_chunk);
+	cart_map_journal_chunk = NULL;
+	cart_map_journal_chunk_number = 0;
+}
+
 ///////////////////////////////////////
 
 void reset_cart_map (void)
@@ -168,6 +282,10 @@ void reset_cart_map (void)
 	cart_around_map_offset = 0;
 	cart_around_map_size = 0;
 	cart_map_location = 0;
+	cart_map_area_location = 0;
+	cart_map_generation = 0;
+	cart_map_identity = 0;
+	cart_map_lost = 0;
 	loader_and_cart_map_size = 0;
 	
 	// new loader
@@ -180,15 +298,34 @@ void reset_cart_map (void)
 		free(cart_map_hole);
 	cart_map_hole = NULL;
 	cart_map_hole_number = 0;
+	cart_space_destroy(cart_map_space);
+	cart_map_space = NULL;
 	
 	// insertion
 	
+	// (prefetched payloads are still counted)
+	while (cart_map_file_number > 0)
+		if (cart_map_file[--cart_map_file_number].data)
+		{
+			free(cart_map_file[cart_map_file_number].data);
+			cart_map_file[cart_map_file_number].data = NULL;
+			cart_map_payload_size -= cart_map_file[cart_map_file_number].size;
+		}
 	if (cart_map_hole_remaining_size)
 		free(cart_map_hole_remaining_size);
 	cart_map_hole_remaining_size = NULL;
 	cart_map_hole_number = 0;
 	cart_map_file_number = 0;
 	cart_map_insertion_best_score = 0;
+	while (cart_map_fixed_number > 0)
+		if (cart_map_fixed[--cart_map_fixed_number].data)
+		{
+			free(cart_map_fixed[cart_map_fixed_number].data);
+			cart_map_payload_size -= cart_map_fixed[cart_map_fixed_number].size;
+		}
+	if (cart_map_fixed)
+		free(cart_map_fixed);
+	cart_map_fixed = NULL;
 	
 	if (change_map_file)
 		free(change_map_file);
@@ -201,6 +338,14 @@ void reset_cart_map (void)
 	cart_map_new_number = 0;
 	cart_map_new_max_number = 0;
 	cart_map_new_location = 0;
+	cart_map_new_area_location = 0;
+	if (cart_map_table)
+		free(cart_map_table);
+	cart_map_table = NULL;
+	cart_map_table_index = -1;
+	
+	// journal (files are kept)
+	cart_map_journal_free();
 }
 
 ///////////////////////
@@ -216,14 +361,83 @@ void convert_cart_map_endian_from_cart_to_host (cart_map_s* cart_map, int cart_m
 	}
 }
 
-void convert_cart_map_endian_from_host_to_cart (cart_map_s* cart_map, int cart_map_max_number)
+static u_int32_t cart_map_entry_crc (const cart_map_entry_s* entry)
 {
-	int i;
+	return ~cart_crc32_update(0xffffffff, (const unsigned char*)entry, sizeof(cart_map_entry_s) - sizeof(entry->crc));
+}
+
+// IF2A-0003 table is converted in place to host entries (which are smaller),
+// corrupted entries are kept as MAP_CORRUPTED_NAME if they look like a rom
+// place (cart_map_lost counts the others), returns the number of entries up
+// to terminator
+static int convert_cart_map_from_cart_v3 (unsigned char* table, int cart_map_max_number)
+{
+	cart_map_s* cart_map = (cart_map_s*)table;
+	cart_map_entry_s entry;
+	int i, number = 0;
+
 	for (i = 0; i < cart_map_max_number; i++)
 	{
-		cart_map[i].offset = hton32(cart_map[i].offset);
-		cart_map[i].size = hton32(cart_map[i].size);
+		memcpy(&entry, &table[i * sizeof(cart_map_entry_s)], sizeof(cart_map_entry_s));
+		if (ntoh32(entry.crc) != cart_map_entry_crc(&entry))
+		{
+			u_int32_t offset = ntoh32(entry.offset);
+			u_int32_t size = ntoh32(entry.size);
+
+			if (   size == 0
+			    || offset % CART_ROM_BLOCK_SIZE
+			    || size % CART_ROM_BLOCK_SIZE
+			    || (long long)offset + size > CART_SIZE_BYTES)
+			{
+				printerr("Cart map entry #%i is corrupted, the place of its rom is unknown.\n", i);
+				cart_map_lost++;
+				continue;
+			}
+			printerr("Cart map entry #%i is corrupted, its place (offset=0x%x size=0x%x) is kept as '%s'.\n",
+				 i, offset, size, MAP_CORRUPTED_NAME);
+			strcpy(entry.name, MAP_CORRUPTED_NAME);
+		}
+		memcpy(cart_map[number].name, entry.name, MAP_NAMELEN);
+		cart_map[number].offset = ntoh32(entry.offset);
+		cart_map[number].size = ntoh32(entry.size);
+		if (cart_map[number].size == 0)
+			break;
+		number++;
+	}
+	return number;
+}
+
+// number entries (terminator included if any) to IF2A-0003 table
+static void convert_cart_map_to_cart_v3 (unsigned char* table, const cart_map_s* cart_map, int number)
+{
+	cart_map_entry_s entry;
+	int i;
+
+	for (i = 0; i < number; i++)
+	{
+		// (bytes after the name are not initialized in memory)
+		memset(entry.name, 0, MAP_NAMELEN);
+		strncpy(entry.name, cart_map[i].name, MAP_NAMELEN - 1);
+		entry.offset = hton32(cart_map[i].offset);
+		entry.size = hton32(cart_map[i].size);
+		entry.crc = hton32(cart_map_entry_crc(&entry));
+		memcpy(&table[i * sizeof(cart_map_entry_s)], &entry, sizeof(cart_map_entry_s));
+	}
+}
+
+// crc32 of number entries as they are in an IF2A-0003 table
+static u_int32_t cart_map_table_crc (const cart_map_s* cart_map, int number)
+{
+	unsigned char entry [sizeof(cart_map_entry_s)];
+	u_int32_t crc = 0xffffffff;
+	int i;
+
+	for (i = 0; i < number; i++)
+	{
+		convert_cart_map_to_cart_v3(entry, &cart_map[i], 1);
+		crc = cart_crc32_update(crc, entry, sizeof(entry));
 	}
+	return ~crc;
 }
 
 ///////////////////////////////////////
@@ -285,8 +499,34 @@ void display_cart_map (void)
 	display_cart_map_ptr(cart_map, cart_map_number, /* map has loader */ 0);
 }
 
+// a cart without identity (IF2A-0002 map) gets one with its first IF2A-0003 map
+static u_int32_t cart_map_identity_new (void)
+{
+	long long seed [2];
+	u_int32_t identity;
+
+	seed[0] = time(NULL);
+	seed[1] = cart_time_ms();
+	identity = ~cart_crc32_update(0xffffffff, (const unsigned char*)seed, sizeof(seed));
+	return identity? identity: 1;
+}
+
 void brand_new_empty_cart_map (void)
 {
+	u_int32_t generation = 0;
+	u_int32_t identity = 0;
+
+	// a map already on cart is replaced: the new one is a later generation
+	// (its locator may stay elsewhere), and the cart keeps its identity
+	if (cart_io_sim <= 1 && cart_map_locate() == 1)
+	{
+		generation = cart_map_generation;
+		identity = cart_map_identity;
+	}
+	reset_cart_map();
+	cart_map_generation = generation;
+	cart_map_identity = identity;
+
 	cart_map_max_number = 8;
 	cart_map_number = 0;
 	loader_and_cart_map_size = cart_map_max_number * sizeof(cart_map_s);
@@ -300,11 +540,259 @@ void brand_new_empty_cart_map (void)
 	cart_map[0].size = 0;
 }
 
-int load_cart_map (void)
+int load_cart_map_at (const unsigned char* small_cart, int offset)
+{
+	const cart_map_locator_s* endian_locator = (const cart_map_locator_s*)&small_cart[SIZE_1K - sizeof(cart_map_locator_s)];
+	const cart_map_locator_v3_s* endian_locator_v3 = (const cart_map_locator_v3_s*)&small_cart[SIZE_1K - sizeof(cart_map_locator_v3_s)];
+	int entry_size;
+
+	switch (ntoh32(endian_locator->magic))
+	{
+	case MAP_MAGIC_V2:
+		entry_size = sizeof(cart_map_s);
+		cart_map_generation = 0;
+		cart_map_identity = 0;
+		cart_map_area_location = ntoh32(endian_locator->location);
+		break;
+	case MAP_MAGIC:
+		entry_size = sizeof(cart_map_entry_s);
+		cart_map_generation = ntoh32(endian_locator_v3->generation);
+		cart_map_identity = ntoh32(endian_locator_v3->identity);
+		cart_map_area_location = ntoh32(endian_locator_v3->area_location);
+		break;
+	default:
+		return 0;
+	}
+
+	cart_map_max_number = ntoh16(endian_locator->number_of_entries);
+	cart_map_location = ntoh32(endian_locator->location);
+	loader_and_cart_map_size = offset + CART_ROM_BLOCK_SIZE;
+
+	if (cart_verbose)
+		print("Rom map locator found ! - version %x generation %u identity %08x - offset=0x%x size=0x%x (%i roms)\n", 
+		       ntoh32(endian_locator->magic) & 0xffff,
+		       cart_map_generation,
+		       cart_map_identity,
+		       cart_map_location, 
+		       cart_map_max_number * entry_size,
+		       cart_map_max_number);
+
+	// Reload in a proper dimensionned place
+
+	cart_around_map_offset = GBA_ROM + cart_map_location;
+	cart_around_map_size = cart_map_max_number * entry_size;
+	adjust_load_addresses(&cart_around_map_offset, &cart_around_map_size);
+
+	// (room for a terminator when map is full)
+	assert(cart_around_map == NULL);
+	if ((cart_around_map = (unsigned char*)malloc(cart_around_map_size + sizeof(cart_map_s))) == NULL)
+	{
+		printerrno("Cannot allocate %i bytes to load cart map: malloc:", cart_around_map_size);
+		return -1;
+	}
+
+	if (cart_read_mem(cart_around_map, cart_around_map_offset, cart_around_map_size) == -1)
+	{
+		reset_cart_map();
+		return -1;
+	}
+
+	cart_map = (cart_map_s*)&cart_around_map[cart_map_location - (cart_around_map_offset - GBA_ROM)];
+	if (entry_size == sizeof(cart_map_entry_s))
+		cart_map_number = convert_cart_map_from_cart_v3((unsigned char*)cart_map, cart_map_max_number);
+	else
+	{
+		convert_cart_map_endian_from_cart_to_host(cart_map, cart_map_max_number);
+		for (cart_map_number = 0;
+		        cart_map_number < cart_map_max_number
+		     && cart_map[cart_map_number].size > 0;
+		     cart_map_number++);
+	}
+	if (cart_map_number == cart_map_max_number)
+	{
+		strcpy(cart_map[cart_map_number].name, "nomore");
+		cart_map[cart_map_number].size = cart_map[cart_map_number].offset = 0;
+	}
+
+	return 1;
+}
+
+////////////////////////////////////////
+// map locator discovery
+
+// host side file, one "cart-size-in-Mbits 0xoffset" line per locator block found, most recent first
+#define LOCATOR_NAME		"locator"
+#define LOCATOR_HEADER		"# if2a map locator hints v1\n"
+#define LOCATOR_LINELEN		64
+#define LOCATOR_HINTS		8		// lines kept
+#define LOCATOR_CANDIDATES	64
+#define LOCATOR_LOADER_BLOCKS	2		// blocks probed from the smallest loader+map size
+#define LOCATOR_SCAN_BYTES	(1024 * 1024)	// scan stops there unless cart_map_full_scan
+
+extern binware_s binware_f2a_loader_pro [];
+extern binware_s binware_f2a_loader_ultra [];
+
+int		cart_map_full_scan = 0;
+
+static int	locator_hint_mbits [LOCATOR_HINTS];
+static int	locator_hint_offset [LOCATOR_HINTS];
+static int	locator_hint_number = 0;
+static int	locator_scan_end = 0;		// where last search stopped
+
+static void cart_map_locator_hints_load (void)
+{
+	FILE* f;
+	char line [LOCATOR_LINELEN];
+
+	locator_hint_number = 0;
+	if ((f = fopen(cart_home_file(LOCATOR_NAME), "r")) == NULL)
+		// no map found yet
+		return;
+	while (locator_hint_number < LOCATOR_HINTS && fgets(line, LOCATOR_LINELEN, f))
+	{
+		int mbits;
+		unsigned int offset;
+
+		if (line[0] == '#')
+			continue;
+		if (sscanf(line, "%i %x", &mbits, &offset) != 2 || offset % CART_ROM_BLOCK_SIZE)
+			continue;
+		locator_hint_mbits[locator_hint_number] = mbits;
+		locator_hint_offset[locator_hint_number] = offset;
+		locator_hint_number++;
+	}
+	fclose(f);
+}
+
+// offset becomes the most recent hint, returns -1 if error
+static int cart_map_locator_hints_save (int offset)
+{
+	FILE* f;
+	char tmpname [1024];
+	int i, saved;
+
+	cart_map_locator_hints_load();
+	if (locator_hint_number && locator_hint_mbits[0] == cart_size_mbits && locator_hint_offset[0] == offset)
+		return 0;
+
+	snprintf(tmpname, sizeof(tmpname), "%s.new", cart_home_file(LOCATOR_NAME));
+	if ((f = fopen(tmpname, "w")) == NULL)
+	{
+		printerrno("fopen(%s)", tmpname);
+		return -1;
+	}
+	fputs(LOCATOR_HEADER, f);
+	fprintf(f, "%i 0x%x\n", cart_size_mbits, offset);
+	for (i = 0, saved = 1; i < locator_hint_number && saved < LOCATOR_HINTS; i++)
+		if (locator_hint_mbits[i] != cart_size_mbits || locator_hint_offset[i] != offset)
+		{
+			fprintf(f, "%i 0x%x\n", locator_hint_mbits[i], locator_hint_offset[i]);
+			saved++;
+		}
+	if (fclose(f) != 0)
+	{
+		printerrno("write(%s)", tmpname);
+		return -1;
+	}
+
+#if _WIN32
+	remove(cart_home_file(LOCATOR_NAME));
+#endif
+	if (rename(tmpname, cart_home_file(LOCATOR_NAME)) != 0)
+	{
+		printerrno("rename(%s)", tmpname);
+		return -1;
+	}
+	return 0;
+}
+
+static int cart_map_locator_add (int* candidate, int number, int offset)
+{
+	int i;
+
+	if (offset < 0 || offset + CART_ROM_BLOCK_SIZE > CART_SIZE_BYTES)
+		return number;
+	for (i = 0; i < number; i++)
+		if (candidate[i] == offset)
+			return number;
+	if (number < LOCATOR_CANDIDATES)
+		candidate[number++] = offset;
+	return number;
+}
+
+// where a map burned along with this loader has its locator (see cart_map_build_hole())
+static int cart_map_locator_add_loader (int* candidate, int number, const binware_s* binware)
+{
+	int size;
+	int i;
+
+	if (!binware->data || binware->size <= 0)
+		return number;
+	size = trim(binware->data, binware->size) + sizeof(cart_map_locator_v3_s) + MAP_MINIMUM_ENTRIES * sizeof(cart_map_entry_s);
+	adjust_rom_size(&size);
+	for (i = 0; i < LOCATOR_LOADER_BLOCKS; i++)
+		number = cart_map_locator_add(candidate, number, size - CART_ROM_BLOCK_SIZE + i * CART_ROM_BLOCK_SIZE);
+	return number;
+}
+
+// small_cart: last 1K of a rom block, returns 1 if it ends with a locator
+// (its map generation is set), 0 if not
+static int cart_map_locator_at (const unsigned char* small_cart, u_int32_t* generation)
+{
+	const cart_map_locator_s* endian_locator = (const cart_map_locator_s*)&small_cart[SIZE_1K - sizeof(cart_map_locator_s)];
+	const cart_map_locator_v3_s* endian_locator_v3 = (const cart_map_locator_v3_s*)&small_cart[SIZE_1K - sizeof(cart_map_locator_v3_s)];
+
+	switch (ntoh32(endian_locator->magic))
+	{
+	case MAP_MAGIC_V2:
+		*generation = 0;
+		return 1;
+	case MAP_MAGIC:
+		*generation = ntoh32(endian_locator_v3->generation);
+		return 1;
+	}
+	return 0;
+}
+
+// keeps the locator of block at offset if its generation is the highest
+// yet, returns 1 if there is a locator, 0 if not, -1 if error
+static int load_cart_map_probe (int offset, unsigned char* best, int* best_offset, u_int32_t* best_generation)
+{
+	unsigned char small_cart [SIZE_1K];
+	u_int32_t generation;
+
+	if (cart_read_mem(small_cart, GBA_ROM + offset + CART_ROM_BLOCK_SIZE - SIZE_1K, SIZE_1K) == -1)
+		return -1;
+	if (!cart_map_locator_at(small_cart, &generation))
+		return 0;
+	if (cart_verbose)
+		print("Locator at 0x%x, generation %u\n", offset + CART_ROM_BLOCK_SIZE - SIZE_1K, generation);
+	if (*best_offset < 0 || generation > *best_generation)
+	{
+		memcpy(best, small_cart, SIZE_1K);
+		*best_offset = offset;
+		*best_generation = generation;
+	}
+	return 1;
+}
+
+// loads cart map if its locator is found, returns 1 if found, 0 if not,
+// -1 if error (nothing is told when it is not found)
+// Locators left by previous maps (another loader, or a new map over an old
+// one) may still be there: of all the likely places, or else of all the
+// blocks scanned, the locator of the latest map generation is taken.
+int cart_map_locate (void)
 {
-	unsigned char		small_cart [SIZE_1K];
-	cart_map_locator_s*	endian_locator = NULL;
+	int			candidate [LOCATOR_CANDIDATES];
+	int			candidate_number = 0;
+	int			scan_end;
+	int			probes = 0;
 	int			offset;
+	int			i;
+	unsigned char		best [SIZE_1K];
+	int			best_offset = -1;
+	u_int32_t		best_generation = 0;
+	int			found;
 	
 	if (cart_io_sim > 1)
 	{
@@ -312,59 +800,253 @@ int load_cart_map (void)
 		return -1;
 	}
 	
+	// Likely places first: where map was last found on a cart of this size,
+	// then right after the known loaders
+	cart_map_locator_hints_load();
+	for (i = 0; i < locator_hint_number; i++)
+		if (locator_hint_mbits[i] == cart_size_mbits)
+			candidate_number = cart_map_locator_add(candidate, candidate_number, locator_hint_offset[i]);
+	candidate_number = cart_map_locator_add_loader(candidate, candidate_number, &loader);
+	for (i = 0; binware_f2a_loader_pro[i].size; i++)
+		candidate_number = cart_map_locator_add_loader(candidate, candidate_number, &binware_f2a_loader_pro[i]);
+	for (i = 0; binware_f2a_loader_ultra[i].size; i++)
+		candidate_number = cart_map_locator_add_loader(candidate, candidate_number, &binware_f2a_loader_ultra[i]);
+
+	// Then every block, up to a bit farther than any known loader
+	scan_end = CART_SIZE_BYTES;
+	if (!cart_map_full_scan)
+	{
+		scan_end = LOCATOR_SCAN_BYTES;
+		for (i = 0; i < candidate_number; i++)
+			scan_end = MAX(scan_end, candidate[i] + LOCATOR_LOADER_BLOCKS * CART_ROM_BLOCK_SIZE);
+		scan_end = MIN(scan_end, CART_SIZE_BYTES);
+	}
+	locator_scan_end = scan_end;
+
 	// Find locator
 	if (cart_verbose)
-		print("Searching for locator...\n");
-	for (offset = 0; !endian_locator && offset < CART_SIZE_BYTES; offset += CART_ROM_BLOCK_SIZE)
+		print("Searching for locator (%i likely places, then up to 0x%x)...\n", candidate_number, scan_end);
+	for (i = 0; i < candidate_number + scan_end / CART_ROM_BLOCK_SIZE; i++)
 	{
-		if (cart_read_mem(small_cart, GBA_ROM + offset + CART_ROM_BLOCK_SIZE - SIZE_1K, SIZE_1K) == -1)
+		// likely places were enough
+		if (i == candidate_number && best_offset >= 0)
+			break;
+		if (i < candidate_number)
+			offset = candidate[i];
+		else
+		{
+			int j;
+
+			offset = (i - candidate_number) * CART_ROM_BLOCK_SIZE;
+			for (j = 0; j < candidate_number && candidate[j] != offset; j++);
+			if (j < candidate_number)
+				// already probed
+				continue;
+		}
+		probes++;
+		if (load_cart_map_probe(offset, best, &best_offset, &best_generation) < 0)
 			return -1;
-		endian_locator = (cart_map_locator_s*)&small_cart[SIZE_1K - sizeof(cart_map_locator_s)];
-		if (ntoh32(endian_locator->magic) == MAP_MAGIC)
+	}
+	if (best_offset < 0)
+		return 0;
+
+	if (cart_verbose)
+		print("Locator found after %i probes\n", probes);
+	if ((found = load_cart_map_at(best, best_offset)) == 1)
+		// hints are only a shortcut
+		cart_map_locator_hints_save(best_offset);
+	return found;
+}
+
+int load_cart_map (void)
+{
+	FILE* f;
+	int found;
+
+	if ((found = cart_map_locate()) != 0)
+		return found < 0? -1: 0;
+
+	if (cart_map_full_scan || locator_scan_end == CART_SIZE_BYTES)
+		printerr("Could not find cart map locator.\n");
+	else
+		printerr("Could not find cart map locator in first %gMbits (-y searches whole cart).\n", locator_scan_end * 8.0 / 1024 / 1024);
+	if ((f = fopen(cart_home_file(JOURNAL_NAME), "r")) != NULL)
+	{
+		fclose(f);
+		printerr("A burn has been interrupted, it may have erased the map: it can be resumed with -q.\n");
+	}
+	return -1;
+}
+
+int cart_map_rom_size_at (int offset)
+{
+	int i;
+	for (i = 0; i < cart_map_number; i++)
+		if (cart_map[i].name[0] && (int)cart_map[i].offset == offset)
+			return cart_map[i].size;
+	return 0;
+}
+
+////////////////////////////////////////
+// roms removed from map, still on cart
+
+// host side file per cart, one "offset size<TAB>name" line per removed rom
+#define REMOVED_NAME		"removed-%08x"
+#define REMOVED_HEADER		"# if2a removed roms v1\n"
+#define REMOVED_LINELEN		256
+
+static cart_map_s*	cart_map_removed = NULL;
+static int		cart_map_removed_number = 0;
+static int		cart_map_removed_max_number = 0;
+static int		cart_map_removed_loaded = 0;
+static int		cart_map_removed_changed = 0;
+static u_int32_t	cart_map_removed_identity = 0;	// cart they are on
+
+static const char* cart_map_removed_file (void)
+{
+	char name [32];
+
+	snprintf(name, sizeof(name), REMOVED_NAME, cart_map_removed_identity);
+	return cart_home_file(name);
+}
+
+// remembers rom (replacing the one at same offset), returns -1 if error
+static int cart_map_removed_store (const cart_map_s* rom)
+{
+	int i;
+
+	for (i = 0; i < cart_map_removed_number && cart_map_removed[i].offset != rom->offset; i++);
+	if (i == cart_map_removed_max_number)
+	{
+		int max_number = cart_map_removed_max_number? 2 * cart_map_removed_max_number: 16;
+		cart_map_s* bigger;
+		if ((bigger = (cart_map_s*)realloc(cart_map_removed, max_number * sizeof(cart_map_s))) == NULL)
 		{
-			cart_map_max_number = ntoh16(endian_locator->number_of_entries);
-			cart_map_location = ntoh32(endian_locator->location);
-			loader_and_cart_map_size = offset + CART_ROM_BLOCK_SIZE;
+			printerrno("realloc(%i) for removed roms", max_number * (int)sizeof(cart_map_s));
+			return -1;
+		}
+		cart_map_removed = bigger;
+		cart_map_removed_max_number = max_number;
+	}
+	cart_map_removed[i] = *rom;
+	if (i == cart_map_removed_number)
+		cart_map_removed_number++;
+	cart_map_removed_changed = 1;
+	return 0;
+}
 
-			if (cart_verbose)
-				print("Rom map locator found ! - offset=0x%x size=0x%x (%i roms)\n", 
-				       cart_map_location, 
-				       loader_and_cart_map_size - cart_map_location, 
-				       cart_map_max_number);
+static void cart_map_removed_forget (int index)
+{
+	memmove(&cart_map_removed[index], &cart_map_removed[index + 1], (--cart_map_removed_number - index) * sizeof(cart_map_s));
+	cart_map_removed_changed = 1;
+}
 
-			// Reload in a proper dimensionned place
+static int cart_map_removed_load (void)
+{
+	FILE* f;
+	char line [REMOVED_LINELEN];
+	int lineno = 0;
+
+	if (cart_map_removed_loaded && cart_map_removed_identity == cart_map_identity)
+		return 0;
+	// roms removed from a cart which gets its identity now are kept
+	if (cart_map_removed_loaded && !cart_map_removed_identity)
+	{
+		cart_map_removed_identity = cart_map_identity;
+		return 0;
+	}
+	cart_map_removed_loaded = 1;
+	cart_map_removed_identity = cart_map_identity;
+	cart_map_removed_number = 0;
+	cart_map_removed_changed = 0;
 
-			cart_around_map_offset = GBA_ROM + cart_map_location;
-			cart_around_map_size = cart_map_max_number * sizeof(cart_map_s);
-			adjust_load_addresses(&cart_around_map_offset, &cart_around_map_size);
+	// (nothing is recorded for a cart without identity)
+	if (!cart_map_removed_identity)
+		return 0;
+	if ((f = fopen(cart_map_removed_file(), "r")) == NULL)
+		// nothing removed yet
+		return 0;
 
-			assert(cart_around_map == NULL);
-			if ((cart_around_map = (unsigned char*)malloc(cart_around_map_size)) == NULL)
-			{
-				printerrno("Cannot allocate %i bytes to load cart map: malloc:", cart_around_map_size);
-				return -1;
-			}
+	while (fgets(line, REMOVED_LINELEN, f))
+	{
+		cart_map_s rom;
+		unsigned int offset, size;
+		char* name;
+		int len;
 
-			if (cart_read_mem(cart_around_map, cart_around_map_offset, cart_around_map_size) == -1)
+		lineno++;
+		if (line[0] == '#')
+			continue;
+		if ((len = strlen(line)) && line[len - 1] == '\n')
+			line[len - 1] = 0;
+		if (   sscanf(line, "%x %x", &offset, &size) != 2
+		    || (name = strchr(line, '\t')) == NULL
+		    || strlen(name + 1) >= MAP_NAMELEN)
+		{
+			printerr("%s:%i: bad line ignored\n", cart_map_removed_file(), lineno);
+			continue;
+		}
+		strcpy(rom.name, name + 1);
+		rom.offset = offset;
+		rom.size = size;
+		if (cart_map_removed_store(&rom) < 0)
+		{
+			fclose(f);
+			return -1;
+		}
+	}
+	fclose(f);
+
+	cart_map_removed_changed = 0;
+	return 0;
+}
+
+// forgets removed roms overwritten by the new map, then saves the others
+static int cart_map_removed_save (void)
+{
+	FILE* f;
+	char tmpname [1024];
+	int i, j;
+
+	if (cart_map_removed_load() < 0)
+		return -1;
+	for (i = cart_map_removed_number - 1; i >= 0; i--)
+		for (j = 0; j < cart_map_new_number; j++)
+			if (   cart_map_removed[i].offset < cart_map_new[j].offset + cart_map_new[j].size
+			    && cart_map_new[j].offset < cart_map_removed[i].offset + cart_map_removed[i].size)
 			{
-				reset_cart_map();
-				return -1;
+				cart_map_removed_forget(i);
+				break;
 			}
+	if (!cart_map_removed_changed || !cart_map_removed_identity)
+		return 0;
 
-			cart_map = (cart_map_s*)&cart_around_map[cart_map_location - (cart_around_map_offset - GBA_ROM)];
-			convert_cart_map_endian_from_cart_to_host(cart_map, cart_map_max_number);
-			for (cart_map_number = 0;
-			        cart_map_number < cart_map_max_number
-			     && cart_map[cart_map_number].size > 0;
-			     cart_map_number++);
+	snprintf(tmpname, sizeof(tmpname), "%s.new", cart_map_removed_file());
+	if ((f = fopen(tmpname, "w")) == NULL)
+	{
+		printerrno("fopen(%s)", tmpname);
+		return -1;
+	}
+	fputs(REMOVED_HEADER, f);
+	for (i = 0; i < cart_map_removed_number; i++)
+		fprintf(f, "0x%x 0x%x\t%s\n", cart_map_removed[i].offset, cart_map_removed[i].size, cart_map_removed[i].name);
+	if (fclose(f) != 0)
+	{
+		printerrno("write(%s)", tmpname);
+		return -1;
+	}
 
-			return 0;
-		}
-		else
-			endian_locator = NULL;
+#if _WIN32
+	remove(cart_map_removed_file());
+#endif
+	if (rename(tmpname, cart_map_removed_file()) != 0)
+	{
+		printerrno("rename(%s)", tmpname);
+		return -1;
 	}
-	printerr("Could not find cart map locator.\n");
-	return -1;
+
+	cart_map_removed_changed = 0;
+	return 0;
 }
 
 void cart_map_mark_for_remove (const char* del_files[], int del_files_number)
@@ -374,8 +1056,11 @@ void cart_map_mark_for_remove (const char* del_files[], int del_files_number)
 	{
 		removed = 0;
 		for (j = 0; j < cart_map_number; j++)
-			if (strcmp(del_files[i], cart_map[j].name) == 0)
+			if (strcmp(del_files[i], cart_map[j].name) == 0 && strcmp(cart_map[j].name, MAP_TABLE_NAME) != 0)
 			{
+				// remember where it is (only a speedup if it fails)
+				if (cart_map_removed_load() == 0)
+					cart_map_removed_store(&cart_map[j]);
 				cart_map[j].name[0] = 0;
 				removed = 1;
 				something_to_be_done = 1;
@@ -397,13 +1082,26 @@ void cart_map_replace_loader (binware_s* loader)
 ///////////////////
 // hole management
 
+// returns -1 if the loaded map lost entries to corruption (nothing can be
+// placed safely)
+static int cart_map_check_lost (void)
+{
+	if (!cart_map_lost)
+		return 0;
+	printerr("Cart map has %i corrupted entries whose place is unknown, it cannot be changed\n"
+		 "(a new map can be made with -Y).\n", cart_map_lost);
+	return -1;
+}
+
 int cart_map_build_hole (void)
 {
 	int cart_map_index;
-	int cart_map_hole_size = 2 * cart_map_max_number * sizeof(cart_map_s);
-	int test_hole_offset;
+	int i;
 	
 	assert(cart_map_max_number >= MAP_MINIMUM_ENTRIES);
+
+	if (cart_map_check_lost() < 0)
+		return -1;
 	
 	if (loader_and_cart_map_size == (int)sizeof(cart_map_s) * cart_map_max_number && !new_loader)
 	{
@@ -411,41 +1109,27 @@ int cart_map_build_hole (void)
 		return -1;
 	}
 	
-	if ((cart_map_hole = (cart_map_s*)malloc(cart_map_hole_size)) == NULL)
-	{
-		printerrno("cannot allocate %s bytes for cart management", cart_map_hole_size);
-		return -1;
-	}
+	if (cart_map_hole)
+		free(cart_map_hole);
+	cart_map_hole = NULL;
 	cart_map_hole_number = 0;
+	cart_space_destroy(cart_map_space);
+	if ((cart_map_space = cart_space_create()) == NULL)
+		return -1;
 
-	// our test begins right after the loader&map
-	test_hole_offset = loader_and_cart_map_size;
-
-	// loop on the cart map
+	// everything after the loader&map is free, but roms of the cart map
+	if (cart_space_free(cart_map_space, loader_and_cart_map_size, CART_SIZE_BYTES - loader_and_cart_map_size) < 0)
+		return -1;
 	for (cart_map_index = 0; cart_map[cart_map_index].size > 0; cart_map_index++)
 	{
 		// if this rom is to be erased by user, then forget it so to count it in holes
 		if (cart_map[cart_map_index].name[0] == 0)
 			continue;
-	
-		// new data, check if it is contiguous to previous one
-		assert((int)cart_map[cart_map_index].offset >= test_hole_offset);
-		if ((int)cart_map[cart_map_index].offset > test_hole_offset)
+		if (cart_space_use(cart_map_space, cart_map[cart_map_index].offset, cart_map[cart_map_index].size) < 0)
 		{
-			// it is not, so we have crossed a hole
-			cart_map_hole[cart_map_hole_number].offset = test_hole_offset;
-			cart_map_hole[cart_map_hole_number].size = cart_map[cart_map_index].offset - test_hole_offset;
-			cart_map_hole_number++;
+			printerr("Rom '%s' of cart map overlaps another one or the loader.\n", cart_map[cart_map_index].name);
+			return -1;
 		}
-		test_hole_offset = cart_map[cart_map_index].offset + cart_map[cart_map_index].size;
-	}
-
-	// is there a hole at the end ?
-	if (test_hole_offset < CART_SIZE_BYTES)
-	{
-		cart_map_hole[cart_map_hole_number].offset = test_hole_offset;
-		cart_map_hole[cart_map_hole_number].size = CART_SIZE_BYTES - test_hole_offset;
-		cart_map_hole_number++;
 	}
 	
 	// now we know the holes, we check if we can insert the new loader
@@ -459,8 +1143,8 @@ int cart_map_build_hole (void)
 		
 		// max size for loader
 		max_size = loader_and_cart_map_size;
-		if (cart_map_hole_number && (int)cart_map_hole[0].offset == loader_and_cart_map_size)
-			max_size += cart_map_hole[0].size;
+		if ((i = cart_space_find(cart_map_space, loader_and_cart_map_size)) >= 0)
+			max_size += cart_space_extent(cart_map_space, i)->size;
 		// calculate trimmed size
 		new_loader_trimmed_size = trim(new_loader->data, new_loader->size);
 
@@ -473,7 +1157,7 @@ int cart_map_build_hole (void)
 		{
 			new_loader_and_cart_map_size++;
 			adjust_rom_size(&new_loader_and_cart_map_size);
-			cart_map_new_max_number = (new_loader_and_cart_map_size - new_loader_trimmed_size - sizeof(cart_map_locator_s)) / sizeof(cart_map_s);
+			cart_map_new_max_number = (new_loader_and_cart_map_size - new_loader_trimmed_size - sizeof(cart_map_locator_v3_s)) / sizeof(cart_map_entry_s);
 		} while (new_loader_and_cart_map_size < max_size && cart_map_new_max_number < minimum_cart_map_number);
 
 		// can the current map max number fit ?
@@ -486,13 +1170,13 @@ int cart_map_build_hole (void)
 				 new_loader->name,
 				 new_loader_and_cart_map_size,
 				 loader_and_cart_map_size,
-				 cart_map_hole_number? cart_map_hole[0].size: 0,
+				 max_size - loader_and_cart_map_size,
 				 max_size);
 			printerr("------ (show how which roms to remove to fit)\n");
 			reset_cart_map();
 			return -1;
 		}
-		cart_map_new_location = new_loader_and_cart_map_size - sizeof(cart_map_locator_s) - cart_map_new_max_number * sizeof(cart_map_s);
+		cart_map_new_location = new_loader_and_cart_map_size - sizeof(cart_map_locator_v3_s) - cart_map_new_max_number * sizeof(cart_map_entry_s);
 		
 		if (cart_verbose > 0)
 			print("New loader is fitting:\n"
@@ -506,47 +1190,54 @@ int cart_map_build_hole (void)
 			      new_loader_and_cart_map_size * 8.0 / 1024 / 1024,
 			      cart_map_new_max_number);
 		
-		// adjust/add first hole
+		// loader&map area grows into the first hole or shrinks: the old
+		// area is given back (merging with that hole), the new one is taken
 		if (new_loader_and_cart_map_size != loader_and_cart_map_size)
 		{
-
-			// first hole right after old map
-			if (cart_map_hole_number && (int)cart_map_hole[0].offset == loader_and_cart_map_size)
-			{
-				if (cart_verbose > 0)
-					print("\tadjusting first hole\n");
-				// change its size (grow or reduce)
-				cart_map_hole[0].offset += new_loader_and_cart_map_size - loader_and_cart_map_size;
-				cart_map_hole[0].size -= new_loader_and_cart_map_size - loader_and_cart_map_size;
-				assert((int)cart_map_hole[0].size >= 0);
-				// if the first hole is now null-sized, we simply remove it
-				if (cart_map_hole[0].size == 0)
-					memmove(&cart_map_hole[0], &cart_map_hole[1], --cart_map_hole_number * sizeof(cart_map_s));
-			}
-			// there was a rom right after the loader+map or there was no hole,
-			else
-			{
-				if (cart_verbose > 0)
-					print("\tinserting a first new hole\n");
-				// so we have to create a new hole
-				if (cart_map_hole_number)
-				{
-					// shift holes
-					assert(cart_map_hole_number < cart_map_hole_size); // just pray - things are big enough
-					memmove(&cart_map_hole[1], &cart_map_hole[0], cart_map_hole_number * sizeof(cart_map_s));
-				}
-				cart_map_hole_number++;
-				cart_map_hole[0].offset = new_loader_and_cart_map_size;
-				cart_map_hole[0].size = loader_and_cart_map_size - new_loader_and_cart_map_size;
-				assert(   cart_map_hole[0].size > 0
-				       && (   cart_map_hole_size == 1
-				           || cart_map_hole[0].offset + cart_map_hole[0].size < cart_map_hole[1].offset));
-			}
+			if (cart_verbose > 0)
+				print("\tadjusting first hole\n");
+			if (   cart_space_free(cart_map_space, 0, loader_and_cart_map_size) < 0
+			    || cart_space_use(cart_map_space, 0, new_loader_and_cart_map_size) < 0)
+				return -1;
 		}
 		something_to_be_done = 1;
 	}
-	else
-		cart_map_new_max_number = cart_map_max_number;
+
+	// roms with a fixed place take it
+	for (i = 0; i < cart_map_fixed_number; i++)
+		if (cart_space_use(cart_map_space, cart_map_fixed[i].offset, cart_map_fixed[i].size) < 0)
+		{
+			printerr("Rom '%s' cannot be at 0x%x, this place is not free.\n", cart_map_fixed[i].romname, cart_map_fixed[i].offset);
+			return -1;
+		}
+
+	// holes, in offset order, with an empty one where each fixed rom is
+	cart_map_hole_number = cart_space_number(cart_map_space) + cart_map_fixed_number;
+	if ((cart_map_hole = (cart_map_s*)malloc((cart_map_hole_number + 1) * sizeof(cart_map_s))) == NULL)
+	{
+		printerrno("cannot allocate %i bytes for cart management", (cart_map_hole_number + 1) * (int)sizeof(cart_map_s));
+		cart_map_hole_number = 0;
+		return -1;
+	}
+	for (i = cart_map_index = 0; i < cart_map_hole_number; i++)
+	{
+		int fixed = i - cart_map_index;
+
+		if (   fixed < cart_map_fixed_number
+		    && (   cart_map_index == cart_space_number(cart_map_space)
+		        || cart_map_fixed[fixed].offset < cart_space_extent(cart_map_space, cart_map_index)->offset))
+		{
+			cart_map_hole[i].offset = cart_map_fixed[fixed].offset;
+			cart_map_hole[i].size = 0;
+			cart_map_fixed[fixed].hole_index = i;
+		}
+		else
+		{
+			const cart_extent_s* extent = cart_space_extent(cart_map_space, cart_map_index++);
+			cart_map_hole[i].offset = extent->offset;
+			cart_map_hole[i].size = extent->size;
+		}
+	}
 	
 	return 0;
 }
@@ -577,20 +1268,144 @@ void display_cart_map_hole (void)
 // stage 3: files insertion
 ///////////////////////////////////////
 
-void cart_map_file_display_test_score (char* message, u_int64_t score)
+// weight of burn cost against holes sizes in placement score, in percent:
+// at 100, burning the whole cart costs as much as a cart sized hole brings
+int			cart_plan_burn_weight = 0;
+
+// weight of write blocks wear, in percent: at 100, burning the whole cart
+// when it is the most programmed part costs as much as a cart sized hole
+int			cart_plan_wear_weight = 0;
+
+// placement score is more than holes sizes
+static int cart_map_cost_weighted (void)
+{
+	return cart_plan_burn_weight || cart_plan_wear_weight;
+}
+
+// burn cost of a chunk of changes from start to end (excluded)
+static void cart_map_chunk_cost (int start, int end, long long* bytes, long long* written, int* blocks, long long* wear)
+{
+	int offset = start;
+	int size = end - start;
+
+	adjust_burn_addresses(&offset, &size);
+	*written += size;
+	// borders of the write blocks are read from cart before burning
+	*bytes += size + size - (end - start);
+	*blocks += size / CART_WRITE_BLOCK_SIZE;
+	*wear += cart_wear_cost(offset, size);
+}
+
+// bytes transferred to burn a placement, given holes remaining sizes:
+// write blocks burned, and their borders read.
+// written gets bytes burned, wear gets their wear (both never decrease
+// when a rom is placed), blocks gets the number of write blocks erased
+static long long cart_map_burn_cost (const int* remaining, long long* written, int* blocks, long long* wear)
+{
+	int map_start = new_loader? 0: cart_map_area_location;
+	int map_end = new_loader? new_loader_and_cart_map_size: loader_and_cart_map_size;
+	int map_burned = 0;
+	long long bytes = 0;
+	int i;
+
+	*written = 0;
+	*blocks = 0;
+	*wear = 0;
+	for (i = 0; i < cart_map_hole_number; i++)
+		if (remaining[i] < (int)cart_map_hole[i].size)
+		{
+			int start = cart_map_hole[i].offset;
+			int end = start + cart_map_hole[i].size - remaining[i];
+
+			// roms right after the map are burned along with it
+			if (start == map_end)
+			{
+				start = map_start;
+				map_burned = 1;
+			}
+			cart_map_chunk_cost(start, end, &bytes, written, blocks, wear);
+		}
+
+	// the map is always burned
+	if (!map_burned)
+		cart_map_chunk_cost(map_start, map_end, &bytes, written, blocks, wear);
+
+	return bytes;
+}
+
+// sum of holes remaining sizes squared (the bigger, the less fragmented)
+static u_int64_t cart_map_fragmentation (const int* remaining)
+{
+	u_int64_t score = 0;
+	int i;
+
+	for (i = 0; i < cart_map_hole_number; i++)
+		score += (u_int64_t)remaining[i] * remaining[i];
+	return score;
+}
+
+// placement score from its fragmentation, burn cost (bytes) and wear:
+// weighted costs are taken from a constant so that score stays positive
+static u_int64_t cart_map_score (u_int64_t fragmentation, long long bytes, long long wear)
+{
+	u_int64_t max_bytes = 4 * (u_int64_t)CART_SIZE_BYTES;
+	u_int64_t score = fragmentation;
+
+	if (cart_plan_burn_weight)
+		score += (max_bytes - MIN((u_int64_t)bytes, max_bytes)) * CART_SIZE_BYTES / 100 * cart_plan_burn_weight;
+	if (cart_plan_wear_weight)
+		score += (max_bytes - MIN((u_int64_t)wear, max_bytes)) * CART_SIZE_BYTES / 100 * cart_plan_wear_weight;
+	return score;
+}
+
+static u_int64_t cart_map_placement_score (const int* remaining)
+{
+	long long written, wear = 0, bytes = 0;
+	int blocks;
+
+	if (cart_map_cost_weighted())
+		bytes = cart_map_burn_cost(remaining, &written, &blocks, &wear);
+	return cart_map_score(cart_map_fragmentation(remaining), bytes, wear);
+}
+
+// shows the terms of a placement score (the weighted sum is not readable)
+static void cart_map_display_score (const char* message, const int* remaining)
+{
+	long long written, wear;
+	int blocks;
+	long long bytes = cart_map_burn_cost(remaining, &written, &blocks, &wear);
+
+	print("%s placement (score %.4g, burn %.4gMb with %i write blocks",
+	      message,
+	      sqrt(cart_map_fragmentation(remaining)) * 8 / 1024 / 1024,
+	      bytes * 8.0 / 1024 / 1024,
+	      blocks);
+	if (cart_plan_wear_weight)
+		// 0%: least programmed blocks only, 100%: most programmed ones only
+		print(", %.0f%% worn", written? wear * 100.0 / written: 0);
+	print("):\n");
+}
+
+void cart_map_file_display_test_score (char* message)
 {
 	int i;
 	
-	print("%s placement (score %.4g):\n", message, sqrt(score) * 8 / 1024 / 1024);
+	cart_map_display_score(message, cart_map_hole_remaining_size);
 	for (i = 0; i < cart_map_file_number; i++)
 		print("\t- file '%s' in hole #%i (rem. 0x%x)\n", cart_map_file[i].romname, cart_map_file[i].hole_index_test, cart_map_hole_remaining_size[cart_map_file[i].hole_index_test]);
 }
 
 void cart_map_file_display_best_score ()
 {
+	int remaining [cart_map_hole_number + 1];
 	int i;
 	
-	print("Best placement (score %.4g):\n", sqrt(cart_map_insertion_best_score) * 8 / 1024 / 1024);
+	for (i = 0; i < cart_map_hole_number; i++)
+		remaining[i] = cart_map_hole[i].size;
+	for (i = 0; i < cart_map_file_number; i++)
+		remaining[cart_map_file[i].hole_index] -= cart_map_file[i].size;
+
+	cart_map_display_score("Best", remaining);
 	for (i = 0; i < cart_map_file_number; i++)
 		print("\t- file '%s' in hole #%i\n", cart_map_file[i].romname, cart_map_file[i].hole_index);
 }
@@ -599,11 +1414,10 @@ void cart_map_file_display_best_score ()
 void cart_map_file_update_score (void)
 {
 	int i;
-	u_int64_t score = 0;
+	u_int64_t score;
 	
-	// calculate fitting score (use euclidian norm)
-	for (i = 0; i < cart_map_hole_number; i++)
-		score += (u_int64_t)cart_map_hole_remaining_size[i] * cart_map_hole_remaining_size[i];
+	// calculate fitting score (use euclidian norm, and burn cost if weighted)
+	score = cart_map_placement_score(cart_map_hole_remaining_size);
 
 	if (score > cart_map_insertion_best_score)
 	{
@@ -615,372 +1429,2592 @@ void cart_map_file_update_score (void)
 		}
 		cart_map_insertion_best_score = score;
 		if (cart_verbose > 0)
-			cart_map_file_display_test_score("so far, best", score);
+			cart_map_file_display_test_score("so far, best");
 	}
 	else if (cart_verbose > 1)
-		cart_map_file_display_test_score("tried", score);
+		cart_map_file_display_test_score("tried");
 }
 
-// called by cart_map_file_find_best_insertion
-static void cart_map_file_find_best_insertion_recursive (const int cart_map_file_index)
+/*
+ * Branch and bound placement search.
+ *
+ * Files are placed largest first (cart_map_search_order[]), so that big
+ * files which fit in few holes are decided first and the bound is tight
+ * early. A branch is cut when:
+ * - the best score it could reach is not better than the best one found:
+ *   the bound is computed as if the remaining files could be split, their
+ *   total size being taken from the smallest holes first,
+ * - it is a symmetric of an already tried branch:
+ *   . a file the same size as the previous one does not go into a hole
+ *     before the previous one's,
+ *   . of several holes with the same remaining size, only the first is tried,
+ * - the same set of remaining hole sizes has already been searched for the
+ *   same remaining files (memoized at each new file size): the best score
+ *   reachable from there is already known or has been beaten.
+ * This finds the same best score as trying every placement.
+ * When burn cost is weighted, holes with the same remaining size are not
+ * equivalent anymore and the last two cuts are not made. The bound then
+ * takes the bytes already burned by placed files as the burn cost.
+ *
+ * A best fit decreasing placement is scored first. With a time budget
+ * (cart_plan_budget_ms), the search stops when time is out and keeps the
+ * best placement found so far. The bounds of the branches left tell how
+ * far from the best score it may be.
+ *
+ * The tree is split into tasks by the placements of the first files, which
+ * are searched by the workers (cart_jobs_run()). They share the best score
+ * for cutting branches. Of equal scores, the one from the first task wins
+ * (then the first found in that task), which is the one a single search
+ * would keep: the chosen placement does not depend on threads scheduling.
+ */
+
+#define SEARCH_MEMO_MAX		65536		// remembered hole sets per task
+#define SEARCH_MEMO_BYTES	(16 * 1024 * 1024)
+#define SEARCH_TASKS_PER_THREAD	8
+#define SEARCH_TASKS_MAX	4096
+#define SEARCH_SYNC_NODES	1024		// nodes between looks at shared best score
+
+int			cart_plan_budget_ms = 0;
+
+static int*		cart_map_search_order = NULL;			// cart_map_file_max_number ints
+static int*		cart_map_search_left = NULL;			// size of files order[i..]
+static int		cart_map_search_memo_size = 0;			// power of 2, 0: no memo
+
+// shared by tasks, under cart_map_search_lock
+static cart_lock_s*	cart_map_search_lock = NULL;
+static u_int64_t	cart_map_search_best_score = 0;
+static int		cart_map_search_best_task = -1;			// -1: seed placement
+static int		cart_map_search_stopped = 0;
+static long long	cart_map_search_deadline = 0;			// ms, 0: none
+
+typedef struct
 {
-	// no more index to test?
-	if (cart_map_file_index >= cart_map_file_number)
-	{
-		// then all rom are placed, calculate score
-		cart_map_file_update_score();
-		return;
-	}
-	
-	// try next hole for cart_map_file_index file
-	while (1)
-	{
-		// try next hole
-		// (the initializing value is -1 so the hole #0 is the first to be tried)
-		if (++cart_map_file[cart_map_file_index].hole_index_test >= cart_map_hole_number)
-		{
-			// no more hole to test
-			cart_map_file[cart_map_file_index].hole_index_test = -1;
-			return;
-		}
+	int		depth;				// files placed by the task
+	int*		hole;				// task placement, then best placement
+	int*		sorted;				// remaining hole sizes after task placement
+	u_int64_t	best_score;			// 0: nothing better found
+	u_int64_t	open_bound;			// best score of branches left when stopped
+	long long	nodes;
+	int		failed;
+} cart_map_search_task_s;
 
-		// can this file be inserted in its current test hole?
-		if (cart_map_hole_remaining_size[cart_map_file[cart_map_file_index].hole_index_test] >= cart_map_file[cart_map_file_index].size)
-		{
-			// yes, take room
-			cart_map_hole_remaining_size[cart_map_file[cart_map_file_index].hole_index_test] -= cart_map_file[cart_map_file_index].size;
-			// now try to insert subsequent files
-			// best try will be recorded (call to cart_map_file_update_score() above)
-			cart_map_file_find_best_insertion_recursive(cart_map_file_index + 1);
+typedef struct
+{
+	int		task;
+	int*		remaining;			// remaining size in holes
+	int*		hole;				// hole of files in search order
+	int*		sorted;				// hole_number ints per level
+	u_int64_t	known_score;			// best score known, and
+	int		known_task;			// the task which found it
+	int		improved;			// best_score not yet shared
+	int		stopped;
+	long long	nodes;
+	u_int64_t	open_bound;
+	u_int64_t	best_score;
+	int*		best_hole;
+	u_int32_t*	memo_hash;			// 0: empty
+	int*		memo_key;			// (hole_number + 1) ints per entry
+	int		memo_used;
+} cart_map_search_s;
 
-			// a good placement has now been or not been found, we go on seeking...
-			// remove this file from its hole
-			cart_map_hole_remaining_size[cart_map_file[cart_map_file_index].hole_index_test] += cart_map_file[cart_map_file_index].size;
-			
-			// sanity check
-			assert(cart_map_hole_remaining_size[cart_map_file[cart_map_file_index].hole_index_test] <= (int)cart_map_hole[cart_map_file[cart_map_file_index].hole_index_test].size);
-		}
-	}
+static int cart_map_search_compare_size (const void* a, const void* b)
+{
+	// largest first, then by index so that equal sizes keep their order
+	const int ia = *(const int*)a;
+	const int ib = *(const int*)b;
+	if (cart_map_file[ia].size != cart_map_file[ib].size)
+		return cart_map_file[ia].size > cart_map_file[ib].size? -1: 1;
+	return ia - ib;
 }
 
-// this will fill the global structure cart_map_file in.
-// it needs cart_map and cart_map_hole structures correctly initialized
-int cart_map_file_find_best_insertion (void)
+static int cart_map_search_size (int file)
 {
-	int i;
-	
-	// initialise the int array that keeps the current remaining size in holes
-	if ((cart_map_hole_remaining_size = (int*)malloc(cart_map_hole_number * sizeof(int))) == NULL)
-	{
-		printerr("cannot allocate %s bytes for cart management\n", cart_map_hole_number * sizeof(int));
-		return -1;
-	}
-	for (i = 0; i < cart_map_hole_number; i++)
-		cart_map_hole_remaining_size[i] = cart_map_hole[i].size;
-	
-	// nothing is placed yet
-	for (i = 0; i < cart_map_file_number; i++)
-		cart_map_file[i].hole_index = cart_map_file[i].hole_index_test = -1;
-	
-	// dumbfully try everything
-	cart_map_insertion_best_score = 0;
-	cart_map_file_find_best_insertion_recursive(/* start with file index number */ 0);
+	return cart_map_file[cart_map_search_order[file]].size;
+}
 
-	// have we succeeded ?
-	if (cart_map_insertion_best_score == 0)
+// is file the first of its size (in search order)
+static int cart_map_search_new_size (int file)
+{
+	return file == 0 || cart_map_search_size(file - 1) != cart_map_search_size(file);
+}
+
+// sorts remaining hole sizes in increasing order into sorted[]
+static void cart_map_search_sort_holes (const int* remaining, int* sorted)
+{
+	int i, j;
+
+	for (i = 0; i < cart_map_hole_number; i++)
 	{
-		printerr("Could not fit all roms into cart, that's too bad.\n");
-		return -1;
+		int size = remaining[i];
+		for (j = i; j > 0 && sorted[j - 1] > size; j--)
+			sorted[j] = sorted[j - 1];
+		sorted[j] = size;
 	}
-
-	return 0;
 }
 
-int cart_map_find_best_insertion_for_files (const char* add_files[], int add_files_number)
+// best score reachable with files order[file..] still to place, 0 if they cannot fit
+static u_int64_t cart_map_search_bound (int file, const int* remaining, const int* sorted)
 {
+	u_int64_t bound = 0;
+	int left = cart_map_search_left[file];
 	int i;
-	
-	if (add_files_number > FILE_NUMBER_MAX)
+
+	if (file < cart_map_file_number && sorted[cart_map_hole_number - 1] < cart_map_search_size(file))
+		// largest file does not fit anywhere
+		return 0;
+
+	for (i = 0; i < cart_map_hole_number; i++)
 	{
-		printerr("Too many (%i) files to add, raise FILE_NUMBER_MAX(%i) in source code and recompile.\n", add_files_number, FILE_NUMBER_MAX);
-		return -1;
+		int size = sorted[i];
+		int taken = MIN(size, left);
+		left -= taken;
+		size -= taken;
+		bound += (u_int64_t)size * size;
 	}
+	if (left)
+		return 0;
 
-	cart_map_file_number = add_files_number;
-	for (i = 0; i < add_files_number; i++)
+	if (cart_map_cost_weighted())
 	{
-		int			size;
-		int			trimmed_size;
-		unsigned char*		rom;
-		char*			comma;
-		const char*		finalromname;
-		char*			userromname = NULL;
-		const char*		add_file = add_files[i];
+		// what placed files burn is a minimum for the burn cost and wear
+		long long written, wear;
+		int blocks;
+		cart_map_burn_cost(remaining, &written, &blocks, &wear);
+		bound = cart_map_score(bound, written, wear);
+	}
+	return bound;
+}
+
+// holes to try for file, smallest remaining size first (best fit is tried first)
+// returns their number
+static int cart_map_search_candidates (const int* remaining, const int* hole, int file, int* candidate)
+{
+	int size = cart_map_search_size(file);
+	int first_hole = 0;
+	int candidates = 0;
+	int i, j;
 
-		// check if user wants to rename the rom
-		if ((comma = strstr(add_file, ",")))
+	if (!cart_map_search_new_size(file))
+		// same size as previous file: not before its hole
+		first_hole = hole[file - 1];
+
+	for (i = first_hole; i < cart_map_hole_number; i++)
+	{
+		if (remaining[i] < size)
+			continue;
+		if (!cart_map_cost_weighted())
 		{
-			userromname = &comma[1];
-			*comma = 0;
+			for (j = first_hole; j < i && remaining[j] != remaining[i]; j++);
+			if (j < i)
+				// same as an earlier hole
+				continue;
 		}
+		for (j = candidates++; j > 0 && remaining[candidate[j - 1]] > remaining[i]; j--)
+			candidate[j] = candidate[j - 1];
+		candidate[j] = i;
+	}
+	return candidates;
+}
 
-		// load, check and trim rom
-		size = 0;
-		if ((rom = load_from_file(add_file, NULL, &size)) == NULL)
-			return -1;
+// returns 1 if (file, sorted) was already searched, remembers it otherwise
+static int cart_map_search_memo (cart_map_search_s* search, int file, const int* sorted)
+{
+	u_int32_t hash = 2166136261u;		// fnv-1a
+	int keysize = cart_map_hole_number + 1;
+	int i, index;
 
-		trimmed_size = trim(rom, size);
-		
-		// pad size to be "loader compatible"
-		adjust_rom_size(&trimmed_size);
+	if (!cart_map_search_memo_size)
+		return 0;
 
-		if (userromname)
-			finalromname = userromname;
-		else
-		{
-			const char* name = romname(rom);
-			finalromname = name[0]? name: filename2romname(add_file);
-		}
-		strcpy(cart_map_file[i].romname, finalromname);
-		cart_map_file[i].userromname = userromname;
-		cart_map_file[i].filename = add_file;
-		cart_map_file[i].original_size = size;
-		cart_map_file[i].size = trimmed_size;
-		
-		if (cart_verbose)
-			print("Adding file '%s' name '%s' size=0x%x / %.4gMb (trim+fit: %+g%%)\n",
-				add_file,
-				finalromname,
-				trimmed_size,
-				trimmed_size * 8.0 / 1024 / 1024,
-				100.0 * trimmed_size / size - 100.0);
+	hash = (hash ^ file) * 16777619;
+	for (i = 0; i < cart_map_hole_number; i++)
+		hash = (hash ^ sorted[i]) * 16777619;
+	if (!hash)
+		hash = 1;
 
-		free(rom);
+	for (index = hash & (cart_map_search_memo_size - 1);
+	     search->memo_hash[index];
+	     index = (index + 1) & (cart_map_search_memo_size - 1))
+	{
+		int* key = &search->memo_key[index * keysize];
+		if (   search->memo_hash[index] == hash
+		    && key[0] == file
+		    && memcmp(&key[1], sorted, cart_map_hole_number * sizeof(int)) == 0)
+			return 1;
 	}
-	
-	if (cart_map_file_number)
+
+	// keep the table at most 3/4 full
+	if (4 * (search->memo_used + 1) <= 3 * cart_map_search_memo_size)
 	{
-		something_to_be_done = 1;
-		return cart_map_file_find_best_insertion();
+		int* key = &search->memo_key[index * keysize];
+		search->memo_hash[index] = hash;
+		key[0] = file;
+		memcpy(&key[1], sorted, cart_map_hole_number * sizeof(int));
+		search->memo_used++;
 	}
 	return 0;
 }
 
-/////////////////////////////////////////////
-// stage 4: build new map and burn everything
-/////////////////////////////////////////////
+// would score be kept (or could a branch with this bound bring something kept)
+static int cart_map_search_beats (const cart_map_search_s* search, u_int64_t score)
+{
+	return    score > search->known_score
+	       || (score == search->known_score && search->task < search->known_task);
+}
 
-void display_change_map_file (void)
+// shares best score and time budget state with other tasks
+static void cart_map_search_sync (cart_map_search_s* search)
 {
-	int change_map_file_index;
-	
-	print("Changes in map:\n");
-	for (change_map_file_index = 0; change_map_file_index < change_map_file_number; change_map_file_index++)
+	cart_lock(cart_map_search_lock);
+	if (   search->improved
+	    && (   search->best_score > cart_map_search_best_score
+	        || (search->best_score == cart_map_search_best_score && search->task < cart_map_search_best_task)))
 	{
-		cart_map_file_s* item = &change_map_file[change_map_file_index];
-		if (cart_verbose || (item->action == MAP_ACTION_DONTOUCH && cart_verbose > 1))
-			print("\taction:%s rom:'%s' offset:0x%x size:0x%x last:0x%x\n",
-				item->action == MAP_ACTION_ADD? "add   ":
-				item->action == MAP_ACTION_DONTOUCH? "keep  ":
-				item->action == MAP_ACTION_REMOVE? "remove":
-				"error",
-				item->romname,
-				item->offset,
-				item->size,
-				item->offset + item->size - 1);
+		cart_map_search_best_score = search->best_score;
+		cart_map_search_best_task = search->task;
 	}
+	search->improved = 0;
+	if (cart_map_search_deadline && cart_time_ms() > cart_map_search_deadline)
+		cart_map_search_stopped = 1;
+	search->stopped = cart_map_search_stopped;
+	search->known_score = cart_map_search_best_score;
+	search->known_task = cart_map_search_best_task;
+	cart_unlock(cart_map_search_lock);
 }
 
-// burn contiguous change_map_file chunks:
-// all indexes'actions have to be MAP_ACTION_ADD so that we are assured that
-// the addresses are also contiguous
-int burn_map_chunk (int burn_map_file_index_start, int burn_map_file_index_end)
+static void cart_map_search (cart_map_search_s* search, int file)
 {
-	int change_chunk_offset = 0, change_chunk_size = 0;	// that we need
-	int burn_chunk_offset = 0, burn_chunk_size = 0;		// for burning
-	int burn_cart_map_location = 0;				// cart map burning
-	int burn_cart_map_max_number = 0;			// cart map burning
+	int* sorted;
+	int candidate [cart_map_hole_number];
+	int candidates;
+	int i;
+	u_int64_t bound;
 
-	unsigned char* chunkrom;				// this will be burned
-	int border_offset, border_size;
-	int index;
-	
-	if (burn_map_file_index_end > burn_map_file_index_start)
-		print("\nBurn map entries #%i..#%i...\n", burn_map_file_index_start, burn_map_file_index_end);
-	else
-		print("\nBurn map entry #%i...\n", burn_map_file_index_start);
-	
-	// find limits
-	
-	// is it the first chunk ?
-	if (burn_map_file_index_start == 0)
+	if (++search->nodes % SEARCH_SYNC_NODES == 0)
+		cart_map_search_sync(search);
+
+	if (file >= cart_map_file_number)
 	{
-		// so map has to be burned
-		if (new_loader)
-		{
-			change_chunk_offset = 0;
-			burn_cart_map_location = cart_map_new_location;
-			change_chunk_size = change_map_file[burn_map_file_index_end].offset + change_map_file[burn_map_file_index_end].size;
-		}
-		else
+		// all roms are placed, calculate score
+		u_int64_t score = cart_map_placement_score(search->remaining);
+		if (cart_map_search_beats(search, score))
 		{
-			change_chunk_offset = burn_cart_map_location = cart_map_location; // map location does not change
-			change_chunk_size = change_map_file[burn_map_file_index_end].offset + change_map_file[burn_map_file_index_end].size - change_map_file[burn_map_file_index_start].offset;
-			change_chunk_size -= change_chunk_offset; // don't touch the loader
+			search->best_score = search->known_score = score;
+			search->known_task = search->task;
+			memcpy(search->best_hole, search->hole, cart_map_file_number * sizeof(int));
+			search->improved = 1;
+			cart_map_search_sync(search);
 		}
-		// cart_map_new_max_number is always initialized to cart map size + 1 (to cart_map_max_number+1 if !new_loader)
-		burn_cart_map_max_number = cart_map_new_max_number - 1;
+		return;
 	}
-	else
+
+	sorted = &search->sorted[file * cart_map_hole_number];
+	cart_map_search_sort_holes(search->remaining, sorted);
+	if (!cart_map_search_beats(search, bound = cart_map_search_bound(file, search->remaining, sorted)))
+		return;
+	if (search->stopped)
 	{
-		change_chunk_offset = change_map_file[burn_map_file_index_start].offset;
-		change_chunk_size = change_map_file[burn_map_file_index_end].offset + change_map_file[burn_map_file_index_end].size - change_chunk_offset;
+		// out of time: this branch is left, remember what it could bring
+		search->open_bound = MAX(search->open_bound, bound);
+		return;
 	}
-	
-	burn_chunk_offset = change_chunk_offset;
-	burn_chunk_size = change_chunk_size;
-	adjust_burn_addresses(&burn_chunk_offset, &burn_chunk_size);
+	if (cart_map_search_new_size(file) && cart_map_search_memo(search, file, sorted))
+		return;
 
-	// allocate memory
-	if ((chunkrom = (unsigned char*)malloc(burn_chunk_size)) == NULL)
+	candidates = cart_map_search_candidates(search->remaining, search->hole, file, candidate);
+	for (i = 0; i < candidates; i++)
 	{
-		printerr("cannot allocate %i/0x%x bytes for burning changes (index %i .. %i)\n", burn_map_file_index_start, burn_map_file_index_end);
-		return -1;
+		search->hole[file] = candidate[i];
+		search->remaining[candidate[i]] -= cart_map_search_size(file);
+		cart_map_search(search, file + 1);
+		search->remaining[candidate[i]] += cart_map_search_size(file);
 	}
-	// which is the good value when cart map is erased
-	memset(chunkrom, 0xff, burn_chunk_size);
-	
-	// get the rom border from cart
-	
-	// low border:
-	border_offset = burn_chunk_offset;
-	border_size = change_chunk_offset - burn_chunk_offset;
-	adjust_load_addresses(&border_offset, &border_size);
-	assert(border_offset == burn_chunk_offset); // at least we want this ok
-	assert(border_offset + border_size >= change_chunk_offset);
-	if (border_size > 0)
+}
+
+// worker: search below a task's placement
+static void cart_map_search_job (void* arg, int index)
+{
+	cart_map_search_task_s* task = &((cart_map_search_task_s*)arg)[index];
+	cart_map_search_s search;
+	int i;
+
+	memset(&search, 0, sizeof(search));
+	search.task = index;
+	search.remaining = (int*)malloc(cart_map_hole_number * sizeof(int));
+	search.hole = (int*)malloc(cart_map_file_number * sizeof(int));
+	search.best_hole = (int*)malloc(cart_map_file_number * sizeof(int));
+	search.sorted = (int*)malloc((cart_map_file_number + 1) * cart_map_hole_number * sizeof(int));
+	if (cart_map_search_memo_size)
 	{
-		if (cart_verbose)
-			print("Loading low border\n");
-		if (cart_read_mem(&chunkrom[0], GBA_ROM + border_offset, border_size) < 0)
+		// the memo is an optimization: the search goes on without it
+		search.memo_hash = (u_int32_t*)calloc(cart_map_search_memo_size, sizeof(u_int32_t));
+		search.memo_key = (int*)malloc(cart_map_search_memo_size * (cart_map_hole_number + 1) * sizeof(int));
+	}
+	if (!search.remaining || !search.hole || !search.best_hole || !search.sorted)
+		task->failed = 1;
+	else
+	{
+		if (!search.memo_hash || !search.memo_key)
 		{
-			free(chunkrom);
-			return -1;
+			free(search.memo_hash);
+			free(search.memo_key);
+			search.memo_hash = NULL;
+			search.memo_key = NULL;
+			search.memo_used = 3 * cart_map_search_memo_size;	// never remember
+		}
+
+		for (i = 0; i < cart_map_hole_number; i++)
+			search.remaining[i] = cart_map_hole[i].size;
+		for (i = 0; i < task->depth; i++)
+		{
+			search.hole[i] = task->hole[i];
+			search.remaining[task->hole[i]] -= cart_map_search_size(i);
 		}
+		cart_map_search_sync(&search);
+		cart_map_search(&search, task->depth);
+
+		task->best_score = search.best_score;
+		if (search.best_score)
+			memcpy(task->hole, search.best_hole, cart_map_file_number * sizeof(int));
+		task->open_bound = search.open_bound;
+		task->nodes = search.nodes;
 	}
 
-	// high border:
-	border_offset = change_chunk_offset + change_chunk_size;
-	border_size = burn_chunk_offset + burn_chunk_size - border_offset;
-	adjust_load_addresses(&border_offset, &border_size);
-	assert(border_offset + border_size == burn_chunk_offset + burn_chunk_size); // at least we want this ok
-	assert(border_offset <= change_chunk_offset + change_chunk_size);
-	if (border_size > 0)
+	free(search.remaining);
+	free(search.hole);
+	free(search.best_hole);
+	free(search.sorted);
+	free(search.memo_hash);
+	free(search.memo_key);
+}
+
+// appends to task[] placements of files up to depth which may beat seed placement,
+// returns -1 if more than SEARCH_TASKS_MAX
+static int cart_map_search_split (int* remaining, int* hole, int file, int depth, cart_map_search_task_s* task, int* number, int* sorted)
+{
+	int candidate [cart_map_hole_number];
+	int candidates;
+	int i;
+
+	cart_map_search_sort_holes(remaining, sorted);
+	if (cart_map_search_bound(file, remaining, sorted) <= cart_map_search_best_score)
+		return 0;
+
+	if (file == depth)
 	{
-		if (cart_verbose)
-			print("Loading high border\n");
-		if (cart_read_mem(&chunkrom[border_offset - burn_chunk_offset], GBA_ROM + border_offset, border_size) < 0)
-		{
-			free(chunkrom);
+		// same remaining holes as a previous task for the same files: already searched
+		if (!cart_map_cost_weighted() && (file == cart_map_file_number || cart_map_search_new_size(file)))
+			for (i = 0; i < *number; i++)
+				if (memcmp(task[i].sorted, sorted, cart_map_hole_number * sizeof(int)) == 0)
+					return 0;
+		if (*number == SEARCH_TASKS_MAX)
+			return -1;
+		memcpy(task[*number].hole, hole, depth * sizeof(int));
+		memcpy(task[*number].sorted, sorted, cart_map_hole_number * sizeof(int));
+		task[*number].depth = depth;
+		(*number)++;
+		return 0;
+	}
+
+	candidates = cart_map_search_candidates(remaining, hole, file, candidate);
+	for (i = 0; i < candidates; i++)
+	{
+		int ret;
+		hole[file] = candidate[i];
+		remaining[candidate[i]] -= cart_map_search_size(file);
+		ret = cart_map_search_split(remaining, hole, file + 1, depth, task, number, sorted);
+		remaining[candidate[i]] += cart_map_search_size(file);
+		if (ret < 0)
 			return -1;
+	}
+	return 0;
+}
+
+// best fit decreasing placement as a first best score (none if a file does not fit)
+static void cart_map_search_seed (void)
+{
+	int i, j;
+
+	for (i = 0; i < cart_map_file_number; i++)
+	{
+		cart_map_file_s* item = &cart_map_file[cart_map_search_order[i]];
+		int best = -1;
+
+		for (j = 0; j < cart_map_hole_number; j++)
+			if (   cart_map_hole_remaining_size[j] >= item->size
+			    && (best < 0 || cart_map_hole_remaining_size[j] < cart_map_hole_remaining_size[best]))
+				best = j;
+		if (best < 0)
+			break;
+		item->hole_index_test = best;
+		cart_map_hole_remaining_size[best] -= item->size;
+	}
+	if (i == cart_map_file_number)
+		cart_map_file_update_score();
+
+	while (--i >= 0)
+	{
+		cart_map_file_s* item = &cart_map_file[cart_map_search_order[i]];
+		cart_map_hole_remaining_size[item->hole_index_test] += item->size;
+		item->hole_index_test = -1;
+	}
+}
+
+// searches best placement from seed's, returns -1 if error
+static int cart_map_search_run (void)
+{
+	cart_map_search_task_s* task = NULL;
+	cart_map_search_task_s* next = NULL;
+	int* sorted = NULL;
+	int* holes = NULL;
+	int hole [cart_map_file_number];
+	int remaining [cart_map_hole_number];
+	int number, next_number, depth, threads, i;
+	int winner = -1;
+	long long nodes = 0;
+	u_int64_t open_bound = 0;
+	int ret = -1;
+
+	threads = cart_thread_count();
+	task = (cart_map_search_task_s*)malloc(SEARCH_TASKS_MAX * sizeof(cart_map_search_task_s));
+	next = (cart_map_search_task_s*)malloc(SEARCH_TASKS_MAX * sizeof(cart_map_search_task_s));
+	sorted = (int*)malloc((2 * SEARCH_TASKS_MAX + 1) * cart_map_hole_number * sizeof(int));
+	holes = (int*)malloc(2 * SEARCH_TASKS_MAX * cart_map_file_number * sizeof(int));
+	if (!task || !next || !sorted || !holes || (cart_map_search_lock = cart_lock_create()) == NULL)
+	{
+		printerrno("malloc for placement search");
+		goto end;
+	}
+	for (i = 0; i < SEARCH_TASKS_MAX; i++)
+	{
+		task[i].sorted = &sorted[i * cart_map_hole_number];
+		next[i].sorted = &sorted[(SEARCH_TASKS_MAX + i) * cart_map_hole_number];
+		task[i].hole = &holes[i * cart_map_file_number];
+		next[i].hole = &holes[(SEARCH_TASKS_MAX + i) * cart_map_file_number];
+	}
+
+	cart_map_search_best_score = cart_map_insertion_best_score;
+	cart_map_search_best_task = -1;
+	cart_map_search_stopped = 0;
+	cart_map_search_deadline = cart_plan_budget_ms > 0? cart_time_ms() + cart_plan_budget_ms: 0;
+
+	// split the tree until there are enough tasks for the workers
+	for (i = 0; i < cart_map_hole_number; i++)
+		remaining[i] = cart_map_hole[i].size;
+	number = 0;
+	cart_map_search_split(remaining, hole, 0, 0, task, &number, &sorted[2 * SEARCH_TASKS_MAX * cart_map_hole_number]);
+	for (depth = 1;
+	     threads > 1 && number > 0 && number < threads * SEARCH_TASKS_PER_THREAD && depth <= cart_map_file_number;
+	     depth++)
+	{
+		cart_map_search_task_s* swap;
+		next_number = 0;
+		if (cart_map_search_split(remaining, hole, 0, depth, next, &next_number, &sorted[2 * SEARCH_TASKS_MAX * cart_map_hole_number]) < 0)
+			break;
+		swap = task;
+		task = next;
+		next = swap;
+		number = next_number;
+	}
+
+	// running workers share the memo budget
+	for (cart_map_search_memo_size = SEARCH_MEMO_MAX;
+	     cart_map_search_memo_size > 1 && (long long)cart_map_search_memo_size * (cart_map_hole_number + 1) * sizeof(int) * MIN(threads, number) > SEARCH_MEMO_BYTES;
+	     cart_map_search_memo_size /= 2);
+	if (cart_map_cost_weighted())
+		cart_map_search_memo_size = 0;
+
+	for (i = 0; i < number; i++)
+	{
+		task[i].best_score = task[i].open_bound = 0;
+		task[i].nodes = 0;
+		task[i].failed = 0;
+	}
+	if (number && cart_jobs_run(number, cart_map_search_job, task) < 0)
+		goto end;
+
+	for (i = 0; i < number; i++)
+	{
+		if (task[i].failed)
+		{
+			printerr("not enough memory for placement search\n");
+			goto end;
+		}
+		nodes += task[i].nodes;
+		open_bound = MAX(open_bound, task[i].open_bound);
+		// strictly better: first task wins on equal scores
+		if (task[i].best_score > cart_map_insertion_best_score)
+		{
+			cart_map_insertion_best_score = task[i].best_score;
+			winner = i;
+		}
+	}
+	if (winner >= 0)
+		for (i = 0; i < cart_map_file_number; i++)
+			cart_map_file[cart_map_search_order[i]].hole_index = task[winner].hole[i];
+
+	if (cart_verbose)
+		print("Placement search: %lli nodes visited (%i files, %i holes, %i tasks on %i threads)\n",
+		      nodes, cart_map_file_number, cart_map_hole_number, number, MIN(threads, number));
+	if (cart_map_search_stopped && open_bound > cart_map_insertion_best_score && cart_map_cost_weighted())
+		print("Placement search stopped after %ims: optimum is at most worth a %.4gMb hole more\n",
+		      cart_plan_budget_ms,
+		      sqrt(open_bound - cart_map_insertion_best_score) * 8 / 1024 / 1024);
+	else if (cart_map_search_stopped && open_bound > cart_map_insertion_best_score)
+		print("Placement search stopped after %ims: best score %.4g, optimum is at most %.4g better\n",
+		      cart_plan_budget_ms,
+		      sqrt(cart_map_insertion_best_score) * 8 / 1024 / 1024,
+		      (sqrt(open_bound) - sqrt(cart_map_insertion_best_score)) * 8 / 1024 / 1024);
+	ret = 0;
+
+end:
+	if (cart_map_search_lock)
+		cart_lock_destroy(cart_map_search_lock);
+	cart_map_search_lock = NULL;
+	free(task);
+	free(next);
+	free(sorted);
+	free(holes);
+	return ret;
+}
+
+// this will fill the global structure cart_map_file in.
+// it needs cart_map and cart_map_hole structures correctly initialized
+int cart_map_file_find_best_insertion (void)
+{
+	int i;
+	
+	// initialise the int array that keeps the current remaining size in holes
+	if ((cart_map_hole_remaining_size = (int*)malloc(cart_map_hole_number * sizeof(int))) == NULL)
+	{
+		printerr("cannot allocate %s bytes for cart management\n", cart_map_hole_number * sizeof(int));
+		return -1;
+	}
+	for (i = 0; i < cart_map_hole_number; i++)
+		cart_map_hole_remaining_size[i] = cart_map_hole[i].size;
+	
+	// nothing is placed yet
+	for (i = 0; i < cart_map_file_number; i++)
+		cart_map_file[i].hole_index = cart_map_file[i].hole_index_test = -1;
+	cart_map_insertion_best_score = 0;
+
+	if (cart_map_file_number == 0)
+		cart_map_file_update_score();
+	else if (cart_map_hole_number > 0)
+	{
+		for (i = 0; i < cart_map_file_number; i++)
+			cart_map_search_order[i] = i;
+		qsort(cart_map_search_order, cart_map_file_number, sizeof(int), cart_map_search_compare_size);
+		cart_map_search_left[cart_map_file_number] = 0;
+		for (i = cart_map_file_number - 1; i >= 0; i--)
+			cart_map_search_left[i] = cart_map_search_left[i + 1] + cart_map_search_size(i);
+
+		cart_map_search_seed();
+		if (cart_map_search_run() < 0)
+			return -1;
+	}
+
+	// have we succeeded ?
+	if (cart_map_insertion_best_score == 0)
+	{
+		printerr("Could not fit all roms into cart, that's too bad.\n");
+		return -1;
+	}
+
+	return 0;
+}
+
+// fill payload[0..item->size-1] with trimmed, padded and header corrected rom
+static void cart_map_file_prepare (const cart_map_file_s* item, const unsigned char* rom, unsigned char* payload)
+{
+	int size_to_copy = MIN(item->original_size, item->size);
+
+	assert(size_to_copy > 0);
+	memcpy(payload, rom, size_to_copy);
+
+	// pad file with the last byte
+	if (item->size > size_to_copy)
+		memset(&payload[size_to_copy], payload[size_to_copy - 1], item->size - size_to_copy);
+
+	// homebrew roms often need correction, correct_header() has to be reworked
+	correct_header(payload,
+		       item->userromname? item->userromname: item->romname,
+		       /* force name */ item->userromname? 1: 0);
+}
+
+// load and check item's file into payload (file may have changed since planning)
+static int cart_map_file_load (const cart_map_file_s* item, unsigned char* payload)
+{
+	unsigned char* rom;
+	int size = 0;
+	int crc;
+
+	if ((rom = load_from_file(item->filename, NULL, &size)) == NULL)
+		return -1;
+	cart_crc32(rom, &crc, size);
+	if (size != item->original_size || (u_int32_t)crc != item->crc)
+	{
+		printerr("File '%s' has changed since insertion was planned, aborting\n", item->filename);
+		// (its catalog entry may be stale) next plan uses its new contents
+		if (size > 0 && cart_catalog_update(item->filename, rom, size))
+			cart_catalog_save();
+		free(rom);
+		return -1;
+	}
+	cart_map_file_prepare(item, rom, payload);
+	free(rom);
+	return 0;
+}
+
+// fill section 1 of item from file's catalog entry (reentrant)
+static void cart_map_file_init (cart_map_file_s* item, const char* filename, char* userromname, const cart_catalog_entry_s* entry)
+{
+	char name [13];
+
+	item->filename = filename;
+	item->userromname = userromname;
+	item->original_size = entry->size;
+	item->crc = entry->crc;
+	item->data = NULL;
+
+	item->size = cart_trim_allowed? entry->trimmed_size: entry->size;
+	// pad size to be "loader compatible"
+	adjust_rom_size(&item->size);
+
+	if (userromname)
+		strcpy(item->romname, userromname);
+	else
+		strcpy(item->romname, entry->romname[0]? entry->romname: filename2romname_r(filename, name));
+}
+
+typedef struct
+{
+	const char*		source;		// "file" or "file,romname" as given
+	const char*		filename;
+	char*			userromname;
+	int			result;		// -1: error, 0: cataloged, 1: loaded
+	cart_catalog_entry_s	entry;		// when loaded
+	unsigned char*		data;		// when loaded, ready to burn
+	int			size;		// of data (it depends on rom block size)
+} cart_map_file_prep_s;
+
+// copies of "file,romname" split into "file" and "romname" (cart map files
+// point to them until exit)
+static char**			cart_map_file_split = NULL;
+static int			cart_map_file_split_number = 0;
+
+// files prepared while the linker is connecting (see cart_map_prefetch())
+static cart_map_file_prep_s*	cart_map_prefetch_prep = NULL;
+static int			cart_map_prefetch_number = 0;
+static int			cart_map_prefetch_left = 0;	// preparations not taken yet
+static cart_jobs_s*		cart_map_prefetch_jobs = NULL;
+
+// worker: load, trim, correct header and hash a file unknown to the catalog
+// (it is kept ready to burn only if payload budget allows)
+static void cart_map_file_prep_job (void* arg, int index)
+{
+	cart_map_file_prep_s* prep = &((cart_map_file_prep_s*)arg)[index];
+	cart_map_file_s item;
+	unsigned char* rom;
+	int size = 0;
+	int reserved;
+
+	prep->data = NULL;
+	prep->entry.path = NULL;
+
+	// catalog is read only while jobs are running
+	if (cart_catalog_lookup(prep->filename))
+	{
+		prep->result = 0;
+		return;
+	}
+
+	prep->result = -1;
+	if ((rom = load_from_file(prep->filename, NULL, &size)) == NULL)
+		return;
+	if (size == 0)
+		printerr("File '%s' is empty\n", prep->filename);
+	else if (cart_catalog_fill(&prep->entry, prep->filename, rom, size) == 0)
+	{
+		cart_map_file_init(&item, prep->filename, prep->userromname, &prep->entry);
+		cart_lock(cart_map_payload_lock);
+		if ((reserved = cart_map_payload_size + item.size <= PAYLOAD_BUDGET))
+			cart_map_payload_size += item.size;
+		cart_unlock(cart_map_payload_lock);
+		if (reserved && (prep->data = (unsigned char*)malloc(item.size)) != NULL)
+			cart_map_file_prepare(&item, rom, prep->data);
+		else if (reserved)
+		{
+			cart_lock(cart_map_payload_lock);
+			cart_map_payload_size -= item.size;
+			cart_unlock(cart_map_payload_lock);
+		}
+		prep->size = item.size;
+		prep->result = 1;
+	}
+	free(rom);
+}
+
+// bytes read back at once to check that a removed rom is still on cart
+#define REMOVED_CHECK_SIZE	SIZE_64K
+
+// returns 1 if item is on cart at offset, 0 if not, -1 if error
+// (whole rom is compared, reading stops at first difference)
+static int cart_map_removed_check (const cart_map_file_s* item, int offset)
+{
+	unsigned char block [REMOVED_CHECK_SIZE];
+	unsigned char* payload = item->data;
+	int done, ret = 1;
+
+	if (!payload)
+	{
+		if ((payload = (unsigned char*)malloc(item->size)) == NULL)
+		{
+			printerrno("malloc(%i) to check rom '%s'", item->size, item->romname);
+			return -1;
+		}
+		if (cart_map_file_load(item, payload) < 0)
+		{
+			free(payload);
+			return -1;
+		}
+	}
+
+	for (done = 0; done < item->size && ret > 0; done += REMOVED_CHECK_SIZE)
+	{
+		int size = MIN(REMOVED_CHECK_SIZE, item->size - done);
+		print("Checking removed rom '%s' at 0x%x...\r", item->romname, offset + done);
+		printflush();
+		if (cart_read_mem(block, GBA_ROM + offset + done, size) < 0)
+			ret = -1;
+		else if (memcmp(block, &payload[done], size) != 0)
+			ret = 0;
+	}
+	print("\n");
+
+	if (payload != item->data)
+		free(payload);
+	return ret;
+}
+
+// roms to add which are still on cart since they were removed are put back
+// in map instead of being burned, returns -1 if error
+static int cart_map_reuse_removed (void)
+{
+	int i, j, k;
+	int reused = 0;
+
+	if (cart_map_removed_load() < 0)
+		return -1;
+
+	for (i = 0; i < cart_map_file_number; i++)
+	{
+		cart_map_file_s* item = &cart_map_file[i];
+
+		for (j = 0; j < cart_map_removed_number; j++)
+		{
+			cart_map_s rom = cart_map_removed[j];
+			int hole, marked, check;
+			const cart_extent_s* extent;
+
+			if (strcmp(rom.name, item->romname) != 0 || (int)rom.size != item->size)
+				continue;
+
+			// nothing has been put there since
+			if ((hole = cart_space_find(cart_map_space, rom.offset)) < 0)
+				continue;
+			extent = cart_space_extent(cart_map_space, hole);
+			if ((int)(rom.offset + rom.size) > extent->offset + extent->size)
+				continue;
+
+			// it may still be in map (removed now), otherwise there must be room for it
+			for (marked = 0;
+			        marked < cart_map_number
+			     && (cart_map[marked].name[0] || cart_map[marked].offset != rom.offset || cart_map[marked].size != rom.size);
+			     marked++);
+			if (marked == cart_map_number && cart_map_number + 1 >= cart_map_max_number)
+				continue;
+
+			if ((check = cart_map_removed_check(item, rom.offset)) < 0)
+				return -1;
+			if (!check)
+			{
+				if (cart_verbose)
+					print("Removed rom '%s' at 0x%x has been overwritten\n", rom.name, rom.offset);
+				cart_map_removed_forget(j--);
+				continue;
+			}
+
+			print("Rom '%s' is still at 0x%x, it is put back in map without burning\n", rom.name, rom.offset);
+			if (marked < cart_map_number)
+				strcpy(cart_map[marked].name, rom.name);
+			else
+			{
+				// insert in offset order, keep map terminated
+				for (k = cart_map_number; k > 0 && cart_map[k - 1].offset > rom.offset; k--)
+					cart_map[k] = cart_map[k - 1];
+				cart_map[k] = rom;
+				cart_map_number++;
+				strcpy(cart_map[cart_map_number].name, "nomore");
+				cart_map[cart_map_number].size = cart_map[cart_map_number].offset = 0;
+			}
+			cart_map_removed_forget(j);
+
+			// this file is not to be placed anymore
+			if (item->data)
+			{
+				free(item->data);
+				cart_map_payload_size -= item->size;
+			}
+			memmove(item, item + 1, (--cart_map_file_number - i) * sizeof(cart_map_file_s));
+			i--;
+			reused++;
+			break;
+		}
+	}
+
+	if (!reused)
+		return 0;
+	something_to_be_done = 1;
+
+	// holes have changed
+	return cart_map_build_hole();
+}
+
+// room for number files in cart_map_file[], returns -1 if error
+static int cart_map_file_reserve (int number)
+{
+	cart_map_file_s* file;
+	int* order;
+	int* left;
+
+	if (number <= cart_map_file_max_number)
+		return 0;
+	file = (cart_map_file_s*)realloc(cart_map_file, number * sizeof(cart_map_file_s));
+	if (file)
+		cart_map_file = file;
+	order = (int*)realloc(cart_map_search_order, number * sizeof(int));
+	if (order)
+		cart_map_search_order = order;
+	left = (int*)realloc(cart_map_search_left, (number + 1) * sizeof(int));
+	if (left)
+		cart_map_search_left = left;
+	if (!file || !order || !left)
+	{
+		printerrno("realloc(%i) for files", number * (int)sizeof(cart_map_file_s));
+		return -1;
+	}
+	cart_map_file_max_number = number;
+	return 0;
+}
+
+// splits "file,romname" of number files into prep[], loads catalog and
+// starts loading, checking, trimming and correcting roms it does not know in
+// parallel (they will be cataloged when used), returns NULL if error
+static cart_jobs_s* cart_map_file_prep_start (const char* files[], int number, cart_map_file_prep_s* prep)
+{
+	int i;
+
+	for (i = 0; i < number; i++)
+	{
+		const char* comma;
+		char** split;
+		int j, len;
+
+		prep[i].source = files[i];
+		prep[i].filename = files[i];
+		prep[i].userromname = NULL;
+		prep[i].data = NULL;
+		prep[i].result = -1;
+
+		// check if user wants to rename the rom (files[i] is left untouched)
+		if ((comma = strstr(files[i], ",")) == NULL)
+			continue;
+		len = comma - files[i];
+		for (j = 0; j < cart_map_file_split_number; j++)
+			if (   (int)strlen(cart_map_file_split[j]) == len
+			    && strncmp(cart_map_file_split[j], files[i], len) == 0
+			    && strcmp(&cart_map_file_split[j][len + 1], &comma[1]) == 0)
+				break;
+		if (j == cart_map_file_split_number)
+		{
+			if ((split = (char**)realloc(cart_map_file_split, (j + 1) * sizeof(char*))) == NULL)
+			{
+				printerrno("realloc(%i) for file names", (j + 1) * (int)sizeof(char*));
+				return NULL;
+			}
+			cart_map_file_split = split;
+			if ((cart_map_file_split[j] = strdup(files[i])) == NULL)
+			{
+				printerrno("strdup(%s)", files[i]);
+				return NULL;
+			}
+			cart_map_file_split[j][len] = 0;
+			cart_map_file_split_number++;
+		}
+		prep[i].filename = cart_map_file_split[j];
+		prep[i].userromname = &cart_map_file_split[j][len + 1];
+	}
+
+	if (   cart_catalog_load() < 0
+	    || (!cart_map_payload_lock && (cart_map_payload_lock = cart_lock_create()) == NULL))
+		return NULL;
+	return cart_jobs_start(number, cart_map_file_prep_job, prep);
+}
+
+// files to be added or updated are prepared by workers while the linker
+// connects and boots, cart_map_file_prep_files() takes them when it is done
+int cart_map_prefetch (const char* files[], int files_number)
+{
+	int i, ret = 0;
+
+	if (files_number == 0 || cart_map_prefetch_prep)
+		return 0;
+	if ((cart_map_prefetch_prep = (cart_map_file_prep_s*)malloc(files_number * sizeof(cart_map_file_prep_s))) == NULL)
+	{
+		printerrno("malloc(%i) for files preparation", files_number * (int)sizeof(cart_map_file_prep_s));
+		return -1;
+	}
+
+	// missing files are told before the linker is bothered
+	for (i = 0; i < files_number; i++)
+	{
+		const char* comma = strstr(files[i], ",");
+		int len = comma? comma - files[i]: (int)strlen(files[i]);
+		char name [len + 1];
+		FILE* f;
+
+		snprintf(name, len + 1, "%s", files[i]);
+		if ((f = fopen(name, "rb")) == NULL)
+		{
+			printerrno("%s", name);
+			ret = -1;
+		}
+		else
+			fclose(f);
+	}
+	if (ret < 0 || (cart_map_prefetch_jobs = cart_map_file_prep_start(files, files_number, cart_map_prefetch_prep)) == NULL)
+	{
+		free(cart_map_prefetch_prep);
+		cart_map_prefetch_prep = NULL;
+		return -1;
+	}
+	cart_map_prefetch_number = cart_map_prefetch_left = files_number;
+	return 0;
+}
+
+// takes prefetched preparation of file if any, returns 1 if found
+static int cart_map_prefetch_take (const char* file, cart_map_file_prep_s* prep)
+{
+	int i;
+
+	if (!cart_map_prefetch_prep)
+		return 0;
+	for (i = 0; i < cart_map_prefetch_number && cart_map_prefetch_prep[i].source != file; i++);
+	if (i == cart_map_prefetch_number)
+		return 0;
+
+	*prep = cart_map_prefetch_prep[i];
+	// (file may be given again, it is prepared again then)
+	cart_map_prefetch_prep[i].source = NULL;
+	if (--cart_map_prefetch_left == 0)
+	{
+		free(cart_map_prefetch_prep);
+		cart_map_prefetch_prep = NULL;
+		cart_map_prefetch_number = 0;
+	}
+	return 1;
+}
+
+// workers are stopped and preparations which have not been taken are freed
+// (along with split file names, this is called at exit)
+void cart_map_prefetch_release (void)
+{
+	int i;
+
+	if (cart_map_prefetch_jobs)
+	{
+		cart_jobs_finish(cart_map_prefetch_jobs);
+		cart_map_prefetch_jobs = NULL;
+	}
+	while (cart_map_file_split_number > 0)
+		free(cart_map_file_split[--cart_map_file_split_number]);
+	free(cart_map_file_split);
+	cart_map_file_split = NULL;
+	if (!cart_map_prefetch_prep)
+		return;
+	for (i = 0; i < cart_map_prefetch_number; i++)
+	{
+		cart_map_file_prep_s* prep = &cart_map_prefetch_prep[i];
+
+		if (!prep->source)
+			// taken
+			continue;
+		if (prep->result == 1)
+			free(prep->entry.path);
+		if (prep->data)
+		{
+			free(prep->data);
+			cart_map_payload_size -= prep->size;
+		}
+	}
+	free(cart_map_prefetch_prep);
+	cart_map_prefetch_prep = NULL;
+	cart_map_prefetch_number = cart_map_prefetch_left = 0;
+}
+
+// fill cart_map_file[] with files to burn ("file" or "file,romname"),
+// returns -1 if error
+static int cart_map_file_prep_files (const char* add_files[], int add_files_number)
+{
+	int i, j, ret = 0;
+	int number = 0;
+	const char* files [add_files_number + 1];
+	int fresh [add_files_number + 1];
+	cart_map_file_prep_s* prep;
+	cart_jobs_s* jobs;
+	
+	if (cart_map_file_reserve(add_files_number) < 0)
+		return -1;
+	// (files to prepare now are in the second half)
+	if ((prep = (cart_map_file_prep_s*)malloc(2 * add_files_number * sizeof(cart_map_file_prep_s))) == NULL)
+	{
+		printerrno("malloc(%i) for files preparation", 2 * add_files_number * (int)sizeof(cart_map_file_prep_s));
+		return -1;
+	}
+
+	// workers are done with prefetched files (catalog is read only until then)
+	if (cart_map_prefetch_jobs)
+	{
+		cart_jobs_finish(cart_map_prefetch_jobs);
+		cart_map_prefetch_jobs = NULL;
+	}
+
+	// files which were not prepared while connecting are prepared now
+	for (i = 0; i < add_files_number; i++)
+		if (!cart_map_prefetch_take(add_files[i], &prep[i]))
+		{
+			fresh[number] = i;
+			files[number++] = add_files[i];
+		}
+	if ((jobs = cart_map_file_prep_start(files, number, &prep[add_files_number])) == NULL)
+	{
+		free(prep);
+		return -1;
+	}
+	cart_jobs_finish(jobs);
+	for (i = 0; i < number; i++)
+		prep[fresh[i]] = prep[add_files_number + i];
+
+	cart_map_file_number = add_files_number;
+	for (i = 0; i < add_files_number; i++)
+	{
+		cart_map_file_s*	item = &cart_map_file[i];
+		cart_catalog_entry_s*	entry;
+		cart_catalog_entry_s*	same;
+
+		item->data = NULL;
+		if (prep[i].result < 0)
+			entry = NULL;
+		else if (prep[i].result == 0)
+		{
+			if ((entry = cart_catalog_lookup(prep[i].filename)) && cart_verbose > 1)
+				print("File '%s' found in rom catalog\n", prep[i].filename);
+		}
+		else
+			entry = cart_catalog_store(&prep[i].entry);
+		if (entry == NULL)
+		{
+			ret = -1;
+			continue;
+		}
+
+		cart_map_file_init(item, prep[i].filename, prep[i].userromname, entry);
+
+		// warn about duplicates
+		for (j = 0; j < i; j++)
+			if (cart_map_file[j].crc == item->crc && cart_map_file[j].original_size == item->original_size)
+				printerr("Warning: '%s' has the same contents as '%s'\n", item->filename, cart_map_file[j].filename);
+		if (cart_verbose > 1 && (same = cart_catalog_find_same(entry)))
+			print("File '%s' has the same contents as cataloged '%s'\n", item->filename, same->path);
+
+		// rom has been loaded within budget: keep it ready for burning
+		if (prep[i].data && prep[i].size == item->size)
+		{
+			item->data = prep[i].data;
+			prep[i].data = NULL;
+		}
+	}
+
+	for (i = 0; i < add_files_number; i++)
+		if (prep[i].data)
+		{
+			free(prep[i].data);
+			cart_map_payload_size -= prep[i].size;
+		}
+	free(prep);
+	return ret;
+}
+
+// places prepared files (cart_map_file[]) in holes, returns -1 if error
+static int cart_map_insert_prepared (void)
+{
+	if (cart_map_reuse_removed() < 0)
+		return -1;
+
+	// wear is loaded before the search shares it with workers (a cart
+	// without identity has no known wear)
+	if (cart_plan_wear_weight && cart_map_identity && cart_wear_load() < 0)
+		return -1;
+	
+	if (cart_map_file_number)
+	{
+		something_to_be_done = 1;
+		return cart_map_file_find_best_insertion();
+	}
+	return 0;
+}
+
+int cart_map_find_best_insertion_for_files (const char* add_files[], int add_files_number)
+{
+	int i, j;
+
+	if (cart_map_file_prep_files(add_files, add_files_number) < 0)
+		return -1;
+
+	for (i = 0; i < cart_map_file_number; i++)
+	{
+		cart_map_file_s* item = &cart_map_file[i];
+
+		for (j = 0; j < cart_map_number; j++)
+			if (cart_map[j].name[0] && strcmp(cart_map[j].name, item->romname) == 0 && (int)cart_map[j].size == item->size)
+			{
+				printerr("Warning: rom '%s' (size 0x%x) seems to be already in cart\n", item->romname, item->size);
+				break;
+			}
+		
+		if (cart_verbose)
+			print("Adding file '%s' name '%s' size=0x%x / %.4gMb (trim+fit: %+g%%)\n",
+				item->filename,
+				item->romname,
+				item->size,
+				item->size * 8.0 / 1024 / 1024,
+				100.0 * item->size / item->original_size - 100.0);
+	}
+
+	return cart_map_insert_prepared();
+}
+
+// cart contents are made to be files[] (offset[i] >= 0: file i has to be
+// there): roms of map which are one of them (same name and size, and place
+// if it is fixed) are kept, the others are removed, and files not in map are
+// added (moved when their rom is in map elsewhere, or in a fixed place), all
+// from one map. Roms are matched by name and size only. Returns -1 if error.
+int cart_map_sync (const char* files[], const int offset[], int files_number)
+{
+	int match [cart_map_number + 1];	// file kept by each map entry, -1 if none
+	int kept [files_number + 1];
+	int keeps = 0, removes = 0, moves = 0, adds = 0;
+	long long burn = 0;
+	int i, j, k;
+
+	if (cart_map_file_prep_files(files, files_number) < 0)
+		return -1;
+
+	for (j = 0; j < cart_map_number; j++)
+		match[j] = -1;
+	for (i = 0; i < files_number; i++)
+	{
+		cart_map_file_s* item = &cart_map_file[i];
+
+		if (offset[i] > 0 && offset[i] % CART_ROM_BLOCK_SIZE)
+		{
+			printerr("Rom '%s' cannot be at 0x%x, roms are aligned on 0x%x.\n", item->romname, offset[i], CART_ROM_BLOCK_SIZE);
+			return -1;
+		}
+		kept[i] = 0;
+		for (j = 0; j < cart_map_number; j++)
+			if (   match[j] < 0
+			    && cart_map[j].name[0]
+			    && strcmp(cart_map[j].name, item->romname) == 0
+			    && (int)cart_map[j].size == item->size
+			    && (offset[i] < 0 || offset[i] == (int)cart_map[j].offset))
+			{
+				match[j] = i;
+				kept[i] = 1;
+				break;
+			}
+	}
+
+	// fixed places are made free: roms kept there are moved
+	for (i = 0; i < files_number; i++)
+		if (offset[i] >= 0 && !kept[i])
+			for (j = 0; j < cart_map_number; j++)
+				if (   match[j] >= 0
+				    && (int)cart_map[j].offset < offset[i] + cart_map_file[i].size
+				    && offset[i] < (int)(cart_map[j].offset + cart_map[j].size))
+				{
+					if (offset[match[j]] >= 0)
+					{
+						printerr("Roms '%s' and '%s' cannot be both at their place.\n", cart_map_file[i].romname, cart_map[j].name);
+						return -1;
+					}
+					kept[match[j]] = 0;
+					match[j] = -1;
+				}
+
+	// files which are in map elsewhere
+	for (i = 0; i < files_number; i++)
+		if (!kept[i])
+			for (j = 0; j < cart_map_number; j++)
+				if (   match[j] < 0
+				    && cart_map[j].name[0]
+				    && strcmp(cart_map[j].name, cart_map_file[i].romname) == 0
+				    && (int)cart_map[j].size == cart_map_file[i].size)
+				{
+					moves++;
+					break;
+				}
+
+	// other roms are removed (corrupted entries stay until removed with -X)
+	for (j = 0; j < cart_map_number; j++)
+		if (   match[j] < 0
+		    && cart_map[j].name[0]
+		    && strcmp(cart_map[j].name, MAP_TABLE_NAME) != 0
+		    && strcmp(cart_map[j].name, MAP_CORRUPTED_NAME) != 0)
+		{
+			if (cart_verbose)
+				print("Removing rom '%s' at 0x%x\n", cart_map[j].name, cart_map[j].offset);
+			if (cart_map_removed_load() == 0)
+				cart_map_removed_store(&cart_map[j]);
+			cart_map[j].name[0] = 0;
+			removes++;
+			something_to_be_done = 1;
+		}
+
+	// kept files are forgotten, fixed ones are put aside in offset order
+	if (cart_map_fixed)
+		free(cart_map_fixed);
+	if ((cart_map_fixed = (cart_map_file_s*)malloc((files_number + 1) * sizeof(cart_map_file_s))) == NULL)
+	{
+		printerrno("malloc(%i) for fixed roms", (files_number + 1) * (int)sizeof(cart_map_file_s));
+		return -1;
+	}
+	cart_map_fixed_number = 0;
+	for (i = k = 0; i < files_number; i++)
+	{
+		cart_map_file_s* item = &cart_map_file[i];
+
+		if (kept[i])
+		{
+			if (item->data)
+			{
+				free(item->data);
+				cart_map_payload_size -= item->size;
+			}
+			keeps++;
+			continue;
+		}
+		if (cart_verbose)
+			print("Adding file '%s' name '%s' size=0x%x / %.4gMb\n", item->filename, item->romname, item->size, item->size * 8.0 / 1024 / 1024);
+		burn += item->size;
+		adds++;
+		if (offset[i] < 0)
+		{
+			cart_map_file[k++] = *item;
+			continue;
+		}
+		item->offset = offset[i];
+		for (j = cart_map_fixed_number++; j > 0 && cart_map_fixed[j - 1].offset > item->offset; j--)
+			cart_map_fixed[j] = cart_map_fixed[j - 1];
+		cart_map_fixed[j] = *item;
+	}
+	cart_map_file_number = k;
+
+	print("Cart contents: %i rom(s) kept, %i removed, %i added, %i moved - %.4gMb to burn\n",
+	      keeps, removes - moves, adds - moves, moves, burn * 8.0 / 1024 / 1024);
+
+	if (cart_map_build_hole() < 0)
+		return -1;
+	if (cart_verbose > 0)
+		display_cart_map_hole();
+	if (cart_map_insert_prepared() < 0)
+		return -1;
+
+	// fixed roms go in their empty holes (set by cart_map_build_hole())
+	if (cart_map_fixed_number && cart_map_file_reserve(cart_map_file_number + cart_map_fixed_number) < 0)
+		return -1;
+	for (i = 0; i < cart_map_fixed_number; i++)
+	{
+		cart_map_file[cart_map_file_number++] = cart_map_fixed[i];
+		cart_map_fixed[i].data = NULL;
+		something_to_be_done = 1;
+	}
+	return 0;
+}
+
+/////////////////////////////////////////////
+// stage 4: build new map and burn everything
+/////////////////////////////////////////////
+
+void display_change_map_file (void)
+{
+	int change_map_file_index;
+	
+	print("Changes in map:\n");
+	for (change_map_file_index = 0; change_map_file_index < change_map_file_number; change_map_file_index++)
+	{
+		cart_map_file_s* item = &change_map_file[change_map_file_index];
+		if (cart_verbose || (item->action == MAP_ACTION_DONTOUCH && cart_verbose > 1))
+			print("\taction:%s rom:'%s' offset:0x%x size:0x%x last:0x%x\n",
+				item->action == MAP_ACTION_ADD? "add   ":
+				item->action == MAP_ACTION_DONTOUCH? "keep  ":
+				item->action == MAP_ACTION_REMOVE? "remove":
+				"error",
+				item->romname,
+				item->offset,
+				item->size,
+				item->offset + item->size - 1);
+	}
+}
+
+// cart_map_new without loader+map, terminated if not full
+static void cart_map_new_store (unsigned char* table)
+{
+	convert_cart_map_to_cart_v3(table, &cart_map_new[1], cart_map_new_number - (cart_map_new_number == cart_map_new_max_number));
+}
+
+// loader+map area in chunkrom (starting at cart offset burn_chunk_offset):
+// new loader, map table if it is not relocated, and locator
+static void cart_map_area_fill (unsigned char* chunkrom, int burn_chunk_offset)
+{
+	int locator_offset_in_chunk;
+	cart_map_locator_v3_s* burn_cart_map_locator;
+
+	// remember that the loader is not described in burnt cart map (which is womewhere in chunkrom[])
+	// while it is present in cart_map_new[0]
+
+	if (new_loader)
+	{
+		// copy the new loader in chunk
+		assert(burn_chunk_offset == 0);
+		memcpy(chunkrom, new_loader->data, new_loader_trimmed_size);
+		
+		assert(cart_map_new_area_location >= new_loader_trimmed_size);
+	}
+
+	// check burned map's termination (cart_map_new_max_number is always
+	// initialized to cart map size + 1)
+	assert(   cart_map_new_number == cart_map_new_max_number
+	       || (   cart_map_new[cart_map_new_number].size == 0
+		   && cart_map_new[cart_map_new_number].offset == 0));
+
+	// locate the locator, it ends loader+map
+	locator_offset_in_chunk = change_map_file[0].size - sizeof(cart_map_locator_v3_s) - burn_chunk_offset;
+	burn_cart_map_locator = (cart_map_locator_v3_s*)&chunkrom[locator_offset_in_chunk];
+
+	// relocated table is burned with its own entry (see cart_map_build_new())
+	if (cart_map_table_index < 0)
+		cart_map_new_store(&chunkrom[cart_map_new_location - burn_chunk_offset]);
+	burn_cart_map_locator->identity = hton32(cart_map_identity);
+	burn_cart_map_locator->generation = hton32(cart_map_generation + 1);
+	burn_cart_map_locator->area_location = hton32(cart_map_new_area_location);
+	burn_cart_map_locator->tail.magic = hton32(MAP_MAGIC);
+	burn_cart_map_locator->tail.location = hton32(cart_map_new_location);
+	burn_cart_map_locator->tail.number_of_entries = hton16(cart_map_new_max_number - 1);
+}
+
+// rom range changed by burning change_map_file[start..end]
+static void cart_map_chunk_range (int start, int end, int* offset, int* size)
+{
+	// is it the first chunk ?
+	if (start == 0)
+		// so map has to be burned (don't touch the loader unless it is new)
+		*offset = new_loader? 0: cart_map_new_area_location;
+	else
+		*offset = change_map_file[start].offset;
+	*size = change_map_file[end].offset + change_map_file[end].size - *offset;
+}
+
+// ranges of write blocks burn_offset..burn_offset+burn_size-1 which burning
+// change_map_file[start..end] does not change (loader+map area is changed
+// when start is 0), in offset order: returns their number (at most
+// end - start + 2), they are in offset[] and size[]
+static int cart_map_chunk_kept (int start, int end, int burn_offset, int burn_size, int offset[], int size[])
+{
+	int from = burn_offset;		// first byte which may be kept
+	int number = 0;
+	int index;
+
+	for (index = start; index <= end; index++)
+	{
+		int change_offset, change_end;
+
+		if (index == 0)
+		{
+			change_offset = new_loader? 0: cart_map_new_area_location;
+			change_end = change_map_file[0].size;
+		}
+		else if (change_map_file[index].action == MAP_ACTION_ADD)
+		{
+			change_offset = change_map_file[index].offset;
+			change_end = change_offset + change_map_file[index].size;
+		}
+		else
+			continue;
+		if (change_offset > from)
+		{
+			offset[number] = from;
+			size[number++] = change_offset - from;
+		}
+		from = MAX(from, change_end);
+	}
+	if (from < burn_offset + burn_size)
+	{
+		offset[number] = from;
+		size[number++] = burn_offset + burn_size - from;
+	}
+	return number;
+}
+
+// kept bytes (ranges contents one after the other) from or to chunkrom
+static void cart_map_chunk_copy_kept (unsigned char* chunkrom, int burn_offset, int number, const int offset[], const int size[], unsigned char* kept, int to_kept)
+{
+	int i;
+
+	for (i = 0; i < number; kept += size[i++])
+		if (to_kept)
+			memcpy(kept, &chunkrom[offset[i] - burn_offset], size[i]);
+		else
+			memcpy(&chunkrom[offset[i] - burn_offset], kept, size[i]);
+}
+
+// reads from cart what is burned along with changes but is not changed
+static int cart_map_chunk_borders (unsigned char* chunkrom, int burn_offset, int number, const int offset[], const int size[])
+{
+	int i;
+
+	for (i = 0; i < number; i++)
+	{
+		int border_offset = offset[i];
+		int border_size = size[i];
+
+		// (burned range is made of write blocks, which are loaded whole)
+		adjust_load_addresses(&border_offset, &border_size);
+		if (cart_verbose)
+			print("Loading border 0x%x..0x%x\n", border_offset, border_offset + border_size - 1);
+		if (cart_read_mem(&chunkrom[border_offset - burn_offset], GBA_ROM + border_offset, border_size) < 0)
+			return -1;
+	}
+	return 0;
+}
+
+///////////////////////////////////////
+// burn journal
+///////////////////////////////////////
+
+/*
+ * Added roms are burned first and the map last: until the new map is
+ * burned, the one in cart still describes the cart as it was before.
+ *
+ * Planned chunks and their state are kept on host side (JOURNAL_NAME), with
+ * the bytes which are not in rom files (JOURNAL_DATA_NAME): loader+map
+ * area, relocated map table, and borders of chunks, read before anything is
+ * burned (write blocks shared with kept roms are erased along with them).
+ *
+ * cart_map_resume() burns again the chunks which are not done, then the
+ * map. The map found in cart tells whether the journal is still to be
+ * finished (it was planned against this one), or is done (next generation,
+ * with the planned locator place, identity and table), otherwise it is
+ * discarded. Nothing is written in cart for the journal, and nothing is
+ * written in rom while it is pending (see cart_map_journal_pending()).
+ */
+
+static const char* journal_state_name [] = { "todo", "burning", "done" };
+
+// appends size bytes to journal data, returns -1 if error
+static int cart_map_journal_write_data (const unsigned char* data, int size, long* offset)
+{
+	FILE* f;
+
+	if ((f = fopen(cart_home_file(JOURNAL_DATA_NAME), "ab")) == NULL)
+	{
+		printerrno("fopen(%s)", cart_home_file(JOURNAL_DATA_NAME));
+		return -1;
+	}
+	fseek(f, 0, SEEK_END);
+	*offset = ftell(f);
+	if (fwrite(data, 1, size, f) != (size_t)size)
+	{
+		printerrno("write(%s)", cart_home_file(JOURNAL_DATA_NAME));
+		fclose(f);
+		return -1;
+	}
+	if (fclose(f) != 0)
+	{
+		printerrno("write(%s)", cart_home_file(JOURNAL_DATA_NAME));
+		return -1;
+	}
+	return 0;
+}
+
+static int cart_map_journal_read_data (unsigned char* data, int size, long offset)
+{
+	FILE* f;
+
+	if ((f = fopen(cart_home_file(JOURNAL_DATA_NAME), "rb")) == NULL)
+	{
+		printerrno("fopen(%s)", cart_home_file(JOURNAL_DATA_NAME));
+		return -1;
+	}
+	if (fseek(f, offset, SEEK_SET) != 0 || fread(data, 1, size, f) != (size_t)size)
+	{
+		printerr("%s is truncated.\n", cart_home_file(JOURNAL_DATA_NAME));
+		fclose(f);
+		return -1;
+	}
+	fclose(f);
+	return 0;
+}
+
+static int cart_map_journal_save (void)
+{
+	FILE* f;
+	char tmpname [1024];
+	int i, j;
+
+	snprintf(tmpname, sizeof(tmpname), "%s.new", cart_home_file(JOURNAL_NAME));
+	if ((f = fopen(tmpname, "w")) == NULL)
+	{
+		printerrno("fopen(%s)", tmpname);
+		return -1;
+	}
+	fputs(JOURNAL_HEADER, f);
+	fprintf(f, "cart %i generation %u new %i locator 0x%x identity 0x%08x table 0x%08x\n",
+		cart_map_journal_mbits, cart_map_journal_generation, cart_map_journal_new, cart_map_journal_locator,
+		cart_map_journal_identity, cart_map_journal_table);
+	for (i = 0; i < cart_map_journal_chunk_number; i++)
+	{
+		cart_map_journal_chunk_s* chunk = &cart_map_journal_chunk[i];
+
+		fprintf(f, "chunk 0x%x 0x%x %s %li\n", chunk->offset, chunk->size, journal_state_name[chunk->state], chunk->borders);
+		for (j = chunk->first; j <= chunk->last; j++)
+		{
+			cart_map_journal_item_s* item = &cart_map_journal_item[j];
+
+			if (item->data >= 0)
+				fprintf(f, "data 0x%x 0x%x %li\t%s\n", item->file.offset, item->file.size, item->data, item->file.romname);
+			else
+				fprintf(f, "rom 0x%x 0x%x 0x%x 0x%x %i\t%s\t%s\n",
+					item->file.offset, item->file.size, item->file.original_size, item->file.crc,
+					item->file.userromname != NULL, item->file.romname, item->file.filename);
+		}
+	}
+	if (fclose(f) != 0)
+	{
+		printerrno("write(%s)", tmpname);
+		return -1;
+	}
+
+#if _WIN32
+	remove(cart_home_file(JOURNAL_NAME));
+#endif
+	if (rename(tmpname, cart_home_file(JOURNAL_NAME)) != 0)
+	{
+		printerrno("rename(%s)", tmpname);
+		return -1;
+	}
+	return 0;
+}
+
+static void cart_map_journal_remove (void)
+{
+	remove(cart_home_file(JOURNAL_NAME));
+	remove(cart_home_file(JOURNAL_DATA_NAME));
+	cart_map_journal_free();
+}
+
+// new item in last chunk (file is copied, data is saved if not NULL), returns -1 if error
+static int cart_map_journal_add_item (const cart_map_file_s* file, const char* path, const unsigned char* data)
+{
+	cart_map_journal_item_s* item;
+
+	if ((item = (cart_map_journal_item_s*)realloc(cart_map_journal_item, (cart_map_journal_item_number + 1) * sizeof(cart_map_journal_item_s))) == NULL)
+	{
+		printerrno("realloc(%i) for burn journal", (cart_map_journal_item_number + 1) * (int)sizeof(cart_map_journal_item_s));
+		return -1;
+	}
+	cart_map_journal_item = item;
+	item = &cart_map_journal_item[cart_map_journal_item_number];
+	item->file = *file;
+	item->file.filename = strdup(path);
+	item->file.userromname = file->userromname? strdup(file->userromname): NULL;
+	item->file.data = NULL;
+	item->file.hole_index = -1;
+	item->file.action = MAP_ACTION_ADD;
+	item->data = -1;
+	cart_map_journal_chunk[cart_map_journal_chunk_number - 1].last = cart_map_journal_item_number++;
+	if (!item->file.filename || (file->userromname && !item->file.userromname))
+	{
+		printerrno("strdup for burn journal");
+		return -1;
+	}
+	if (data && cart_map_journal_write_data(data, file->size, &item->data) < 0)
+		return -1;
+	return 0;
+}
+
+static int cart_map_journal_add_chunk (int offset, int size)
+{
+	cart_map_journal_chunk_s* chunk;
+
+	if ((chunk = (cart_map_journal_chunk_s*)realloc(cart_map_journal_chunk, (cart_map_journal_chunk_number + 1) * sizeof(cart_map_journal_chunk_s))) == NULL)
+	{
+		printerrno("realloc(%i) for burn journal", (cart_map_journal_chunk_number + 1) * (int)sizeof(cart_map_journal_chunk_s));
+		return -1;
+	}
+	cart_map_journal_chunk = chunk;
+	chunk = &cart_map_journal_chunk[cart_map_journal_chunk_number++];
+	chunk->offset = offset;
+	chunk->size = size;
+	chunk->state = JOURNAL_TODO;
+	chunk->borders = -1;
+	chunk->first = cart_map_journal_item_number;
+	chunk->last = cart_map_journal_item_number - 1;
+	return 0;
+}
+
+// journal of change_map_file chunks start[i]..end[i] (loader+map area is
+// in the one starting at 0, the last one) with their borders
+static int cart_map_journal_start (const int* start, const int* end, unsigned char* const* kept, const int* kept_size, int number)
+{
+	int i, j;
+
+	if (cart_io_sim)
+		return 0;
+
+	// (no journal is pending, see cart_map_journal_pending())
+	cart_map_journal_remove();
+
+	cart_map_journal_generation = cart_map_generation;
+	cart_map_journal_new = cart_map_location == 0;
+	cart_map_journal_mbits = cart_size_mbits;
+	cart_map_journal_locator = change_map_file[0].size - CART_ROM_BLOCK_SIZE;
+
+	for (i = 0; i < number; i++)
+	{
+		int change_offset, change_size;
+
+		cart_map_chunk_range(start[i], end[i], &change_offset, &change_size);
+		if (   cart_map_journal_add_chunk(change_offset, change_size) < 0
+		    || cart_map_journal_write_data(kept[i], kept_size[i], &cart_map_journal_chunk[i].borders) < 0)
+			return -1;
+
+		// loader+map area, as bytes
+		if (start[i] == 0)
+		{
+			cart_map_file_s area;
+			unsigned char* data;
+			int ret;
+
+			memset(&area, 0, sizeof(area));
+			strcpy(area.romname, JOURNAL_AREA_NAME);
+			area.offset = change_offset;
+			area.original_size = area.size = change_map_file[0].size - area.offset;
+			if ((data = (unsigned char*)malloc(area.size)) == NULL)
+			{
+				printerrno("malloc(%i) for burn journal", area.size);
+				return -1;
+			}
+			memset(data, 0xff, area.size);
+			cart_map_area_fill(data, area.offset);
+			ret = cart_map_journal_add_item(&area, area.romname, data);
+			free(data);
+			if (ret < 0)
+				return -1;
+		}
+
+		for (j = MAX(start[i], 1); j <= end[i]; j++)
+		{
+			cart_map_file_s* item = &change_map_file[j];
+			char* path;
+			int ret;
+
+			if (item->action != MAP_ACTION_ADD)
+				continue;
+			if (strcmp(item->filename, MAP_TABLE_NAME) == 0)
+				ret = cart_map_journal_add_item(item, item->filename, item->data);
+			else if ((path = cart_absolute_path(item->filename)) == NULL)
+			{
+				printerrno("%s", item->filename);
+				return -1;
+			}
+			else
+			{
+				ret = cart_map_journal_add_item(item, path, NULL);
+				free(path);
+			}
+			if (ret < 0)
+				return -1;
+		}
+	}
+
+	// what tells the new map apart (its identity is set with loader+map area)
+	cart_map_journal_identity = cart_map_identity;
+	cart_map_journal_table = cart_map_table_crc(&cart_map_new[1], cart_map_new_number - 1);
+	return cart_map_journal_save();
+}
+
+int cart_map_journal_pending (void)
+{
+	FILE* f;
+
+	// its chunks may be half burned, and a map burned meanwhile would be
+	// taken for its own
+	if ((f = fopen(cart_home_file(JOURNAL_NAME), "r")) == NULL)
+		return 0;
+	fclose(f);
+	printerr("A burn has been interrupted, it has to be resumed with -q first.\n");
+	return 1;
+}
+
+static cart_map_journal_chunk_s* cart_map_journal_find (int change_chunk_offset)
+{
+	int i;
+
+	for (i = 0; i < cart_map_journal_chunk_number; i++)
+		if (cart_map_journal_chunk[i].offset == change_chunk_offset)
+			return &cart_map_journal_chunk[i];
+	return NULL;
+}
+
+// borders saved before burning, returns 1 if they are in kept
+static int cart_map_journal_borders (int change_chunk_offset, unsigned char* kept, int kept_size)
+{
+	cart_map_journal_chunk_s* chunk = cart_map_journal_find(change_chunk_offset);
+
+	if (!chunk || chunk->borders < 0)
+		return 0;
+	if (cart_map_journal_read_data(kept, kept_size, chunk->borders) < 0)
+		return -1;
+	return 1;
+}
+
+// chunk is about to be burned: its borders are saved (if they are not
+// yet), returns -1 if error
+static int cart_map_journal_burning (int change_chunk_offset, const unsigned char* kept, int kept_size)
+{
+	cart_map_journal_chunk_s* chunk = cart_map_journal_find(change_chunk_offset);
+
+	if (!chunk)
+		return 0;
+	if (chunk->borders < 0 && cart_map_journal_write_data(kept, kept_size, &chunk->borders) < 0)
+		return -1;
+	chunk->state = JOURNAL_BURNING;
+	return cart_map_journal_save();
+}
+
+static int cart_map_journal_done (int change_chunk_offset)
+{
+	cart_map_journal_chunk_s* chunk = cart_map_journal_find(change_chunk_offset);
+
+	if (!chunk)
+		return 0;
+	chunk->state = JOURNAL_DONE;
+	return cart_map_journal_save();
+}
+
+// returns 1 if journal is loaded, 0 if there is none, -1 if error
+static int cart_map_journal_load (void)
+{
+	FILE* f;
+	char line [JOURNAL_LINELEN];
+	int lineno = 0;
+	int i;
+
+	cart_map_journal_free();
+	if ((f = fopen(cart_home_file(JOURNAL_NAME), "r")) == NULL)
+		return 0;
+
+	while (fgets(line, JOURNAL_LINELEN, f))
+	{
+		cart_map_journal_chunk_s* chunk = cart_map_journal_chunk_number? &cart_map_journal_chunk[cart_map_journal_chunk_number - 1]: NULL;
+		cart_map_file_s file;
+		unsigned int offset, size, original_size, crc;
+		char state [16];
+		char* name;
+		char* path;
+		long data;
+		int user, len, ok;
+
+		lineno++;
+		if (line[0] == '#')
+			continue;
+		if ((len = strlen(line)) && line[len - 1] == '\n')
+			line[len - 1] = 0;
+
+		memset(&file, 0, sizeof(file));
+		if ((name = strchr(line, '\t')) != NULL)
+			*name++ = 0;
+		if (strncmp(line, "cart ", 5) == 0)
+			ok = sscanf(line, "cart %i generation %u new %i locator %x identity %x table %x",
+				    &cart_map_journal_mbits, &cart_map_journal_generation,
+				    &cart_map_journal_new, (unsigned int*)&cart_map_journal_locator,
+				    &cart_map_journal_identity, &cart_map_journal_table) == 6;
+		else if (strncmp(line, "chunk ", 6) == 0)
+		{
+			ok = sscanf(line, "chunk %x %x %15s %li", &offset, &size, state, &data) == 4;
+			for (i = JOURNAL_DONE; ok && i >= 0 && strcmp(state, journal_state_name[i]); i--);
+			if ((ok = ok && i >= 0 && cart_map_journal_add_chunk(offset, size) == 0))
+			{
+				cart_map_journal_chunk[cart_map_journal_chunk_number - 1].state = (journal_state_e)i;
+				cart_map_journal_chunk[cart_map_journal_chunk_number - 1].borders = data;
+			}
+		}
+		else if (strncmp(line, "rom ", 4) == 0)
+		{
+			ok =    chunk
+			     && name
+			     && sscanf(line, "rom %x %x %x %x %i", &offset, &size, &original_size, &crc, &user) == 5
+			     && (path = strchr(name, '\t')) != NULL;
+			if (ok)
+			{
+				*path++ = 0;
+				snprintf(file.romname, MAP_NAMELEN, "%s", name);
+				file.userromname = user? file.romname: NULL;
+				file.offset = offset;
+				file.size = size;
+				file.original_size = original_size;
+				file.crc = crc;
+				ok = cart_map_journal_add_item(&file, path, NULL) == 0;
+			}
+		}
+		else if (strncmp(line, "data ", 5) == 0)
+		{
+			ok =    chunk
+			     && name
+			     && sscanf(line, "data %x %x %li", &offset, &size, &data) == 3;
+			if (ok)
+			{
+				snprintf(file.romname, MAP_NAMELEN, "%s", name);
+				file.offset = offset;
+				file.original_size = file.size = size;
+				ok = cart_map_journal_add_item(&file, name, NULL) == 0;
+			}
+			if (ok)
+			{
+				cart_map_journal_item_s* item = &cart_map_journal_item[cart_map_journal_item_number - 1];
+				item->data = data;
+				if ((item->file.data = (unsigned char*)malloc(size)) == NULL)
+				{
+					printerrno("malloc(%i) for burn journal", size);
+					ok = 0;
+				}
+				else
+					ok = cart_map_journal_read_data(item->file.data, size, data) == 0;
+			}
+		}
+		else
+			ok = 0;
+
+		if (!ok)
+		{
+			printerr("%s:%i: bad line, burn cannot be resumed\n", cart_home_file(JOURNAL_NAME), lineno);
+			fclose(f);
+			cart_map_journal_free();
+			return -1;
+		}
+	}
+	fclose(f);
+	return 1;
+}
+
+// prints bytes read and written, write blocks erased and the time they
+// take according to the throughput model
+static void cart_map_print_cost (long long read, long long written, int blocks)
+{
+	long long ms = cart_rate_estimate_ms(read, written);
+
+	print("read %lldkB, write %lldkB, %i erase block(s), ", read >> 10, written >> 10, blocks);
+	if (ms < 0)
+		print("time unknown\n");
+	else
+		print("%.1fs\n", ms / 1000.0);
+}
+
+// what burning chunks costs: write blocks borders are read from cart, then
+// write blocks are erased and programmed
+static void cart_map_burn_report (const int chunk_start[], const int chunk_end[], int chunk_number)
+{
+	long long read = 0, written = 0;
+	int blocks = 0;
+	int i, j;
+
+	if (cart_rate_name()[0])
+		print("Burn plan (%s throughput model):\n", cart_rate_name());
+	else
+		print("Burn plan:\n");
+	for (i = 0; i < chunk_number; i++)
+	{
+		int offset [chunk_end[i] - chunk_start[i] + 2];
+		int size [chunk_end[i] - chunk_start[i] + 2];
+		int change_offset, change_size, burn_offset, burn_size;
+		int number, kept = 0;
+
+		cart_map_chunk_range(chunk_start[i], chunk_end[i], &change_offset, &change_size);
+		burn_offset = change_offset;
+		burn_size = change_size;
+		adjust_burn_addresses(&burn_offset, &burn_size);
+		number = cart_map_chunk_kept(chunk_start[i], chunk_end[i], burn_offset, burn_size, offset, size);
+		for (j = 0; j < number; j++)
+			kept += size[j];
+
+		if (chunk_end[i] > chunk_start[i])
+			print("\t#%i..#%i ", chunk_start[i], chunk_end[i]);
+		else
+			print("\t#%i ", chunk_start[i]);
+		print("0x%x..0x%x: ", burn_offset, burn_offset + burn_size - 1);
+		cart_map_print_cost(kept, burn_size, burn_size / CART_WRITE_BLOCK_SIZE);
+		read += kept;
+		written += burn_size;
+		blocks += burn_size / CART_WRITE_BLOCK_SIZE;
+	}
+	print("\ttotal: ");
+	cart_map_print_cost(read, written, blocks);
+}
+
+// burns change_map_file[start..end] (added entries, and loader+map area
+// when start is 0) in whole write blocks: what they do not change is kept,
+// taken from kept[] (see cart_map_chunk_kept()) if it is not NULL, from the
+// journal, or read from cart
+static int cart_map_burn_chunk (int start, int end, const unsigned char* kept)
+{
+	int change_chunk_offset = 0, change_chunk_size = 0;	// that we need
+	int burn_chunk_offset = 0, burn_chunk_size = 0;		// for burning
+	int kept_offset [end - start + 2];
+	int kept_size [end - start + 2];
+	int kept_number, kept_total = 0;
+
+	unsigned char* chunkrom;				// this will be burned
+	unsigned char* borders = NULL;
+	int index, journaled, ret = -1;
+	
+	if (end > start)
+		print("\nBurn map entries #%i..#%i...\n", start, end);
+	else
+		print("\nBurn map entry #%i...\n", start);
+	
+	// find limits
+	cart_map_chunk_range(start, end, &change_chunk_offset, &change_chunk_size);
+	burn_chunk_offset = change_chunk_offset;
+	burn_chunk_size = change_chunk_size;
+	adjust_burn_addresses(&burn_chunk_offset, &burn_chunk_size);
+	kept_number = cart_map_chunk_kept(start, end, burn_chunk_offset, burn_chunk_size, kept_offset, kept_size);
+	for (index = 0; index < kept_number; index++)
+		kept_total += kept_size[index];
+
+	// allocate memory
+	if ((chunkrom = (unsigned char*)malloc(burn_chunk_size)) == NULL)
+	{
+		printerr("cannot allocate %i/0x%x bytes for burning changes (index %i .. %i)\n", burn_chunk_size, burn_chunk_size, start, end);
+		return -1;
+	}
+	// which is the good value when cart map is erased
+	memset(chunkrom, 0xff, burn_chunk_size);
+	
+	// get the rom borders (from journal if burning it was interrupted)
+	if (!kept)
+	{
+		if ((borders = (unsigned char*)malloc(kept_total + 1)) == NULL)
+		{
+			printerrno("malloc(%i) for borders", kept_total);
+			goto end;
+		}
+		if ((journaled = cart_map_journal_borders(change_chunk_offset, borders, kept_total)) < 0)
+			goto end;
+		if (!journaled)
+		{
+			if (cart_map_chunk_borders(chunkrom, burn_chunk_offset, kept_number, kept_offset, kept_size) < 0)
+				goto end;
+			cart_map_chunk_copy_kept(chunkrom, burn_chunk_offset, kept_number, kept_offset, kept_size, borders, 1);
+		}
+		kept = borders;
+	}
+	cart_map_chunk_copy_kept(chunkrom, burn_chunk_offset, kept_number, kept_offset, kept_size, (unsigned char*)kept, 0);
+	
+	if (start == 0)
+		cart_map_area_fill(chunkrom, burn_chunk_offset);
+	
+	// now we can fill the rom with files, skip 0 which is loader+map
+	for (index = MAX(start, 1); index <= end; index++)
+	{
+		cart_map_file_s* item = &change_map_file[index];
+		
+		if (item->action != MAP_ACTION_ADD)
+			continue;
+		assert(item->filename);
+		assert(item->offset >= burn_chunk_offset && item->offset + item->size <=  burn_chunk_offset + burn_chunk_size);
+		if (item->data)
+			memcpy(&chunkrom[item->offset - burn_chunk_offset], item->data, item->size);
+		else if (cart_map_file_load(item, &chunkrom[item->offset - burn_chunk_offset]) < 0)
+			goto end;
+	}
+	
+	// yeah! it's time to burn (at last!! I've been waiting for that moment for a while...)
+
+	if (cart_io_sim)
+		print("No burning (simulation)\n");
+	else if (   cart_map_journal_burning(change_chunk_offset, kept, kept_total) < 0
+	         || cart_burn(GBA_ROM, burn_chunk_offset, chunkrom, 0, burn_chunk_size) < 0
+	         || cart_map_journal_done(change_chunk_offset) < 0)
+		goto end;
+	if (start == 0)
+		cart_map_generation++;
+	ret = 0;
+
+end:
+	free(borders);
+	free(chunkrom);
+	return ret;
+}
+
+// burn contiguous change_map_file chunks, borders are read from cart (or
+// from journal if burning was interrupted)
+int burn_map_chunk (int burn_map_file_index_start, int burn_map_file_index_end)
+{
+	return cart_map_burn_chunk(burn_map_file_index_start, burn_map_file_index_end, NULL);
+}
+
+// burns again journal chunks which are not done (only the one which was
+// being burned if interrupted_only), returns -1 if error
+static int cart_map_journal_burn (int interrupted_only)
+{
+	int i, ret = 0;
+
+	// chunks as a change map: loader+map is not burned as such (it is the last chunk)
+	change_map_file_number = 1 + cart_map_journal_item_number;
+	if ((change_map_file = (cart_map_file_s*)malloc(sizeof(cart_map_file_s) * change_map_file_number)) == NULL)
+	{
+		printerrno("malloc(%i) for change map", (int)sizeof(cart_map_file_s) * change_map_file_number);
+		return -1;
+	}
+	memset(&change_map_file[0], 0, sizeof(cart_map_file_s));
+	strcpy(change_map_file[0].romname, "Loader+map");
+	change_map_file[0].original_size = change_map_file[0].size = cart_map_journal_locator + CART_ROM_BLOCK_SIZE;
+	change_map_file[0].hole_index = -1;
+	change_map_file[0].action = MAP_ACTION_DONTOUCH;
+	for (i = 0; i < cart_map_journal_item_number; i++)
+		change_map_file[1 + i] = cart_map_journal_item[i].file;
+
+	for (i = 0; ret == 0 && i < cart_map_journal_chunk_number; i++)
+		if (   cart_map_journal_chunk[i].state == JOURNAL_BURNING
+		    || (cart_map_journal_chunk[i].state == JOURNAL_TODO && !interrupted_only))
+			ret = burn_map_chunk(1 + cart_map_journal_chunk[i].first, 1 + cart_map_journal_chunk[i].last);
+
+	free(change_map_file);
+	change_map_file = NULL;
+	change_map_file_number = 0;
+	return ret;
+}
+
+// generation of the map in cart (burned is set if it is the one planned by
+// journal), returns 1 if there is one, 0 if not, -1 if error
+static int cart_map_resume_generation (u_int32_t* generation, u_int32_t* identity, int* burned)
+{
+	int found = cart_map_locate();
+
+	*generation = cart_map_generation;
+	*identity = cart_map_identity;
+	*burned =    found == 1
+		  && cart_map_generation == cart_map_journal_generation + 1
+		  && cart_map_identity == cart_map_journal_identity
+		  && loader_and_cart_map_size - CART_ROM_BLOCK_SIZE == cart_map_journal_locator
+		  && cart_map_table_crc(cart_map, cart_map_number) == cart_map_journal_table;
+	reset_cart_map();
+	return found;
+}
+
+// journal which cannot be resumed is discarded, returns -1
+static int cart_map_resume_discard (void)
+{
+	printerr("Interrupted burn is discarded.\n");
+	cart_map_journal_remove();
+	return -1;
+}
+
+int cart_map_resume (void)
+{
+	u_int32_t generation = 0;
+	u_int32_t identity = 0;
+	FILE* f;
+	int found, burned;
+
+	if ((f = fopen(cart_home_file(JOURNAL_NAME), "r")) == NULL)
+	{
+		print("No interrupted burn to resume.\n");
+		return 0;
+	}
+	fclose(f);
+
+	if (cart_map_journal_load() < 0)
+		return -1;
+	if (cart_map_journal_mbits != cart_size_mbits)
+	{
+		printerr("Interrupted burn was planned for a %iMbits cart.\n", cart_map_journal_mbits);
+		return cart_map_resume_discard();
+	}
+	cart_map_journal_free();
+	print("Resuming interrupted burn...\n");
+
+	// map in cart now, nothing is burned unless it is the one the burn was
+	// planned against
+	if ((found = cart_map_resume_generation(&generation, &identity, &burned)) < 0)
+		return -1;
+	if (!found)
+	{
+		// the chunk being burned may have erased the map (when they share
+		// a write block): it is restored first
+		if (cart_map_journal_load() < 0)
+			return -1;
+		if (cart_map_journal_burn(1) < 0)
+		{
+			cart_map_journal_free();
+			return -1;
+		}
+		cart_map_journal_free();
+		if ((found = cart_map_resume_generation(&generation, &identity, &burned)) < 0)
+			return -1;
+	}
+
+	if (cart_map_journal_load() < 0)
+		return -1;
+	if (burned)
+	{
+		print("Interrupted burn has been completed (cart map is burned).\n");
+		cart_map_locator_hints_save(cart_map_journal_locator);
+		cart_map_journal_remove();
+		return 0;
+	}
+	if (found? generation != cart_map_journal_generation || (identity && identity != cart_map_journal_identity): !cart_map_journal_new)
+	{
+		printerr("Cart map has changed since the interrupted burn was planned, it cannot be resumed.\n");
+		return cart_map_resume_discard();
+	}
+
+	if (cart_map_journal_burn(0) < 0)
+	{
+		cart_map_journal_free();
+		return -1;
+	}
+	cart_map_locator_hints_save(cart_map_journal_locator);
+	cart_map_journal_remove();
+	print("... done\n");
+	return 0;
+}
+
+// map table of needed entries out of loader+map: in its current block
+// (change_map_file[table]) if it is large enough, or in a new one inserted
+// in change_map_file, in the smallest gap between entries
+static int cart_map_relocate_table (int table, int needed)
+{
+	cart_map_file_s* item;
+	cart_space_s* space;
+	int size = needed * sizeof(cart_map_entry_s);
+	int index, best_offset;
+	int end;
+
+	if (needed > 0xffff)
+	{
+		printerr("A cart map cannot hold %i roms.\n", needed);
+		return -1;
+	}
+	adjust_rom_size(&size);
+
+	if (table > 0 && change_map_file[table].size >= (int)(needed * sizeof(cart_map_entry_s)))
+		index = table;
+	else
+	{
+		if (table > 0)
+			change_map_file[table].action = MAP_ACTION_REMOVE;
+		// gaps between entries (removed roms may overlap added ones)
+		if ((space = cart_space_create()) == NULL)
+			return -1;
+		end = change_map_file[0].size;
+		for (index = 1; index <= change_map_file_number; index++)
+		{
+			int next = index < change_map_file_number? change_map_file[index].offset: CART_SIZE_BYTES;
+
+			if (next > end && cart_space_free(space, end, next - end) < 0)
+			{
+				cart_space_destroy(space);
+				return -1;
+			}
+			if (index < change_map_file_number)
+				end = MAX(end, change_map_file[index].offset + change_map_file[index].size);
+		}
+		best_offset = cart_space_best_fit(space, size);
+		cart_space_destroy(space);
+		if (best_offset < 0)
+		{
+			printerr("No room left in cart for a map table of %i roms (%i bytes).\n", needed, size);
+			return -1;
+		}
+		for (index = 1; index < change_map_file_number && change_map_file[index].offset < best_offset; index++);
+
+		if ((item = (cart_map_file_s*)realloc(change_map_file, (change_map_file_number + 1) * sizeof(cart_map_file_s))) == NULL)
+		{
+			printerrno("realloc(%i) for change map", (change_map_file_number + 1) * (int)sizeof(cart_map_file_s));
+			return -1;
+		}
+		change_map_file = item;
+		memmove(&change_map_file[index + 1], &change_map_file[index], (change_map_file_number - index) * sizeof(cart_map_file_s));
+		change_map_file_number++;
+		item = &change_map_file[index];
+		strcpy(item->romname, MAP_TABLE_NAME);
+		item->userromname = NULL;
+		item->crc = 0;
+		item->original_size = item->size = size;
+		item->hole_index = -1;
+		item->offset = best_offset;
+		if (cart_verbose)
+			print("Map table of %i roms is relocated at 0x%x\n", needed, best_offset);
+	}
+
+	// (filled by cart_map_build_new())
+	item = &change_map_file[index];
+	if ((cart_map_table = (unsigned char*)malloc(item->size)) == NULL)
+	{
+		printerrno("malloc(%i) for map table", item->size);
+		return -1;
+	}
+	memset(cart_map_table, 0xff, item->size);
+	item->filename = MAP_TABLE_NAME;
+	item->data = cart_map_table;
+	item->action = MAP_ACTION_ADD;
+	cart_map_table_index = index;
+	cart_map_new_location = item->offset;
+	cart_map_new_max_number = MIN(item->size / (int)sizeof(cart_map_entry_s), 0xffff);
+	return 0;
+}
+
+// build cart_map_new from change_map_file (loader+map included, removed roms left out)
+// the table goes after the loader if it fits there, otherwise it is relocated
+static int cart_map_build_new (void)
+{
+	int change_map_file_index;
+	int cart_map_new_index;
+	int area_max_number;
+	int number, table;
+
+	if (!cart_map_identity)
+		cart_map_identity = cart_map_identity_new();
+
+	// table space after loader
+	if (new_loader)
+	{
+		// (computed by build_hole())
+		cart_map_new_area_location = cart_map_new_location;
+		area_max_number = cart_map_new_max_number;
+	}
+	else
+	{
+		cart_map_new_area_location = cart_map_area_location;
+		area_max_number = (loader_and_cart_map_size - (int)sizeof(cart_map_locator_v3_s) - cart_map_area_location) / (int)sizeof(cart_map_entry_s);
+	}
+
+	if (cart_map_table)
+		free(cart_map_table);
+	cart_map_table = NULL;
+	cart_map_table_index = -1;
+
+	// roms, relocated table left out
+	number = 0;
+	table = -1;
+	for (change_map_file_index = 1; change_map_file_index < change_map_file_number; change_map_file_index++)
+		if (change_map_file[change_map_file_index].action != MAP_ACTION_REMOVE)
+		{
+			if (strcmp(change_map_file[change_map_file_index].romname, MAP_TABLE_NAME) == 0)
+				table = change_map_file_index;
+			else
+				number++;
+		}
+	if (number <= area_max_number)
+	{
+		// relocated table is not needed (anymore)
+		if (table > 0)
+			change_map_file[table].action = MAP_ACTION_REMOVE;
+		cart_map_new_location = cart_map_new_area_location;
+		cart_map_new_max_number = MAX(area_max_number, 0);
+	}
+	else if (cart_map_relocate_table(table, number + 1) < 0)
+		return -1;
+
+	cart_map_new_number = 0;
+	for (change_map_file_index = 0; change_map_file_index < change_map_file_number; change_map_file_index++)
+		if (change_map_file[change_map_file_index].action != MAP_ACTION_REMOVE)
+			cart_map_new_number++;
+	// (loader+map is not in burned map)
+	assert(cart_map_new_number - 1 <= cart_map_new_max_number);
+	// cart_map_new will contain loader+map but it will not be burned, so we +1 here
+	// now we add one because we need to deal with the loader too in the following
+	// remember that the loader will not be present in final burnt cart map
+	cart_map_new_max_number++;
+	if ((cart_map_new = (cart_map_s*)malloc(cart_map_new_max_number * sizeof(cart_map_s))) == NULL)
+	{
+		printerr("cannot allocate %i bytes of memory for new cart map.\n", cart_map_new_number * sizeof(cart_map_s));
+		return -1;
+	}
+
+	// build new map:
+	// copy from change_map_file except removed rom
+	// loader+map (item 0 in change_map_file) will be copied
+	cart_map_new_index = 0;
+	for (change_map_file_index = 0; change_map_file_index < change_map_file_number; change_map_file_index++)
+		if (change_map_file[change_map_file_index].action != MAP_ACTION_REMOVE)
+		{
+			strcpy(cart_map_new[cart_map_new_index].name, change_map_file[change_map_file_index].romname);
+			cart_map_new[cart_map_new_index].offset = change_map_file[change_map_file_index].offset;
+			cart_map_new[cart_map_new_index].size = change_map_file[change_map_file_index].size;
+			cart_map_new_index++;
+		}
+	cart_map_new_number = cart_map_new_index;
+	if (cart_map_new_number < cart_map_new_max_number)
+	{
+		strcpy(cart_map_new[cart_map_new_number].name, "nomore");
+		cart_map_new[cart_map_new_number].size = cart_map_new[cart_map_new_number].offset = 0;
+	}
+	if (cart_map_table)
+		cart_map_new_store(cart_map_table);
+			
+	if (cart_verbose > 0)
+	{
+		print("New ");
+		display_cart_map_ptr(cart_map_new, cart_map_new_number, /* map has loader */ 1);
+	}
+
+	return 0;
+}
+
+// a loader+map area which has shrunk leaves its previous locator (whose
+// rom block starts at offset) in the first hole: it is blanked unless a rom
+// has been burned over it, returns -1 if error
+static int cart_map_blank_locator (int offset)
+{
+	unsigned char* data;
+	int block = offset / CART_WRITE_BLOCK_SIZE * CART_WRITE_BLOCK_SIZE;
+	int locator = offset + CART_ROM_BLOCK_SIZE - SIZE_1K;
+	u_int32_t generation;
+	int i, ret = -1;
+
+	for (i = 1; i < cart_map_new_number; i++)
+		if (   (int)cart_map_new[i].offset < offset + CART_ROM_BLOCK_SIZE
+		    && offset < (int)(cart_map_new[i].offset + cart_map_new[i].size))
+			return 0;
+
+	if ((data = (unsigned char*)malloc(CART_WRITE_BLOCK_SIZE)) == NULL)
+	{
+		printerrno("malloc(%i) to blank previous locator", CART_WRITE_BLOCK_SIZE);
+		return -1;
+	}
+	if (cart_read_mem(data, GBA_ROM + block, CART_WRITE_BLOCK_SIZE) < 0)
+		goto end;
+	ret = 0;
+	if (cart_map_locator_at(&data[locator - block], &generation))
+	{
+		print("Blanking previous map locator at 0x%x...\n", GBA_ROM + locator);
+		memset(&data[locator - block], 0xff, SIZE_1K);
+		ret = cart_burn(GBA_ROM, block, data, 0, CART_WRITE_BLOCK_SIZE);
+	}
+
+end:
+	free(data);
+	return ret;
+}
+
+// change_map_file chunks to burn, in offset order but the one with the
+// loader+map area (starting at 0) which is the last one: contiguous added
+// entries, merged (with what is between them) when they share a write block
+// so that no write block is burned twice, returns their number
+static int cart_map_chunks (int chunk_start[], int chunk_end[])
+{
+	int number = 1;
+	int burn_end, offset, size, map_end;
+	int i;
+
+	chunk_start[0] = chunk_end[0] = 0;
+	cart_map_chunk_range(0, 0, &offset, &size);
+	adjust_burn_addresses(&offset, &size);
+	burn_end = offset + size;
+
+	for (i = 1; i < change_map_file_number; i++)
+	{
+		if (change_map_file[i].action != MAP_ACTION_ADD)
+			continue;
+		offset = change_map_file[i].offset;
+		size = change_map_file[i].size;
+		adjust_burn_addresses(&offset, &size);
+
+		// a relocated map table may not be contiguous to the previous chunk
+		if (   offset >= burn_end
+		    && (   chunk_start[number - 1] == 0
+		        || chunk_end[number - 1] != i - 1
+		        || change_map_file[i - 1].offset + change_map_file[i - 1].size != change_map_file[i].offset))
+			chunk_start[number++] = i;
+		chunk_end[number - 1] = i;
+		burn_end = MAX(burn_end, offset + size);
+	}
+
+	// everything the new map points to is burned before it
+	map_end = chunk_end[0];
+	for (i = 0; i < number - 1; i++)
+	{
+		chunk_start[i] = chunk_start[i + 1];
+		chunk_end[i] = chunk_end[i + 1];
+	}
+	chunk_start[number - 1] = 0;
+	chunk_end[number - 1] = map_end;
+	return number;
+}
+
+typedef struct
+{
+	int	offset;
+	int	size;
+	unsigned char* kept;		// where it goes
+} cart_map_border_s;
+
+static int cart_map_border_cmp (const void* a, const void* b)
+{
+	return ((const cart_map_border_s*)a)->offset - ((const cart_map_border_s*)b)->offset;
+}
+
+// reads borders of all chunks (see cart_map_chunk_kept()) before anything
+// is burned, in one pass over the cart: each read covers neighbour borders,
+// returns -1 if error
+static int cart_map_chunks_borders (const int chunk_start[], const int chunk_end[], int chunk_number, unsigned char* kept[], int kept_size[])
+{
+	cart_map_border_s* border;
+	unsigned char* data;
+	int number = 0, max_number = 0, reads = 0;
+	int i, j, ret = -1;
+
+	for (i = 0; i < chunk_number; i++)
+	{
+		kept[i] = NULL;
+		max_number += chunk_end[i] - chunk_start[i] + 2;
+	}
+	if ((border = (cart_map_border_s*)malloc(max_number * sizeof(cart_map_border_s))) == NULL)
+	{
+		printerrno("malloc(%i) for borders", max_number * (int)sizeof(cart_map_border_s));
+		return -1;
+	}
+
+	for (i = 0; i < chunk_number; i++)
+	{
+		int offset [chunk_end[i] - chunk_start[i] + 2];
+		int size [chunk_end[i] - chunk_start[i] + 2];
+		int change_offset, change_size;
+		int n;
+
+		cart_map_chunk_range(chunk_start[i], chunk_end[i], &change_offset, &change_size);
+		adjust_burn_addresses(&change_offset, &change_size);
+		n = cart_map_chunk_kept(chunk_start[i], chunk_end[i], change_offset, change_size, offset, size);
+		for (kept_size[i] = j = 0; j < n; j++)
+			kept_size[i] += size[j];
+		if ((kept[i] = (unsigned char*)malloc(kept_size[i] + 1)) == NULL)
+		{
+			printerrno("malloc(%i) for borders", kept_size[i]);
+			goto end;
+		}
+		for (kept_size[i] = j = 0; j < n; j++)
+		{
+			border[number].offset = offset[j];
+			border[number].size = size[j];
+			border[number++].kept = &kept[i][kept_size[i]];
+			kept_size[i] += size[j];
 		}
 	}
-	
-	if (burn_map_file_index_start == 0)
+	qsort(border, number, sizeof(cart_map_border_s), cart_map_border_cmp);
+
+	// borders i..j-1 are loaded at once
+	for (i = 0; i < number; i = j)
 	{
-		int locator_offset_in_chunk;
-		cart_map_locator_s* burn_cart_map_locator;
-		
-		// remember that the loader is not described in burnt cart map (which is womewhere in chunkrom[])
-		// while it is present in cart_map_new[0]
+		int offset = border[i].offset;
+		int size = border[i].size;
 
-		if (new_loader)
+		adjust_load_addresses(&offset, &size);
+		for (j = i + 1; j < number && border[j].offset <= offset + size; j++)
 		{
-			// copy the new loader in chunk
-			assert(burn_chunk_offset == 0);
-			memcpy(chunkrom, new_loader->data, new_loader_trimmed_size);
-			
-			assert(burn_cart_map_location > new_loader_trimmed_size);
-		}
-		else
-			assert(burn_cart_map_location == cart_map_location); // check same location
+			int end = border[j].offset + border[j].size;
 
-		// check burned map's termination
-		assert(   cart_map_new_number == burn_cart_map_max_number + 1
-		       || (   cart_map_new[cart_map_new_number].size == 0
-			   && cart_map_new[cart_map_new_number].offset == 0));
-
-		// locate the locator
-		locator_offset_in_chunk = burn_cart_map_location + (burn_cart_map_max_number * sizeof(cart_map_s)) - burn_chunk_offset;
-		if (burn_map_file_index_end == 0)
-			assert(locator_offset_in_chunk + burn_chunk_offset - change_chunk_offset + (int)sizeof(cart_map_locator_s) == change_chunk_size);
-		else
-			assert(locator_offset_in_chunk + burn_chunk_offset - change_chunk_offset + (int)sizeof(cart_map_locator_s) < change_chunk_size);
-		burn_cart_map_locator = (cart_map_locator_s*)&chunkrom[locator_offset_in_chunk];
-	
-		// copy map but skip loader, we don't want it in map
-		memcpy(&chunkrom[burn_cart_map_location - burn_chunk_offset], &cart_map_new[1], burn_cart_map_max_number * sizeof(cart_map_s));
-		convert_cart_map_endian_from_host_to_cart((cart_map_s*)&chunkrom[burn_cart_map_location - burn_chunk_offset], burn_cart_map_max_number);
-		burn_cart_map_locator->magic = hton32(MAP_MAGIC);
-		burn_cart_map_locator->location = hton32(burn_cart_map_location);
-		burn_cart_map_locator->number_of_entries = hton16(burn_cart_map_max_number);
-	}
-	
-	// now we can fill the rom with files, skip 0 which is loader+map
-	for (index = MAX(burn_map_file_index_start, 1); index <= burn_map_file_index_end; index++)
-	{
-		int size_to_load;
-		cart_map_file_s* item = &change_map_file[index];
-		
-		assert(item->action == MAP_ACTION_ADD);
-		assert(item->filename);
-		assert(item->offset >= burn_chunk_offset && item->offset + item->size <=  burn_chunk_offset + burn_chunk_size);
-		size_to_load = item->original_size;
-		// trimmed rom ?
-		if (size_to_load > item->size)
-			size_to_load = item->size;
-		assert(size_to_load > 0);
-		if (load_from_file(item->filename, &chunkrom[item->offset - burn_chunk_offset], &size_to_load) == NULL)
-		{
-			free(chunkrom);
-			return -1;
+			size = end - offset;
+			adjust_load_addresses(&offset, &size);
 		}
-	
-		// pad file with the last byte
-		if (item->size > size_to_load)
-			memset(&chunkrom[item->offset - burn_chunk_offset + size_to_load], chunkrom[item->offset - burn_chunk_offset + size_to_load - 1], item->size - size_to_load);
 
-		// homebrew roms often need correction, correct_header() has to be reworked
-		correct_header(&chunkrom[item->offset - burn_chunk_offset],
-			       item->userromname? item->userromname: item->romname,
-			       /* force name */ item->userromname? 1: 0);
+		if ((data = (unsigned char*)malloc(size)) == NULL)
+		{
+			printerrno("malloc(%i) for borders", size);
+			goto end;
+		}
+		if (cart_verbose)
+			print("Loading borders 0x%x..0x%x\n", offset, offset + size - 1);
+		if (cart_read_mem(data, GBA_ROM + offset, size) < 0)
+		{
+			free(data);
+			goto end;
+		}
+		for (; i < j; i++)
+			memcpy(border[i].kept, &data[border[i].offset - offset], border[i].size);
+		free(data);
+		reads++;
 	}
-	
-	// yeah! it's time to burn (at last!! I've been waiting for that moment for a while...)
+	if (cart_verbose && number)
+		print("%i border(s) loaded in %i read(s)\n", number, reads);
+	ret = 0;
 
-	if (cart_io_sim)
-		print("No burning (simulation)\n");
-	else if (cart_burn(GBA_ROM, burn_chunk_offset, chunkrom, 0, burn_chunk_size) < 0)
-	{
-		free(chunkrom);
-		return -1;
-	}
+end:
+	free(border);
+	return ret;
+}
 
-	free(chunkrom);
-	return 0;
+// burn chunks of added roms then loader+map (each write block once, borders
+// read first), with a journal to resume them if they are interrupted
+static int cart_map_burn_changes (void)
+{
+	int chunk_start [change_map_file_number];
+	int chunk_end [change_map_file_number];
+	unsigned char* kept [change_map_file_number];
+	int kept_size [change_map_file_number];
+	int chunk_number;
+	int i, ret = -1;
+
+	chunk_number = cart_map_chunks(chunk_start, chunk_end);
+	if (cart_io_sim || cart_verbose)
+		cart_map_burn_report(chunk_start, chunk_end, chunk_number);
+
+	if (   cart_map_chunks_borders(chunk_start, chunk_end, chunk_number, kept, kept_size) < 0
+	    || cart_map_journal_start(chunk_start, chunk_end, kept, kept_size, chunk_number) < 0)
+		goto end;
+	for (i = 0; i < chunk_number; i++)
+		if (cart_map_burn_chunk(chunk_start[i], chunk_end[i], kept[i]) < 0)
+			goto end;
+	if (!cart_io_sim)
+		cart_map_journal_remove();
+	ret = 0;
+
+end:
+	for (i = 0; i < chunk_number; i++)
+		free(kept[i]);
+	return ret;
 }
 
-// the most interesting part: burn parts (new file and/or erased headers) and reburn cart map
 int cart_map_process_changes (void)
 {
 	cart_map_file_s* new;
 	int change_map_file_index;
 	int cart_map_index;
 	int cart_map_hole_index;
-	int cart_map_new_index;
 	int hole_offset;
-	int burn_map_file_index_start;
-	int burn_map_file_index_end;
 
 	if (!something_to_be_done)
 	{
@@ -1007,6 +4041,7 @@ int cart_map_process_changes (void)
 	new = &change_map_file[0];
 	strcpy(new->romname, "Loader+map");
 	new->filename = NULL;
+	new->data = NULL;
 	new->original_size = new->size = new_loader? new_loader_and_cart_map_size: loader_and_cart_map_size;
 	new->hole_index = -1;
 	new->offset = 0;
@@ -1071,6 +4106,7 @@ int cart_map_process_changes (void)
 
 			strcpy(new->romname, src->name);
 			new->filename = NULL;
+			new->data = NULL;
 			new->original_size = new->size = src->size;
 			new->hole_index = -1;
 			new->offset = src->offset;
@@ -1104,6 +4140,7 @@ int cart_map_process_changes (void)
 
 				strcpy(new->romname, src->name);
 				new->filename = NULL;
+				new->data = NULL;
 				new->original_size = new->size = src->size;
 				new->hole_index = -1;
 				new->offset = src->offset;
@@ -1129,99 +4166,520 @@ int cart_map_process_changes (void)
 	/////////////////////////////////
 	// build updated cart map to burn
 	
-	cart_map_new_number = 0;
-	for (change_map_file_index = 0; change_map_file_index < change_map_file_number; change_map_file_index++)
-		if (cart_map_file[change_map_file_index].action != MAP_ACTION_REMOVE)
-			cart_map_new_number++;
-	if (cart_map_new_number > cart_map_max_number)
+	if (cart_map_build_new() < 0)
 	{
-		printerr("new cart map size is %i, but the maximum number of rom in map is %i.\n"
-		         "something has to be improved here...\n",
-		         cart_map_new_number,
-		         cart_map_max_number);
 		reset_cart_map();
 		return -1;
 	}
-	// cart_map_new will contain loader+map but it will not be burned, so we +1 here
-	// cart_map_new_max_number has been initialized in buid_hole().
-	assert((new_loader && cart_map_new_max_number > 0) || cart_map_new_max_number == cart_map_max_number);
-	// now we add one because we need to deal with the loader too in the following
-	// remember that the loader will not be present in final burnt cart map
-	cart_map_new_max_number++;
-	if ((cart_map_new = (cart_map_s*)malloc(cart_map_new_max_number * sizeof(cart_map_s))) == NULL)
+	
+	//////////////////////////////////////////
+	// reburn changed cart chunks (map + roms)
+
+	print("Applying changes...\n");
+
+	if (cart_map_burn_changes() < 0)
 	{
-		printerr("cannot allocate %i bytes of memory for new cart map.\n", cart_map_new_number * sizeof(cart_map_s));
 		reset_cart_map();
 		return -1;
 	}
 
-	// build new map:
-	// copy from change_map_file except removed rom
-	// loader+map (item 0 in change_map_file) will be copied
-	cart_map_new_index = 0;
-	for (change_map_file_index = 0; change_map_file_index < change_map_file_number; change_map_file_index++)
-		if (change_map_file[change_map_file_index].action != MAP_ACTION_REMOVE)
+	// cart has changed: removed roms which are overwritten are forgotten
+	if (!cart_io_sim)
+	{
+		if (   new_loader
+		    && new_loader_and_cart_map_size < loader_and_cart_map_size
+		    && cart_map_blank_locator(loader_and_cart_map_size - CART_ROM_BLOCK_SIZE) < 0)
 		{
-			strcpy(cart_map_new[cart_map_new_index].name, change_map_file[change_map_file_index].romname);
-			cart_map_new[cart_map_new_index].offset = change_map_file[change_map_file_index].offset;
-			cart_map_new[cart_map_new_index].size = change_map_file[change_map_file_index].size;
-			cart_map_new_index++;
+			reset_cart_map();
+			return -1;
 		}
-	cart_map_new_number = cart_map_new_index;
-	if (cart_map_new_number < cart_map_new_max_number)
-	{
-		strcpy(cart_map_new[cart_map_new_number].name, "nomore");
-		cart_map_new[cart_map_new_number].size = cart_map_new[cart_map_new_number].offset = 0;
+		cart_map_removed_save();
+		cart_map_locator_hints_save((new_loader? new_loader_and_cart_map_size: loader_and_cart_map_size) - CART_ROM_BLOCK_SIZE);
 	}
-			
-	if (cart_verbose > 0)
+
+	print("... done\n");
+	reset_cart_map();
+	return 0;
+}
+
+///////////////////////////////////////
+// compaction
+///////////////////////////////////////
+
+/*
+ * To make a hole of a given size, the roms between two kept roms (or the
+ * loader, or the cart end) are moved into the holes outside of them. Of
+ * these windows, the one needing the fewest moves (then the fewest bytes to
+ * move) is chosen, provided its roms fit outside (best fit decreasing).
+ * Their places are then chosen by the placement search.
+ *
+ * Roms are only moved to free space, so a move never overwrites a rom in
+ * map: the rom is read from cart and burned at its new place, then the map
+ * is burned pointing to it. If something goes wrong in between, the map
+ * still points to the old copy which has not been touched.
+ */
+
+// indexes of roms in map (not marked for remove), in offset order
+static int cart_map_live (int* live)
+{
+	int i, live_number = 0;
+
+	for (i = 0; i < cart_map_number; i++)
+		if (cart_map[i].name[0])
+		{
+			assert(live_number == 0 || cart_map[i].offset >= cart_map[live[live_number - 1]].offset);
+			live[live_number++] = i;
+		}
+	return live_number;
+}
+
+// can roms live[first..last-1] fit in holes outside of [window_start, window_end[
+static int cart_map_compact_fits (const int* live, int first, int last, int window_start, int window_end)
+{
+	cart_space_s* space;
+	int size [last - first];
+	int i, j, offset, fits = 1;
+
+	if ((space = cart_space_create()) == NULL)
+		return 0;
+	for (i = 0; i < cart_map_hole_number; i++)
+		if (   ((int)cart_map_hole[i].offset >= window_end || (int)(cart_map_hole[i].offset + cart_map_hole[i].size) <= window_start)
+		    && cart_space_free(space, cart_map_hole[i].offset, cart_map_hole[i].size) < 0)
+			fits = 0;
+
+	// largest first
+	for (i = 0; i < last - first; i++)
 	{
-		print("New ");
-		display_cart_map_ptr(cart_map_new, cart_map_new_number, /* map has loader */ 1);
+		int rom_size = cart_map[live[first + i]].size;
+		for (j = i; j > 0 && size[j - 1] < rom_size; j--)
+			size[j] = size[j - 1];
+		size[j] = rom_size;
 	}
-	
-	//////////////////////////////////////////
-	// reburn changed cart chunks (map + roms)
 
-	print("Applying changes...\n");
+	for (i = 0; fits && i < last - first; i++)
+		fits =    (offset = cart_space_best_fit(space, size[i])) >= 0
+		       && cart_space_use(space, offset, size[i]) >= 0;
+	cart_space_destroy(space);
+	return fits;
+}
 
-	// at minimum, we do this:
-	burn_map_file_index_start = 0; // cart map must be reburned
-	burn_map_file_index_end = 0; // cart map must be reburned
-	
-	if (change_map_file_number == 1)
+// move rom #index of map to offset (free space): burn it there, then burn map
+static int cart_map_compact_move (int index, int offset)
+{
+	cart_map_s* rom = &cart_map[index];
+	cart_map_file_s* new;
+	unsigned char* data;
+	int live [cart_map_number + 1];
+	int live_number, moved = -1;
+	int i, j, ret = -1;
+
+	print("\nMoving rom '%s' from 0x%x to 0x%x (size 0x%x)...\n", rom->name, rom->offset, offset, rom->size);
+
+	if ((data = (unsigned char*)malloc(rom->size)) == NULL)
+	{
+		printerrno("cannot allocate %i bytes to move rom '%s'", rom->size, rom->name);
+		return -1;
+	}
+	if (cart_read_mem(data, GBA_ROM + rom->offset, rom->size) < 0)
+		goto end;
+
+	// change map: loader+map, then roms in offset order, the moved one being added
+	live_number = cart_map_live(live);
+	change_map_file_number = 1 + live_number;
+	if ((change_map_file = (cart_map_file_s*)malloc(sizeof(cart_map_file_s) * change_map_file_number)) == NULL)
 	{
-		// user want to reburn loader and only loader (there are no other roms than loader)
-		burn_map_chunk(0, 0);
+		printerr("cannot allocate %i bytes for change map processing !\n", (int)sizeof(cart_map_file_s) * change_map_file_number);
+		goto end;
 	}
-	else for (change_map_file_index = 1; change_map_file_index < change_map_file_number; change_map_file_index++)
+	new = &change_map_file[0];
+	strcpy(new->romname, "Loader+map");
+	new->filename = NULL;
+	new->data = NULL;
+	new->original_size = new->size = loader_and_cart_map_size;
+	new->hole_index = -1;
+	new->offset = 0;
+	new->action = MAP_ACTION_DONTOUCH;
+	for (i = 0; i < live_number; i++)
 	{
-		cart_map_file_s* item = &change_map_file[change_map_file_index];
-		if (item->action == MAP_ACTION_ADD)
+		cart_map_s* src = &cart_map[live[i]];
+		cart_map_file_s item;
+
+		strcpy(item.romname, src->name);
+		item.filename = NULL;
+		item.data = NULL;
+		item.original_size = item.size = src->size;
+		item.hole_index = -1;
+		item.offset = src->offset;
+		item.action = MAP_ACTION_DONTOUCH;
+		if (live[i] == index)
 		{
-			if (burn_map_file_index_start < 0)
-				burn_map_file_index_start = change_map_file_index;
-			else
-				// sanity check
-				assert((change_map_file[change_map_file_index - 1].offset + change_map_file[change_map_file_index - 1].size) == item->offset);
-			burn_map_file_index_end = change_map_file_index;
+			item.filename = rom->name;
+			item.data = data;
+			item.offset = offset;
+			item.action = MAP_ACTION_ADD;
 		}
+		for (j = i + 1; j > 1 && change_map_file[j - 1].offset > item.offset; j--)
+			change_map_file[j] = change_map_file[j - 1];
+		change_map_file[j] = item;
+	}
+	for (i = 1; i < change_map_file_number; i++)
+		if (change_map_file[i].action == MAP_ACTION_ADD)
+			moved = i;
+	assert(moved > 0);
+
+	if (cart_map_build_new() < 0)
+		goto end;
+	// (a relocated map table may have been inserted before it)
+	for (moved = 1; change_map_file[moved].data != data; moved++);
+
+	// rom first, then map
+	if (   burn_map_chunk(moved, moved) < 0
+	    || (cart_map_table_index > 0 && burn_map_chunk(cart_map_table_index, cart_map_table_index) < 0)
+	    || burn_map_chunk(0, 0) < 0)
+		goto end;
+
+	// map in memory is now the burned one
+	if (cart_map_new_number - 1 > cart_map_max_number)
+	{
+		// its table has been relocated to grow: read it again
+		free(cart_around_map);
+		cart_around_map = NULL;
+		cart_map = NULL;
+		if (load_cart_map() >= 0)
+			ret = 0;
+		goto end;
+	}
+	for (i = 1; i < cart_map_new_number; i++)
+		cart_map[i - 1] = cart_map_new[i];
+	cart_map_number = cart_map_new_number - 1;
+	if (cart_map_number < cart_map_max_number)
+	{
+		strcpy(cart_map[cart_map_number].name, "nomore");
+		cart_map[cart_map_number].size = cart_map[cart_map_number].offset = 0;
+	}
+	ret = 0;
+
+end:
+	free(data);
+	if (change_map_file)
+		free(change_map_file);
+	change_map_file = NULL;
+	change_map_file_number = 0;
+	if (cart_map_new)
+		free(cart_map_new);
+	cart_map_new = NULL;
+	return ret;
+}
+
+int cart_map_compact (int hole_size)
+{
+	int live [cart_map_number + 1];
+	int old_offset [cart_map_number + 1];
+	int offset [cart_map_number + 1];
+	int live_number, first, last, moves;
+	int best_first = -1, best_moves = 0;
+	long long best_bytes = 0;
+	int largest = 0;
+	int window_start = 0, window_end = 0;
+	int i, j;
 
-		// the hole has been filled, or there is nothing more in change_map_file, time to burn !
-		if (   (item->action != MAP_ACTION_ADD || change_map_file_index == change_map_file_number - 1)
-		    && burn_map_file_index_start >= 0)
+	if (cart_map_build_hole() < 0)
+		return -1;
+	if (cart_space_largest(cart_map_space))
+		largest = cart_space_largest(cart_map_space)->size;
+	if (largest >= hole_size)
+	{
+		print("Largest hole is already 0x%x=%.4gMb, nothing to move.\n", largest, largest * 8.0 / 1024 / 1024);
+		return 0;
+	}
+
+	// find the window to clear
+	live_number = cart_map_live(live);
+	for (first = 0; first < live_number; first++)
+	{
+		long long bytes = 0;
+		int start = first? (int)(cart_map[live[first - 1]].offset + cart_map[live[first - 1]].size): loader_and_cart_map_size;
+
+		for (last = first + 1; last <= live_number; last++)
 		{
-			if (burn_map_chunk(burn_map_file_index_start, burn_map_file_index_end) < 0)
+			int end = last < live_number? (int)cart_map[live[last]].offset: CART_SIZE_BYTES;
+
+			// a relocated map table stays where its locator points to
+			if (strcmp(cart_map[live[last - 1]].name, MAP_TABLE_NAME) == 0)
+				break;
+			bytes += cart_map[live[last - 1]].size;
+			if (best_first >= 0 && (last - first > best_moves || (last - first == best_moves && bytes >= best_bytes)))
+				break;
+			if (end - start < hole_size)
+				continue;
+			// a larger window only has more roms to move and less room for them
+			if (cart_map_compact_fits(live, first, last, start, end))
 			{
-				reset_cart_map();
-				return -1;
+				best_first = first;
+				best_moves = last - first;
+				best_bytes = bytes;
+				window_start = start;
+				window_end = end;
 			}
-			burn_map_file_index_start = burn_map_file_index_end = -1;
+			break;
 		}
 	}
-	
+	if (best_first < 0)
+	{
+		printerr("Cannot make a 0x%x=%.4gMb hole by moving roms (largest hole is 0x%x=%.4gMb).\n",
+			 hole_size, hole_size * 8.0 / 1024 / 1024,
+			 largest, largest * 8.0 / 1024 / 1024);
+		return -1;
+	}
+
+	// place roms of window in holes outside of it
+	for (i = j = 0; i < cart_map_hole_number; i++)
+		if ((int)cart_map_hole[i].offset >= window_end || (int)(cart_map_hole[i].offset + cart_map_hole[i].size) <= window_start)
+			cart_map_hole[j++] = cart_map_hole[i];
+	cart_map_hole_number = j;
+	moves = best_moves;
+	if (cart_map_file_reserve(moves) < 0)
+		return -1;
+	for (i = 0; i < moves; i++)
+	{
+		cart_map_file_s* item = &cart_map_file[i];
+		cart_map_s* src = &cart_map[live[best_first + i]];
+
+		memset(item, 0, sizeof(*item));
+		strcpy(item->romname, src->name);
+		item->original_size = item->size = src->size;
+		old_offset[i] = src->offset;
+	}
+	cart_map_file_number = moves;
+	if (cart_map_file_find_best_insertion() < 0)
+		return -1;
+	if (cart_verbose > 0)
+		cart_map_file_display_best_score();
+
+	// roms are stacked from the start of their hole
+	for (i = 0; i < cart_map_hole_number; i++)
+	{
+		int hole_offset = cart_map_hole[i].offset;
+		for (j = 0; j < moves; j++)
+			if (cart_map_file[j].hole_index == i)
+			{
+				offset[j] = hole_offset;
+				hole_offset += cart_map_file[j].size;
+			}
+	}
+
+	print("Compaction: moving %i rom(s) (%.4gMb) frees 0x%x=%.4gMb at 0x%x (largest hole was 0x%x=%.4gMb)\n",
+	      moves, best_bytes * 8.0 / 1024 / 1024,
+	      window_end - window_start, (window_end - window_start) * 8.0 / 1024 / 1024, window_start,
+	      largest, largest * 8.0 / 1024 / 1024);
+	for (i = 0; i < moves; i++)
+		print("\t- rom '%s' from 0x%x to 0x%x\n", cart_map_file[i].romname, old_offset[i], offset[i]);
+
+	for (i = 0; i < moves; i++)
+	{
+		// map indexes change after each move
+		for (j = 0; j < cart_map_number && (!cart_map[j].name[0] || (int)cart_map[j].offset != old_offset[i]); j++);
+		assert(j < cart_map_number);
+		if (cart_map_compact_move(j, offset[i]) < 0)
+			return -1;
+	}
 
 	print("... done\n");
-	reset_cart_map();
-	return 0;
+	return moves;
+}
+
+///////////////////////////////////////
+// in place update
+///////////////////////////////////////
+
+/*
+ * A rom rebuilt over and over (homebrew) is burned again at its offset,
+ * over its old version, provided it still fits there (in its place and the
+ * hole following it). Only the write blocks whose contents change are
+ * burned, and the map is burned only if the rom size has changed.
+ * Roms which do not fit anymore are removed, and added like with -A.
+ */
+
+// burn map with new size of rom #index
+static int cart_map_update_map (int index, int size)
+{
+	cart_map_file_s* new;
+	int live [cart_map_number + 1];
+	int live_number;
+	int i, ret = -1;
+
+	live_number = cart_map_live(live);
+	change_map_file_number = 1 + live_number;
+	if ((change_map_file = (cart_map_file_s*)malloc(sizeof(cart_map_file_s) * change_map_file_number)) == NULL)
+	{
+		printerr("cannot allocate %i bytes for change map processing !\n", (int)sizeof(cart_map_file_s) * change_map_file_number);
+		return -1;
+	}
+	new = &change_map_file[0];
+	strcpy(new->romname, "Loader+map");
+	new->filename = NULL;
+	new->data = NULL;
+	new->original_size = new->size = loader_and_cart_map_size;
+	new->hole_index = -1;
+	new->offset = 0;
+	new->action = MAP_ACTION_DONTOUCH;
+	for (i = 0; i < live_number; i++)
+	{
+		cart_map_s* src = &cart_map[live[i]];
+
+		new = &change_map_file[i + 1];
+		strcpy(new->romname, src->name);
+		new->filename = NULL;
+		new->data = NULL;
+		new->original_size = new->size = live[i] == index? size: (int)src->size;
+		new->hole_index = -1;
+		new->offset = src->offset;
+		new->action = MAP_ACTION_DONTOUCH;
+	}
+
+	if (   cart_map_build_new() >= 0
+	    && (cart_map_table_index < 0 || burn_map_chunk(cart_map_table_index, cart_map_table_index) >= 0)
+	    && burn_map_chunk(0, 0) >= 0)
+	{
+		cart_map[index].size = size;
+		ret = 0;
+	}
+
+	free(change_map_file);
+	change_map_file = NULL;
+	change_map_file_number = 0;
+	if (cart_map_new)
+		free(cart_map_new);
+	cart_map_new = NULL;
+	return ret;
+}
+
+// burn item over rom #index of map, write block by write block,
+// returns -1 if error
+static int cart_map_update_rom (const cart_map_file_s* item, int index)
+{
+	int start = cart_map[index].offset;
+	int burn_offset = start;
+	int burn_size = item->size;
+	unsigned char* payload = item->data;
+	unsigned char* data;
+	int offset, blocks = 0, checked = 0, burned = 0, ret = -1;
+
+	adjust_burn_addresses(&burn_offset, &burn_size);
+	if ((data = (unsigned char*)malloc(2 * CART_WRITE_BLOCK_SIZE)) == NULL)
+	{
+		printerrno("malloc(%i) to update rom '%s'", 2 * CART_WRITE_BLOCK_SIZE, item->romname);
+		return -1;
+	}
+	if (!payload)
+	{
+		if ((payload = (unsigned char*)malloc(item->size)) == NULL)
+		{
+			printerrno("malloc(%i) to update rom '%s'", item->size, item->romname);
+			goto end;
+		}
+		if (cart_map_file_load(item, payload) < 0)
+			goto end;
+	}
+
+	for (offset = burn_offset; offset < burn_offset + burn_size; offset += CART_WRITE_BLOCK_SIZE)
+	{
+		unsigned char* cart = &data[CART_WRITE_BLOCK_SIZE];
+		int from = MAX(offset, start);
+		int to = MIN(offset + CART_WRITE_BLOCK_SIZE, start + item->size);
+
+		// what is around the rom in its first and last blocks is kept
+		blocks++;
+		if (!cart_burn_without_comparison || from > offset || to < offset + CART_WRITE_BLOCK_SIZE)
+		{
+			print("Checking 0x%x...\r", GBA_ROM + offset);
+			printflush();
+			if (cart_read_mem(cart, GBA_ROM + offset, CART_WRITE_BLOCK_SIZE) < 0)
+				goto end;
+			memcpy(data, cart, CART_WRITE_BLOCK_SIZE);
+			checked++;
+		}
+		memcpy(&data[from - offset], &payload[from - start], to - from);
+		if (!cart_burn_without_comparison && memcmp(data, cart, CART_WRITE_BLOCK_SIZE) == 0)
+			continue;
+
+		print("\n");
+		if (cart_io_sim)
+			print("No burning (simulation)\n");
+		else if (cart_burn(GBA_ROM, offset, data, 0, CART_WRITE_BLOCK_SIZE) < 0)
+			goto end;
+		burned++;
+	}
+	print("\n");
+	print("Rom '%s' updated in place at 0x%x: %i of %i write blocks burned (%ikB)\n",
+	      item->romname, start, burned, blocks, (burned * CART_WRITE_BLOCK_SIZE) >> 10);
+	if (cart_io_sim || cart_verbose)
+	{
+		print("\t");
+		cart_map_print_cost((long long)checked * CART_WRITE_BLOCK_SIZE, (long long)burned * CART_WRITE_BLOCK_SIZE, burned);
+	}
+
+	// size in map
+	if (item->size != (int)cart_map[index].size && cart_map_update_map(index, item->size) < 0)
+		goto end;
+	ret = 0;
+
+end:
+	if (payload != item->data)
+		free(payload);
+	free(data);
+	return ret;
+}
+
+int cart_map_update (const char* files[], int files_number)
+{
+	int i, j, left = 0;
+
+	if (cart_map_check_lost() < 0 || cart_map_file_prep_files(files, files_number) < 0)
+		return -1;
+
+	for (i = 0; i < cart_map_file_number; i++)
+	{
+		cart_map_file_s* item = &cart_map_file[i];
+		int end = CART_SIZE_BYTES;
+		int index;
+
+		for (index = 0; index < cart_map_number && (!cart_map[index].name[0] || strcmp(cart_map[index].name, item->romname) != 0); index++);
+
+		// room up to next rom in map
+		if (index < cart_map_number)
+			for (j = 0; j < cart_map_number; j++)
+				if (cart_map[j].name[0] && cart_map[j].offset > cart_map[index].offset)
+					end = MIN(end, (int)cart_map[j].offset);
+
+		if (index < cart_map_number && (int)cart_map[index].offset + item->size <= end)
+		{
+			if (cart_map_update_rom(item, index) < 0)
+				return -1;
+			continue;
+		}
+
+		if (index < cart_map_number)
+		{
+			const char* name = item->romname;
+			print("Rom '%s' (size 0x%x) does not fit at 0x%x anymore, it is removed and added again\n",
+			      item->romname, item->size, cart_map[index].offset);
+			cart_map_mark_for_remove(&name, 1);
+		}
+		else
+			print("Rom '%s' is not in cart map, it is added\n", item->romname);
+
+		// (as given, "file,romname")
+		files[left++] = files[i];
+	}
+
+	// files will be prepared again when added (catalog now knows them)
+	while (cart_map_file_number > 0)
+		if (cart_map_file[--cart_map_file_number].data)
+		{
+			free(cart_map_file[cart_map_file_number].data);
+			cart_map_file[cart_map_file_number].data = NULL;
+			cart_map_payload_size -= cart_map_file[cart_map_file_number].size;
+		}
+	return left;
 }
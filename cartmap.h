@@ -12,8 +12,12 @@
 
 #define MAP_NAMELEN		32
 #define MAP_MINIMUM_ENTRIES	2
-#define MAP_MAGIC		0x1F2A0002	// IF2A-0002 map version
+#define MAP_MAGIC_V2		0x1F2A0002	// IF2A-0002 map version (read only)
+#define MAP_MAGIC		0x1F2A0003	// IF2A-0003 map version
+#define MAP_TABLE_NAME		"(if2a map)"	// entry of a map table relocated out of loader+map
+#define MAP_CORRUPTED_NAME	"(corrupted)"	// entry whose crc is wrong, its place is kept
 
+// in host memory, and in cart for IF2A-0002 maps
 typedef struct
 {
 	char		name[MAP_NAMELEN];
@@ -21,6 +25,16 @@ typedef struct
 	u_int32_t	size;
 } __attribute__ ((packed)) cart_map_s;
 
+// in cart for IF2A-0003 maps
+typedef struct
+{
+	char		name[MAP_NAMELEN];
+	u_int32_t	offset;
+	u_int32_t	size;
+	u_int32_t	crc;		// crc32 of the fields above, as stored in cart
+} __attribute__ ((packed)) cart_map_entry_s;
+
+// IF2A-0002 locator, ends every locator block
 typedef struct
 {
 	u_int32_t	magic;
@@ -28,10 +42,22 @@ typedef struct
 	u_int16_t	number_of_entries;
 } __attribute__ ((packed)) cart_map_locator_s;
 
+// IF2A-0003 locator
+typedef struct
+{
+	u_int32_t		identity;	// random, tells carts apart (see cart_map_identity)
+	u_int32_t		generation;	// incremented each time the map is burned
+	u_int32_t		area_location;	// table space after loader (unused when table is relocated)
+	cart_map_locator_s	tail;		// location may be out of loader+map (see MAP_TABLE_NAME)
+} __attribute__ ((packed)) cart_map_locator_v3_s;
+
 void	reset_cart_map				(void);
 
 void	brand_new_empty_cart_map		(void);
 int	load_cart_map				(void);
+int	load_cart_map_at			(const unsigned char* small_cart, int offset);
+int	cart_map_locate				(void);
+int	cart_map_rom_size_at			(int offset);
 void	display_cart_map			(void);
 void	cart_map_mark_for_remove		(const char* del_files[], int del_files_number);
 void	cart_map_replace_loader			(binware_s* loader);
@@ -40,3 +66,10 @@ void	display_cart_map_hole			(void);
 int	cart_map_find_best_insertion_for_files	(const char* add_files[], int add_files_number);
 void	cart_map_file_display_best_score	(void);
 int	cart_map_process_changes		(void);
+int	cart_map_compact			(int hole_size);
+int	cart_map_update				(const char* files[], int files_number);
+int	cart_map_resume				(void);
+int	cart_map_journal_pending		(void);
+int	cart_map_sync				(const char* files[], const int offset[], int files_number);
+int	cart_map_prefetch			(const char* files[], int files_number);
+void	cart_map_prefetch_release		(void);
@@ -0,0 +1,184 @@
+/*
+ * Based in f2a by Ulrich Hecht <uli@emulinks.de>
+ * if2a by D. Gauchard <deyv@free.fr>
+ * F2A Ultra support by Vincent Rubiolo <vincent.rubiolo@free.fr>
+ * Licensed under the terms of the GNU Public License version 2
+ */
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <ctype.h>
+
+#include "cartrate.h"
+#include "cartutils.h"
+
+/*///////////////////////////////////////////////////////////////////////////
+
+How fast the linker reads from and burns into the cart is measured on every
+rom read (cart_read_mem()) and burn (cart_direct_write(), erasing included).
+Measures are kept on host side, one model per linker and cart type, in
+if2a's home directory. They are only bytes and time, halved when they grow
+past RATE_WINDOW so that recent transfers count most.
+
+The model gives the wall time of a burn plan before it is run
+(cart_rate_estimate_ms(), see cart_map_process_changes() with -d).
+
+///////////////////////////////////////////////////////////////////////////*/
+
+#define RATE_HEADER		"# if2a throughput model v1\n"
+#define RATE_LINELEN		128
+#define RATE_NAMELEN		64
+#define RATE_WINDOW		(256LL * 1024 * 1024)	// bytes measured before halving
+
+typedef struct
+{
+	long long	bytes;
+	long long	us;
+} cart_rate_s;
+
+static char		cart_rate_model [RATE_NAMELEN] = "";	// "linker-cart", "" if none
+static cart_rate_s	cart_rate_read = { 0, 0 };
+static cart_rate_s	cart_rate_write = { 0, 0 };
+static int		cart_rate_changed = 0;
+
+static const char* cart_rate_file (void)
+{
+	char name [RATE_NAMELEN + 8];
+
+	snprintf(name, sizeof(name), "rate-%s", cart_rate_model);
+	return cart_home_file(name);
+}
+
+int cart_rate_select (const char* linker, cart_type_e cart_type)
+{
+	FILE* f;
+	char line [RATE_LINELEN];
+	int lineno = 0;
+	char* c;
+
+	// file name made of linker and cart type names
+	snprintf(cart_rate_model, RATE_NAMELEN, "%s-%s", linker, cart_type_str(cart_type));
+	for (c = cart_rate_model; *c; c++)
+		if (!isalnum((unsigned char)*c) && *c != '-')
+			*c = '_';
+	cart_rate_read.bytes = cart_rate_read.us = 0;
+	cart_rate_write.bytes = cart_rate_write.us = 0;
+	cart_rate_changed = 0;
+
+	if ((f = fopen(cart_rate_file(), "r")) == NULL)
+		// nothing measured yet
+		return 0;
+	while (fgets(line, RATE_LINELEN, f))
+	{
+		char what [16];
+		long long bytes, us;
+
+		lineno++;
+		if (line[0] == '#')
+			continue;
+		if (   sscanf(line, "%15s %lld %lld", what, &bytes, &us) != 3
+		    || bytes < 0 || us < 0
+		    || (strcmp(what, "read") != 0 && strcmp(what, "write") != 0))
+		{
+			printerr("%s:%i: bad line ignored\n", cart_rate_file(), lineno);
+			continue;
+		}
+		if (strcmp(what, "read") == 0)
+		{
+			cart_rate_read.bytes = bytes;
+			cart_rate_read.us = us;
+		}
+		else
+		{
+			cart_rate_write.bytes = bytes;
+			cart_rate_write.us = us;
+		}
+	}
+	fclose(f);
+	return 0;
+}
+
+static void cart_rate_count (cart_rate_s* rate, int bytes, long long us)
+{
+	if (!cart_rate_model[0] || bytes <= 0 || us < 0)
+		return;
+	rate->bytes += bytes;
+	rate->us += us;
+	if (rate->bytes > RATE_WINDOW)
+	{
+		rate->bytes /= 2;
+		rate->us /= 2;
+	}
+	cart_rate_changed = 1;
+}
+
+void cart_rate_count_read (int bytes, long long us)
+{
+	cart_rate_count(&cart_rate_read, bytes, us);
+}
+
+void cart_rate_count_write (int bytes, long long us)
+{
+	cart_rate_count(&cart_rate_write, bytes, us);
+}
+
+int cart_rate_save (void)
+{
+	FILE* f;
+	char tmpname [1024];
+
+	if (!cart_rate_changed)
+		return 0;
+
+	snprintf(tmpname, sizeof(tmpname), "%s.new", cart_rate_file());
+	if ((f = fopen(tmpname, "w")) == NULL)
+	{
+		printerrno("fopen(%s)", tmpname);
+		return -1;
+	}
+	fputs(RATE_HEADER, f);
+	fprintf(f, "read %lld %lld\n", cart_rate_read.bytes, cart_rate_read.us);
+	fprintf(f, "write %lld %lld\n", cart_rate_write.bytes, cart_rate_write.us);
+	if (fclose(f) != 0)
+	{
+		printerrno("write(%s)", tmpname);
+		return -1;
+	}
+
+#if _WIN32
+	remove(cart_rate_file());
+#endif
+	if (rename(tmpname, cart_rate_file()) != 0)
+	{
+		printerrno("rename(%s)", tmpname);
+		return -1;
+	}
+
+	cart_rate_changed = 0;
+	return 0;
+}
+
+long long cart_rate_estimate_ms (long long read, long long written)
+{
+	double us = 0;
+
+	if (read > 0)
+	{
+		if (!cart_rate_read.bytes)
+			return -1;
+		us += (double)read * cart_rate_read.us / cart_rate_read.bytes;
+	}
+	if (written > 0)
+	{
+		if (!cart_rate_write.bytes)
+			return -1;
+		us += (double)written * cart_rate_write.us / cart_rate_write.bytes;
+	}
+	return (long long)(us / 1000);
+}
+
+const char* cart_rate_name (void)
+{
+	return cart_rate_model;
+}
@@ -0,0 +1,32 @@
+/*
+ * Based in f2a by Ulrich Hecht <uli@emulinks.de>
+ * if2a by D. Gauchard <deyv@free.fr>
+ * F2A Ultra support by Vincent Rubiolo <vincent.rubiolo@free.fr>
+ * Licensed under the terms of the GNU Public License version 2
+ */
+
+// Throughput model: measured linker read and burn speeds, kept on host side
+
+#ifndef __CARTRATE_H__
+#define __CARTRATE_H__
+
+#include "libf2a.h"
+
+// load the model of linker with cart_type (measures are not kept before), returns -1 if error
+int		cart_rate_select	(const char* linker, cart_type_e cart_type);
+
+// bytes transferred from or to cart rom in us microseconds
+void		cart_rate_count_read	(int bytes, long long us);
+void		cart_rate_count_write	(int bytes, long long us);
+
+// save the model if it changed, returns -1 if error
+int		cart_rate_save		(void);
+
+// wall time in milliseconds to read and write (erasing included) these
+// bytes, -1 when the model has not measured them yet
+long long	cart_rate_estimate_ms	(long long read, long long written);
+
+// "linker-cart" model name, "" if none selected
+const char*	cart_rate_name		(void);
+
+#endif // __CARTRATE_H__
@@ -18,6 +18,7 @@
 #include "cartrom.h"
 #include "cartmap.h"
 #include "cartutils.h"
+#include "cartthread.h"
 #include "binware.h"
 
 // cart map generation by auto_loadandburn_rom() activation:
@@ -36,6 +37,8 @@ int cart_write_block_size_log2 = -1;	/* autodetect, see cart_get_type() */
 int cart_rom_block_size_log2 = -1;	/* autodetect, see cart_get_type() */
 int cart_thorough_compare = 0;
 int cart_correct_header_allowed = 1;
+cart_sum_e cart_dump_sum = CART_SUM_NONE;
+int cart_dump_trim = 0;
 int cart_burn_without_comparison = 0;
 
 /*
@@ -98,21 +101,129 @@ static const unsigned int CRC32_TAB[256] = {
  */
 int cart_crc32(const unsigned char *str, int *crc32buf, int size) 
 {
-	unsigned int temp = 0xffffffff;
-	int idx ;
-	const unsigned char *ptr = str;
-
 	if (str == NULL)
 		return -1;
 
-	for (idx = 0; idx < size; idx++)
+	*crc32buf = cart_crc32_update(0xffffffff, str, size);
+	
+	return 0;
+}
+
+// crc32 by parts (standard crc32 is ~cart_crc32_update(0xffffffff, ...))
+u_int32_t cart_crc32_update (u_int32_t crc, const unsigned char* data, int size)
+{
+	unsigned int temp = crc;
+
+	while (size--)
+		CRC32_UPDATE(temp, *data++);
+	return temp;
+}
+
+/*
+ * SHA-1 (FIPS 180-1), by parts
+ */
+
+#define SHA1_ROL(x, n)	(((x) << (n)) | ((x) >> (32 - (n))))
+
+static void cart_sha1_block (cart_sha1_s* sha1, const unsigned char* block)
+{
+	u_int32_t w[80];
+	u_int32_t a, b, c, d, e, f, k, t;
+	int i;
+
+	for (i = 0; i < 16; i++)
+		w[i] = (block[4*i] << 24) | (block[4*i+1] << 16) | (block[4*i+2] << 8) | block[4*i+3];
+	for (i = 16; i < 80; i++)
+		w[i] = SHA1_ROL(w[i-3] ^ w[i-8] ^ w[i-14] ^ w[i-16], 1);
+
+	a = sha1->state[0];
+	b = sha1->state[1];
+	c = sha1->state[2];
+	d = sha1->state[3];
+	e = sha1->state[4];
+
+	for (i = 0; i < 80; i++)
 	{
-		CRC32_UPDATE(temp, *ptr++);
+		if (i < 20)
+		{
+			f = (b & c) | (~b & d);
+			k = 0x5a827999;
+		}
+		else if (i < 40)
+		{
+			f = b ^ c ^ d;
+			k = 0x6ed9eba1;
+		}
+		else if (i < 60)
+		{
+			f = (b & c) | (b & d) | (c & d);
+			k = 0x8f1bbcdc;
+		}
+		else
+		{
+			f = b ^ c ^ d;
+			k = 0xca62c1d6;
+		}
+		t = SHA1_ROL(a, 5) + f + e + k + w[i];
+		e = d;
+		d = c;
+		c = SHA1_ROL(b, 30);
+		b = a;
+		a = t;
 	}
 
-	*crc32buf = temp;
-	
-	return 0;
+	sha1->state[0] += a;
+	sha1->state[1] += b;
+	sha1->state[2] += c;
+	sha1->state[3] += d;
+	sha1->state[4] += e;
+}
+
+void cart_sha1_init (cart_sha1_s* sha1)
+{
+	sha1->state[0] = 0x67452301;
+	sha1->state[1] = 0xefcdab89;
+	sha1->state[2] = 0x98badcfe;
+	sha1->state[3] = 0x10325476;
+	sha1->state[4] = 0xc3d2e1f0;
+	sha1->count = 0;
+}
+
+void cart_sha1_update (cart_sha1_s* sha1, const unsigned char* data, int size)
+{
+	int used = sha1->count & 63;
+
+	sha1->count += size;
+	if (used)
+	{
+		int fill = MIN(64 - used, size);
+		memcpy(&sha1->buffer[used], data, fill);
+		data += fill;
+		size -= fill;
+		if (used + fill < 64)
+			return;
+		cart_sha1_block(sha1, sha1->buffer);
+	}
+	for (; size >= 64; data += 64, size -= 64)
+		cart_sha1_block(sha1, data);
+	memcpy(sha1->buffer, data, size);
+}
+
+void cart_sha1_final (cart_sha1_s* sha1, unsigned char digest[20])
+{
+	unsigned char pad[72];
+	u_int64_t bits = sha1->count * 8;
+	int padsize = 64 - ((sha1->count + 8) & 63);
+	int i;
+
+	memset(pad, 0, sizeof(pad));
+	pad[0] = 0x80;
+	for (i = 0; i < 8; i++)
+		pad[padsize + i] = bits >> (56 - 8 * i);
+	cart_sha1_update(sha1, pad, padsize + 8);
+
+	for (i = 0; i < 20; i++)
+		digest[i] = sha1->state[i / 4] >> (24 - 8 * (i % 4));
 }
 
 // burned addresses have to be on CART_WRITE_BLOCK_SIZE multiples boundaries
@@ -169,24 +280,24 @@ void adjust_rom_size (int* size)
 	*size &= ~(CART_ROM_BLOCK_SIZE - 1);
 }
 
-int trim (const unsigned char* rom, int size)
+int trim_size (const unsigned char* rom, int size)
 {
 	unsigned char last;
 	int trimmed_size;
 	
-	if (cart_trim_allowed)
-	{
-		// trim to get interesting size
-		last = rom[size - 1];
-		for (trimmed_size = size - 2; trimmed_size > 0 && rom[trimmed_size] == last; trimmed_size--);
-		trimmed_size += 2;
-	}
-	else
-		trimmed_size = size;
+	// trim to get interesting size
+	last = rom[size - 1];
+	for (trimmed_size = size - 2; trimmed_size > 0 && rom[trimmed_size] == last; trimmed_size--);
+	trimmed_size += 2;
 	
 	return trimmed_size;
 }
 
+int trim (const unsigned char* rom, int size)
+{
+	return cart_trim_allowed? trim_size(rom, size): size;
+}
+
 // struct got from devkitpro project (devkitpro.org),
 // subproject buildscripts, file tools/gba/gbafix.c
 typedef struct
@@ -285,7 +396,7 @@ void correct_header (unsigned char* rom, const char* name, int force_name)
 
 	char romname[13];
 	char romcode[5];
-	const char* shortname;
+	char shortname[13];
 	
 	// replace everything before title (jump instruction + logo)
 	memcpy(rom, &good_header, 0xa0);
@@ -294,7 +405,7 @@ void correct_header (unsigned char* rom, const char* name, int force_name)
 	memset(romcode, 32, 4);
 	romname[12] = romcode[4] = 0;
 
-	shortname = filename2romname(name);
+	filename2romname_r(name, shortname);
 	memcpy(romname, shortname, MIN(strlen(shortname) + 1, 12));
 	memcpy(romcode, shortname, MIN(strlen(shortname), 4));
 	
@@ -330,10 +441,9 @@ void display_map (const unsigned char* rom)
 	//print("\n0x96:		0x%02x\n", rom[0xb2]);
 }
 
-const char* romname (const unsigned char* rom)
+const char* romname_r (const unsigned char* rom, char* name)
 {
 	int len;
-	static char name [13];
 	
 	for (len = 0; len < 12; len++)
 		name[len] = ASCII((char)rom[0xa0 + len]);
@@ -342,11 +452,31 @@ const char* romname (const unsigned char* rom)
 	return name;
 }
 
+const char* romname (const unsigned char* rom)
+{
+	static char name [13];
+	return romname_r(rom, name);
+}
+
+/*
+ * GameIDs are computed by a CRC32 on (first 180 bytes + 189th byte)
+ * of the ROM
+ */
+u_int32_t cart_game_id (const unsigned char* rom)
+{
+	unsigned char buffer[181];
+	int game_id;
+
+	memcpy(buffer, rom, 180);
+	buffer[180] = rom[188];
+	cart_crc32(buffer, &game_id, 181);
+	return game_id;
+}
+
 // Remove directory part and extension, limit to 12 chars
-const char* filename2romname (const char* filename)
+const char* filename2romname_r (const char* filename, char* name)
 {
 	int i, len;
-	static char name [13];
 	
 	len = 0;
 	for (i = strlen(filename) - 1; i >= 0 && filename[i] != '/' && filename[i] != '\\'; i--)
@@ -362,27 +492,214 @@ const char* filename2romname (const char* filename)
 	return name;
 }
 
+const char* filename2romname (const char* filename)
+{
+	static char name [13];
+	return filename2romname_r(filename, name);
+}
+
 int display_scanned_cart_map (void)
 {
-	int i;
-	unsigned char rom[SIZE_1K];
+	int offset, next;
+	int map_loaded;
+	unsigned char rom [SIZE_1K];
 	
 	if (cart_io_sim > 1)
 	return 0;
 
-	for (i = GBA_ROM; i < GBA_ROM + CART_SIZE_BYTES; i += CART_ROM_BLOCK_SIZE)
+	// cart map is searched where it is likely to be (its locator is at
+	// the end of a rom block, so it is not read along with headers)
+	if ((map_loaded = cart_map_locate()) < 0)
+		return -1;
+
+	for (offset = 0; offset < CART_SIZE_BYTES; offset = next)
 	{
-		print("Trying address 0x%x...\r", i);
-		if (cart_read_mem(rom, i, SIZE_1K) == -1)
-			return -1;
+		next = offset + CART_ROM_BLOCK_SIZE;
+		print("Trying address 0x%x...\r", GBA_ROM + offset);
+		if (cart_read_mem(rom, GBA_ROM + offset, SIZE_1K) == -1)
+			break;
 		if (has_good_header_for_reading(rom) > -1)
 		{
 			print("\n");
 			display_map(rom);
 		}
+
+		// map is known: do not probe inside roms
+		if (map_loaded)
+		{
+			int rom_size = cart_map_rom_size_at(offset) & ~(CART_ROM_BLOCK_SIZE - 1);
+			if (rom_size > CART_ROM_BLOCK_SIZE)
+				next = offset + rom_size;
+		}
 	}
 	print("\n");
+	reset_cart_map();
+
+	return offset < CART_SIZE_BYTES? -1: 0;
+}
+
+// dump writer: runs in its own thread, fed by auto_readandsave_rom()
+
+#define DUMP_SLOTS		32		// CART_ROM_BLOCK_SIZE each
+#define DUMP_NAMELEN		(SIZE_1K - (int)sizeof(FILE*))	// DUMP_OPEN fits in any slot
+#define DUMP_SPARSE_MIN		SIZE_64K	// shorter 0x00 runs are written (-T)
+
+enum { DUMP_OPEN, DUMP_DATA };
+
+typedef struct
+{
+	FILE*		f;
+	char		name [DUMP_NAMELEN];
+	u_int32_t	crc;
+	cart_sha1_s	sha1;
+	int		failed;
+	int		size;			// received from cart
+	int		written;		// written to file (including holes)
+	unsigned char	run_byte;		// -T: run of run_byte not yet written
+	int		run_size;		//     (trimmed when file ends)
+} dump_writer_s;
+
+static void dump_writer_sum (dump_writer_s* writer, const unsigned char* data, int size)
+{
+	if (cart_dump_sum == CART_SUM_CRC32)
+		writer->crc = cart_crc32_update(writer->crc, data, size);
+	else if (cart_dump_sum == CART_SUM_SHA1)
+		cart_sha1_update(&writer->sha1, data, size);
+}
+
+static void dump_writer_write (dump_writer_s* writer, const unsigned char* data, int size)
+{
+	if (writer->failed || size == 0)
+		return;
+	if (fwrite(data, size, 1, writer->f) != 1)
+	{
+		if (ferror(writer->f))
+			printerrno("write(%s)", writer->name);
+		else
+			printerr("could not write to file %s\n", writer->name);
+		writer->failed = 1;
+		return;
+	}
+	dump_writer_sum(writer, data, size);
+	writer->written += size;
+}
+
+// write size bytes of run_byte, as a sparse hole if possible
+static void dump_writer_write_run (dump_writer_s* writer, int size)
+{
+	unsigned char run [SIZE_1K];
+
+	memset(run, writer->run_byte, SIZE_1K);
+	if (writer->run_byte == 0 && size >= DUMP_SPARSE_MIN && !writer->failed)
+	{
+		if (fseek(writer->f, size, SEEK_CUR) == 0)
+		{
+			writer->written += size;
+			for (; size > 0; size -= SIZE_1K)
+				dump_writer_sum(writer, run, MIN(size, SIZE_1K));
+			return;
+		}
+		// not seekable: write zeroes
+	}
+	for (; size > 0; size -= SIZE_1K)
+		dump_writer_write(writer, run, MIN(size, SIZE_1K));
+}
+
+// -T: write data but keep the last run of identical bytes for later
+static void dump_writer_trim (dump_writer_s* writer, const unsigned char* data, int size)
+{
+	int i;
+	unsigned char last = data[size - 1];
+
+	for (i = size - 2; i >= 0 && data[i] == last; i--);
+	if (i < 0 && last == writer->run_byte)
+	{
+		// run goes on
+		writer->run_size += size;
+		return;
+	}
+	dump_writer_write_run(writer, writer->run_size);
+	dump_writer_write(writer, data, i + 1);
+	writer->run_byte = last;
+	writer->run_size = size - 1 - i;
+}
+
+static void dump_writer_close (dump_writer_s* writer)
+{
+	FILE* sum;
+	char sumname [DUMP_NAMELEN + 8];
+	const char* base;
+
+	if (!writer->f)
+		return;
+	if (cart_dump_trim && writer->run_size)
+	{
+		// same rule as trim_size(): keep one byte of the last run
+		dump_writer_write_run(writer, 1);
+		if (cart_verbose && writer->written < writer->size)
+			print("(%s: dump trimmed from %ikB to %ikB)\n", writer->name, writer->size >> 10, (writer->written + 1023) >> 10);
+	}
+	if (fclose(writer->f) != 0 && !writer->failed)
+	{
+		printerrno("write(%s)", writer->name);
+		writer->failed = 1;
+	}
+	writer->f = NULL;
+	if (writer->failed || cart_dump_sum == CART_SUM_NONE)
+		return;
+
+	if ((base = strrchr(writer->name, '/')) == NULL)
+		base = writer->name;
+	else
+		base++;
+	snprintf(sumname, sizeof(sumname), "%s.%s", writer->name, cart_dump_sum == CART_SUM_SHA1? "sha1": "sfv");
+	if ((sum = fopen(sumname, "w")) == NULL)
+	{
+		printerrno("fopen(%s)", sumname);
+		return;
+	}
+	if (cart_dump_sum == CART_SUM_SHA1)
+	{
+		// sha1sum format
+		unsigned char digest [20];
+		int i;
+		cart_sha1_final(&writer->sha1, digest);
+		for (i = 0; i < 20; i++)
+			fprintf(sum, "%02x", digest[i]);
+		fprintf(sum, "  %s\n", base);
+	}
+	else
+		// sfv format (standard crc32)
+		fprintf(sum, "%s %08X\n", base, ~writer->crc);
+	if (fclose(sum) != 0)
+		printerrno("write(%s)", sumname);
+}
+
+static int dump_writer (void* arg, int tag, const unsigned char* data, int size)
+{
+	dump_writer_s* writer = (dump_writer_s*)arg;
+
+	if (tag == DUMP_OPEN)
+	{
+		// data is FILE* then name
+		dump_writer_close(writer);
+		memcpy(&writer->f, data, sizeof(FILE*));
+		memcpy(writer->name, data + sizeof(FILE*), DUMP_NAMELEN);
+		writer->crc = 0xffffffff;
+		cart_sha1_init(&writer->sha1);
+		writer->failed = 0;
+		writer->size = writer->written = 0;
+		writer->run_byte = writer->run_size = 0;
+		return 0;
+	}
 
+	if (!writer->f)
+		return 0;
+	writer->size += size;
+	if (cart_dump_trim)
+		dump_writer_trim(writer, data, size);
+	else
+		dump_writer_write(writer, data, size);
 	return 0;
 }
 
@@ -393,17 +710,25 @@ void auto_readandsave_rom (int numfiles, char* files[])
 	int nextblockloaded;
 	const char* name;
 	char autoname[64];
-	unsigned char rom[CART_ROM_BLOCK_SIZE];
+	unsigned char* rom;			// current pipe slot
+	cart_pipe_s* pipe;
+	dump_writer_s writer;
+	int complete = 0;
 	
 	assert(CART_ROM_BLOCK_SIZE >= SIZE_1K);
 	
 	if (cart_io_sim > 1)
 		return;
 
+	// cart is read here while files are written by dump_writer()
+	writer.f = NULL;
+	if ((pipe = cart_pipe_start(DUMP_SLOTS, CART_ROM_BLOCK_SIZE, dump_writer, &writer)) == NULL)
+		return;
+
 	indexfile = 0;
 	i = GBA_ROM;
-	if (cart_read_mem(rom, i, SIZE_1K) < 0)
-		return;
+	if ((rom = cart_pipe_slot(pipe)) == NULL || cart_read_mem(rom, i, SIZE_1K) < 0)
+		goto end;
 	do
 	{
 		nextblockloaded = 0;
@@ -444,22 +769,22 @@ void auto_readandsave_rom (int numfiles, char* files[])
 					printerrno("fopen(%s)", name);
 				else
 				{
-					if (cart_read_mem(rom, i, CART_ROM_BLOCK_SIZE) < 0)
-						return;
+					// hand the file to the writer
+					memcpy(rom, &f, sizeof(FILE*));
+					strncpy((char*)rom + sizeof(FILE*), name, DUMP_NAMELEN - 1);
+					rom[SIZE_1K - 1] = 0;
+					cart_pipe_push(pipe, DUMP_OPEN, SIZE_1K);
+
+					if ((rom = cart_pipe_slot(pipe)) == NULL || cart_read_mem(rom, i, CART_ROM_BLOCK_SIZE) < 0)
+						goto end;
 					do /* read data up to next ROM/valid header */
 					{
-						if (fwrite(rom, CART_ROM_BLOCK_SIZE, 1, f) != 1)
-						{
-							if (ferror(f))
-								printerrno("write(%s)", name);
-							else
-								printerr("could not write to file %s\n", name);
-							break;
-						}
+						cart_pipe_push(pipe, DUMP_DATA, CART_ROM_BLOCK_SIZE);
+						if ((rom = cart_pipe_slot(pipe)) == NULL)
+							goto end;
 						if ((i+=CART_ROM_BLOCK_SIZE) < GBA_ROM + CART_SIZE_BYTES && cart_read_mem(rom, i, CART_ROM_BLOCK_SIZE) < 0)
-							return;
+							goto end;
 					} while (i < GBA_ROM + CART_SIZE_BYTES && has_good_header_for_reading(rom) == -1);
-					fclose(f);
 					nextblockloaded = 1;
 				}
 			}
@@ -468,11 +793,22 @@ void auto_readandsave_rom (int numfiles, char* files[])
 		if (!nextblockloaded) // continue to look for ROM/valid header
 		{
 			if ((i += CART_ROM_BLOCK_SIZE) < GBA_ROM + CART_SIZE_BYTES && cart_read_mem(rom, i, SIZE_1K) < 0)
-				return;
+				goto end;
 		}
 	} while (i < GBA_ROM + CART_SIZE_BYTES);
 	
 	print("\n");
+	complete = 1;
+
+end:
+	cart_pipe_finish(pipe);
+	// (writer thread is done) a partial dump gets no checksum file
+	if (!complete && writer.f)
+	{
+		printerr("\n%s is incomplete.\n", writer.name);
+		writer.failed = 1;
+	}
+	dump_writer_close(&writer);
 }
 
 void display_memory_map (const unsigned char* rom, int size)
@@ -696,6 +1032,113 @@ int cart_file2sram (const char* file, int offset, int size)
 //////////////////////////////////////////////////////////////////////////
 // automatic check cart and burn if necessary
 
+typedef struct
+{
+	const char*	filename;
+	unsigned char*	rom;		// whole file, NULL if error
+	int		size;
+	int		padding;	// rom[padding+1..size-1] is padding
+	int		crc;
+} rom_prep_s;
+
+// returns the index before the last bytes padding (not lower than min_limit - 1)
+static int rom_padding (const unsigned char* rom, int size, int min_limit)
+{
+	int i;
+	unsigned char last = rom[size - 1];
+	for (i = size - 2; i >= min_limit && rom[i] == last; i--);
+	return i;
+}
+
+// worker: load, look for padding, correct header and hash one file
+static void rom_prep_job (void* arg, int index)
+{
+	rom_prep_s* prep = &((rom_prep_s*)arg)[index];
+
+	prep->size = 0;
+	if ((prep->rom = load_from_file(prep->filename, NULL, &prep->size)) == NULL)
+		return;
+	if (prep->size == 0)
+	{
+		printerr("File %s is empty\n", prep->filename);
+		free(prep->rom);
+		prep->rom = NULL;
+		return;
+	}
+
+	prep->padding = rom_padding(prep->rom, prep->size, 0);
+	if (cart_correct_header_allowed)
+		correct_header(prep->rom, prep->filename, 0);
+	if (cart_verbose)
+		cart_crc32(prep->rom, &prep->crc, prep->size);
+}
+
+// files prepared while the linker is connecting (see auto_loadandburn_prefetch())
+static rom_prep_s*	rom_prefetch_preps = NULL;
+static char**		rom_prefetch_files = NULL;
+static int		rom_prefetch_number = 0;
+static cart_jobs_s*	rom_prefetch_jobs = NULL;
+
+static void rom_prep_release (cart_jobs_s* jobs, rom_prep_s* preps, int numfiles)
+{
+	int index;
+	cart_jobs_finish(jobs);
+	for (index = 0; index < numfiles; index++)
+		free(preps[index].rom);
+	if (preps == rom_prefetch_preps)
+	{
+		free(rom_prefetch_preps);
+		rom_prefetch_preps = NULL;
+	}
+}
+
+// files to burn are loaded and prepared by workers while the linker
+// connects and boots, auto_loadandburn_rom() takes them when it is done
+
+void auto_loadandburn_prefetch_release (void)
+{
+	if (rom_prefetch_jobs)
+	{
+		rom_prep_release(rom_prefetch_jobs, rom_prefetch_preps, rom_prefetch_number);
+		rom_prefetch_jobs = NULL;
+	}
+}
+
+int auto_loadandburn_prefetch (int numfiles, char* files[])
+{
+	int index;
+	struct stat st;
+
+	if (numfiles <= 0 || rom_prefetch_jobs)
+		return 0;
+	// missing files are told before the linker is bothered
+	for (index = 0; index < numfiles; index++)
+		if (stat(files[index], &st) == -1)
+		{
+			printerrno("%s", files[index]);
+			return -1;
+		}
+	if ((rom_prefetch_preps = (rom_prep_s*)malloc(numfiles * sizeof(rom_prep_s))) == NULL)
+	{
+		printerrno("malloc(%i) for files preparation", numfiles * (int)sizeof(rom_prep_s));
+		return -1;
+	}
+	for (index = 0; index < numfiles; index++)
+	{
+		rom_prefetch_preps[index].filename = files[index];
+		rom_prefetch_preps[index].rom = NULL;
+	}
+	if ((rom_prefetch_jobs = cart_jobs_start(numfiles, rom_prep_job, rom_prefetch_preps)) == NULL)
+	{
+		free(rom_prefetch_preps);
+		rom_prefetch_preps = NULL;
+		return -1;
+	}
+	rom_prefetch_files = files;
+	rom_prefetch_number = numfiles;
+	return 0;
+}
+
 int auto_loadandburn_rom (cart_type_e cart_type, int cart_use_loader, int clean_cart, int numfiles, char* files[])
 {
 	typedef struct
@@ -717,8 +1160,10 @@ int auto_loadandburn_rom (cart_type_e cart_type, int cart_use_loader, int clean_
 	int			reduce			= 0;
 
 	int			index;
-	FILE*			ROMf;
 	struct stat		st;
+	rom_prep_s		local_preps [numfiles];
+	rom_prep_s*		preps			= local_preps;	// files loaded by workers
+	cart_jobs_s*		jobs;
 	int			loadedsize;
 	int			roundedfilesize;
 	unsigned char*		image;				// image that will contain all cart contents
@@ -735,14 +1180,34 @@ int auto_loadandburn_rom (cart_type_e cart_type, int cart_use_loader, int clean_
 	}
 	memset(image, 0xff, wholesize);
 	
+	// files are loaded and prepared by workers (since connection if they
+	// were prefetched), and delivered in cart order
+	if (rom_prefetch_jobs && rom_prefetch_files == files && rom_prefetch_number == numfiles)
+	{
+		preps = rom_prefetch_preps;
+		jobs = rom_prefetch_jobs;
+		rom_prefetch_jobs = NULL;
+	}
+	else
+	{
+		for (index = 0; index < numfiles; index++)
+		{
+			preps[index].filename = files[index];
+			preps[index].rom = NULL;
+		}
+		if ((jobs = cart_jobs_start(numfiles, rom_prep_job, preps)) == NULL)
+		{
+			free(image);
+			return -1;
+		}
+	}
+
 	// load
 	loadedsize = 0;
 	for (index = (cart_use_loader && (loader.size > 0)? -1: 0); index < numfiles; index++)
 	{
 		print("\n");
 		
-		STAT
-		
 		if (index == -1) // manage loader, fit cart map
 		{
 			int i, real_loader_size;
@@ -802,6 +1267,19 @@ int auto_loadandburn_rom (cart_type_e cart_type, int cart_use_loader, int clean_
 		}
 		else
 		{
+			rom_prep_s* prep = &preps[index];
+			int padding;
+
+			cart_jobs_wait(jobs, index);
+			if (prep->rom == NULL)
+			{
+				rom_prep_release(jobs, preps, numfiles);
+				free(image);
+				return -1;
+			}
+			st.st_size = prep->size;
+			padding = prep->padding;
+
 			print("File %s at address 0x%x is:\n", files[index], GBA_ROM + loadedsize);
 
 			roundedfilesize = st.st_size;
@@ -814,39 +1292,26 @@ int auto_loadandburn_rom (cart_type_e cart_type, int cart_use_loader, int clean_
 					break;
 				roundedfilesize = st.st_size;
 				adjust_rom_size(&roundedfilesize);
+				padding = rom_padding(prep->rom, st.st_size, 0);
 			}
 
-			// load ROM into image file
-			if ((ROMf = fopen(files[index], "rb")) == NULL)
-			{
-				if (ferror(ROMf))
-					printerrno("fopen(%s)", files[index]);
-				else
-					printerr("Could not open file %s for reading\n", files[index]);
-				return -1;
-			}
-			if (fread(&image[loadedsize], st.st_size, 1, ROMf) != 1)
-			{
-				if (ferror(ROMf))
-					printerrno("fread(%s)", files[index]);
-				else
-					printerr("Could not read file %s\n", files[index]);
-				return -1;
-			}
-			fclose(ROMf);
+			// copy ROM into image file
+			memcpy(&image[loadedsize], prep->rom, st.st_size);
+			free(prep->rom);
+			prep->rom = NULL;
+			if (cart_verbose)
+				print("(crc32: %08x)\n", prep->crc);
 			
 			// try to reduce rom size
 			if (cart_trim_allowed || cart_trim_always)
 			{
 				int i, min_limit;
-				// last bytes are probably padding
-				char last = image[loadedsize + st.st_size - 1];
 
 				// cart_trim_always tries to mad-pad everything
 				// !cart_trim_always tries to fit loader only
 				min_limit = cart_trim_always? 0: MAX(0, (st.st_size - whole_loader_size - 1));
 				// truncate as long as there is padding
-				for (i = st.st_size - 2; i >= min_limit && image[loadedsize + i] == last; i--);
+				i = MAX(padding, min_limit - 1);
 				roundedfilesize = i + 2;
 				adjust_rom_size(&roundedfilesize);
 
@@ -866,9 +1331,7 @@ int auto_loadandburn_rom (cart_type_e cart_type, int cart_use_loader, int clean_
 			}
 		}
 
-		// check file against real ROM
-		if (cart_correct_header_allowed && index != -1)
-			correct_header(&image[loadedsize], files[index], 0);
+		// file header has been checked and corrected by worker
 		display_map(&image[loadedsize]);
 		
 #if ENABLE_MAP // code to remove - cartmap is self-sufficient
@@ -934,6 +1397,9 @@ int auto_loadandburn_rom (cart_type_e cart_type, int cart_use_loader, int clean_
 	}
 #endif // ENABLE_MAP
 
+	// files not used because cart is full
+	rom_prep_release(jobs, preps, numfiles);
+
 	// register the last chunk
 	if (burnstart >= 0)
 	{
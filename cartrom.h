@@ -12,10 +12,25 @@
 #define ASCII(x)	_ASCII((unsigned char)(x))
 #define _ASCII(x)	(((x) >= 32 && isascii(x))? (x): '.')
 
+typedef struct
+{
+	u_int32_t	state[5];
+	u_int64_t	count;
+	unsigned char	buffer[64];
+} cart_sha1_s;
+
 int		cart_crc32			(const unsigned char *str, int *crc32buf, int size);
-int		trim				(const unsigned char* rom, int size);
+u_int32_t	cart_crc32_update		(u_int32_t crc, const unsigned char* data, int size);
+void		cart_sha1_init			(cart_sha1_s* sha1);
+void		cart_sha1_update		(cart_sha1_s* sha1, const unsigned char* data, int size);
+void		cart_sha1_final			(cart_sha1_s* sha1, unsigned char digest[20]);
+int		trim_size			(const unsigned char* rom, int size);	// always trims
+int		trim				(const unsigned char* rom, int size);	// trims if cart_trim_allowed
 const char*	romname				(const unsigned char* rom);
+const char*	romname_r			(const unsigned char* rom, char* name);	// name has 13 chars
+u_int32_t	cart_game_id			(const unsigned char* rom);		// f2a ultra GameID
 const char*	filename2romname 		(const char* filename);
+const char*	filename2romname_r 		(const char* filename, char* name);	// name has 13 chars
 void		correct_header			(unsigned char* rom, const char* name, int force_name);
 void		adjust_rom_size			(int* size);
 void		adjust_burn_addresses		(int* offset, int* size);
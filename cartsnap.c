@@ -0,0 +1,535 @@
+/*
+ * Based in f2a by Ulrich Hecht <uli@emulinks.de>
+ * if2a by D. Gauchard <deyv@free.fr>
+ * F2A Ultra support by Vincent Rubiolo <vincent.rubiolo@free.fr>
+ * Licensed under the terms of the GNU Public License version 2
+ */
+
+#include <stdio.h>
+#include <errno.h>
+#include <stdlib.h>
+#include <string.h>
+#include <time.h>
+#include <dirent.h>
+#include <sys/stat.h>
+
+#include "cartsnap.h"
+#include "libf2a.h"
+#include "cartrom.h"
+#include "cartutils.h"
+#include "cartthread.h"
+
+/*///////////////////////////////////////////////////////////////////////////
+
+A snapshot store is a directory holding:
+	objects/xx/yyy...	one file per distinct block, named after the
+				sha1 of its contents (xx: first two digits)
+	snapshots/<date>	one manifest per snapshot, one line per block:
+					region address size sha1
+
+Blocks are cart write blocks for the rom, and 64kB for sram areas. A cart
+which has barely changed since the previous snapshot only adds a few
+objects to the store, and a restore only writes back the blocks which
+differ from what the cart currently holds.
+
+///////////////////////////////////////////////////////////////////////////*/
+
+#define SNAP_HEADER		"# if2a snapshot v1\n"
+#define SNAP_OBJECTS		"objects"
+#define SNAP_SNAPSHOTS		"snapshots"
+#define SNAP_PATHLEN		1024
+#define SNAP_LINELEN		256
+#define SNAP_REGIONS_MAX	4
+#define SNAP_SRAM_BLOCK		SIZE_64K
+#define SNAP_SLOTS		8
+
+typedef struct
+{
+	const char*	name;
+	int		address;
+	int		size;
+	int		block_size;
+} snap_region_s;
+
+// cart areas saved in a snapshot, returns their number
+static int snap_regions (snap_region_s region[SNAP_REGIONS_MAX], cart_type_e cart_type, int sram_size)
+{
+	int number = 0;
+
+	#define REGION(n,a,s,b)	do { region[number].name = (n); region[number].address = (a); region[number].size = (s); region[number].block_size = (b); number++; } while (0)
+	REGION("rom", GBA_ROM, CART_SIZE_BYTES, CART_WRITE_BLOCK_SIZE);
+	REGION("sram", GBA_SRAM, sram_size, MIN(sram_size, SNAP_SRAM_BLOCK));
+	// (SVD is not a plain sram area, see f2au_SVD_from_file())
+	if (cart_type == CART_TYPE_F2A_ULTRA)
+		REGION("cd", F2AU_CD_BASE, SIZE_64K, SNAP_SRAM_BLOCK);
+	#undef REGION
+
+	return number;
+}
+
+static void snap_digest (const unsigned char* data, int size, char hex [41])
+{
+	cart_sha1_s sha1;
+	unsigned char digest [20];
+	int i;
+
+	cart_sha1_init(&sha1);
+	cart_sha1_update(&sha1, data, size);
+	cart_sha1_final(&sha1, digest);
+	for (i = 0; i < 20; i++)
+		sprintf(&hex[2 * i], "%02x", digest[i]);
+}
+
+static int snap_mkdir (const char* path)
+{
+#if _WIN32
+	if (mkdir(path) == -1 && errno != EEXIST)
+#else
+	if (mkdir(path, 0755) == -1 && errno != EEXIST)
+#endif
+	{
+		printerrno("mkdir(%s)", path);
+		return -1;
+	}
+	return 0;
+}
+
+static void snap_object_path (char path [SNAP_PATHLEN], const char* store, const char* hex)
+{
+	snprintf(path, SNAP_PATHLEN, "%s/" SNAP_OBJECTS "/%.2s/%s", store, hex, hex + 2);
+}
+
+///////////////////////////////////////
+// snapshot
+
+typedef struct
+{
+	const char*	store;
+	FILE*		manifest;
+	snap_region_s	region [SNAP_REGIONS_MAX];
+	int		regions;
+	int		blocks;
+	int		new_blocks;
+	int		new_bytes;
+} snap_save_s;
+
+// returns 1 if object is written, 0 if it was already in store, -1 if error
+static int snap_object_write (const char* store, const char* hex, const unsigned char* data, int size)
+{
+	char path [SNAP_PATHLEN];
+	char tmpname [SNAP_PATHLEN + 4];
+	struct stat st;
+	FILE* f;
+
+	snprintf(path, SNAP_PATHLEN, "%s/" SNAP_OBJECTS "/%.2s", store, hex);
+	if (snap_mkdir(path) < 0)
+		return -1;
+	snap_object_path(path, store, hex);
+	if (stat(path, &st) == 0 && st.st_size == size)
+		return 0;
+
+	snprintf(tmpname, sizeof(tmpname), "%s.new", path);
+	if ((f = fopen(tmpname, "wb")) == NULL)
+	{
+		printerrno("fopen(%s)", tmpname);
+		return -1;
+	}
+	if (fwrite(data, size, 1, f) != 1)
+	{
+		printerrno("write(%s)", tmpname);
+		fclose(f);
+		return -1;
+	}
+	if (fclose(f) != 0)
+	{
+		printerrno("write(%s)", tmpname);
+		return -1;
+	}
+#if _WIN32
+	remove(path);
+#endif
+	if (rename(tmpname, path) != 0)
+	{
+		printerrno("rename(%s)", tmpname);
+		return -1;
+	}
+	return 1;
+}
+
+// pipe consumer: stores the block read at address
+static int snap_save_block (void* arg, int address, const unsigned char* data, int size)
+{
+	snap_save_s* save = (snap_save_s*)arg;
+	char hex [41];
+	int r;
+	int written;
+
+	for (r = 0; r < save->regions - 1; r++)
+		if (address >= save->region[r].address && address < save->region[r].address + save->region[r].size)
+			break;
+
+	snap_digest(data, size, hex);
+	if ((written = snap_object_write(save->store, hex, data, size)) < 0)
+		return -1;
+	save->blocks++;
+	save->new_blocks += written;
+	save->new_bytes += written * size;
+	fprintf(save->manifest, "%s 0x%08x %i %s\n", save->region[r].name, address, size, hex);
+	return 0;
+}
+
+int cart_snapshot_save (const char* store, cart_type_e cart_type, int sram_size)
+{
+	snap_save_s save;
+	cart_pipe_s* pipe;
+	char path [SNAP_PATHLEN];
+	char tmpname [SNAP_PATHLEN + 4];
+	char name [32];
+	time_t now;
+	struct stat st;
+	int r, offset, retry;
+	int ret = -1;
+
+	if (cart_io_sim > 1)
+		return 0;
+
+	if (snap_mkdir(store) < 0)
+		return -1;
+	snprintf(path, SNAP_PATHLEN, "%s/" SNAP_OBJECTS, store);
+	if (snap_mkdir(path) < 0)
+		return -1;
+	snprintf(path, SNAP_PATHLEN, "%s/" SNAP_SNAPSHOTS, store);
+	if (snap_mkdir(path) < 0)
+		return -1;
+
+	now = time(NULL);
+	strftime(name, sizeof(name), "%Y%m%d-%H%M%S", localtime(&now));
+	snprintf(path, SNAP_PATHLEN, "%s/" SNAP_SNAPSHOTS "/%s", store, name);
+	for (retry = 2; stat(path, &st) == 0; retry++)
+		snprintf(path, SNAP_PATHLEN, "%s/" SNAP_SNAPSHOTS "/%s-%i", store, name, retry);
+
+	snprintf(tmpname, sizeof(tmpname), "%s.new", path);
+	if ((save.manifest = fopen(tmpname, "w")) == NULL)
+	{
+		printerrno("fopen(%s)", tmpname);
+		return -1;
+	}
+	fputs(SNAP_HEADER, save.manifest);
+	save.store = store;
+	save.regions = snap_regions(save.region, cart_type, sram_size);
+	save.blocks = save.new_blocks = save.new_bytes = 0;
+
+	// cart is read here while blocks are hashed and stored by snap_save_block()
+	if ((pipe = cart_pipe_start(SNAP_SLOTS, CART_WRITE_BLOCK_SIZE, snap_save_block, &save)) == NULL)
+	{
+		fclose(save.manifest);
+		remove(tmpname);
+		return -1;
+	}
+	for (r = 0; r < save.regions; r++)
+	{
+		snap_region_s* region = &save.region[r];
+
+		for (offset = 0; offset < region->size; offset += region->block_size)
+		{
+			int size = MIN(region->block_size, region->size - offset);
+			unsigned char* block;
+
+			print("Reading %s 0x%x...\r", region->name, region->address + offset);
+			printflush();
+			if ((block = cart_pipe_slot(pipe)) == NULL || cart_read_mem(block, region->address + offset, size) < 0)
+				goto end;
+			cart_pipe_push(pipe, region->address + offset, size);
+		}
+	}
+	print("\n");
+	ret = 0;
+
+end:
+	if (cart_pipe_finish(pipe) < 0)
+		ret = -1;
+	if (fclose(save.manifest) != 0 && ret == 0)
+	{
+		printerrno("write(%s)", tmpname);
+		ret = -1;
+	}
+	if (ret < 0)
+	{
+		printerr("Snapshot failed.\n");
+		remove(tmpname);
+		return -1;
+	}
+	if (rename(tmpname, path) != 0)
+	{
+		printerrno("rename(%s)", tmpname);
+		return -1;
+	}
+
+	print("Snapshot %s: %i blocks, %i new (%ikB added to store)\n", path, save.blocks, save.new_blocks, save.new_bytes >> 10);
+	return 0;
+}
+
+///////////////////////////////////////
+// restore
+
+typedef struct
+{
+	int		region;
+	int		address;
+	int		size;
+	char		hex [41];
+	int		differs;	// cart does not hold it
+} snap_block_s;
+
+// latest snapshot of store directory into path, returns -1 if none
+static int snap_latest (char path [SNAP_PATHLEN], const char* store)
+{
+	DIR* dir;
+	struct dirent* dirent;
+	char latest [256] = "";
+
+	snprintf(path, SNAP_PATHLEN, "%s/" SNAP_SNAPSHOTS, store);
+	if ((dir = opendir(path)) == NULL)
+	{
+		printerrno("opendir(%s)", path);
+		return -1;
+	}
+	while ((dirent = readdir(dir)) != NULL)
+	{
+		const char* ext = strrchr(dirent->d_name, '.');
+		if (dirent->d_name[0] == '.' || (ext && strcmp(ext, ".new") == 0))
+			continue;
+		// names are dates, the latest is the greatest
+		if (strcmp(dirent->d_name, latest) > 0)
+			snprintf(latest, sizeof(latest), "%s", dirent->d_name);
+	}
+	closedir(dir);
+
+	if (!latest[0])
+	{
+		printerr("No snapshot in %s\n", path);
+		return -1;
+	}
+	snprintf(path, SNAP_PATHLEN, "%s/" SNAP_SNAPSHOTS "/%s", store, latest);
+	return 0;
+}
+
+// loads and checks manifest file, returns allocated block list, NULL if error
+static snap_block_s* snap_load (const char* manifest, const char* store, snap_region_s* region, int regions, int* number)
+{
+	FILE* f;
+	char line [SNAP_LINELEN];
+	char path [SNAP_PATHLEN];
+	snap_block_s* block = NULL;
+	int max_number = 0;
+	int lineno = 0;
+
+	*number = 0;
+	if ((f = fopen(manifest, "r")) == NULL)
+	{
+		printerrno("fopen(%s)", manifest);
+		return NULL;
+	}
+
+	while (fgets(line, SNAP_LINELEN, f))
+	{
+		char name [16];
+		struct stat st;
+		snap_block_s* b;
+		int r;
+
+		lineno++;
+		if (line[0] == '#')
+			continue;
+
+		if (*number == max_number)
+		{
+			snap_block_s* bigger;
+			max_number = max_number? 2 * max_number: 256;
+			if ((bigger = (snap_block_s*)realloc(block, max_number * sizeof(snap_block_s))) == NULL)
+			{
+				printerrno("realloc");
+				goto error;
+			}
+			block = bigger;
+		}
+		b = &block[*number];
+
+		if (   sscanf(line, "%15s %i %i %40s", name, &b->address, &b->size, b->hex) != 4
+		    || strlen(b->hex) != 40)
+		{
+			printerr("%s:%i: bad snapshot line\n", manifest, lineno);
+			goto error;
+		}
+		// SVD blocks were saved by earlier versions
+		if (strcmp(name, "svd") == 0)
+		{
+			if (cart_verbose)
+				print("%s:%i: SVD block is not restored\n", manifest, lineno);
+			continue;
+		}
+		for (r = 0; r < regions && strcmp(region[r].name, name) != 0; r++);
+		if (   r == regions
+		    || b->size <= 0
+		    || b->address < region[r].address
+		    || b->address + b->size > region[r].address + region[r].size)
+		{
+			printerr("%s:%i: %s block 0x%x does not fit in this cart\n", manifest, lineno, name, b->address);
+			goto error;
+		}
+		b->region = r;
+
+		snap_object_path(path, store, b->hex);
+		if (stat(path, &st) == -1 || st.st_size != b->size)
+		{
+			printerr("%s:%i: object %s is missing from store\n", manifest, lineno, path);
+			goto error;
+		}
+		(*number)++;
+	}
+	fclose(f);
+	return block;
+
+error:
+	fclose(f);
+	free(block);
+	return NULL;
+}
+
+int cart_snapshot_restore (const char* snapshot, cart_type_e cart_type, int sram_size)
+{
+	snap_region_s region [SNAP_REGIONS_MAX];
+	int regions;
+	snap_block_s* block;
+	int number, i;
+	char manifest [SNAP_PATHLEN];
+	char parent [SNAP_PATHLEN];
+	char path [SNAP_PATHLEN];
+	const char* store = snapshot;
+	char* slash;
+	struct stat st;
+	unsigned char* data;
+	int written = 0;
+	int written_bytes = 0;
+	int ret = -1;
+
+	if (stat(snapshot, &st) == -1)
+	{
+		printerrno("stat(%s)", snapshot);
+		return -1;
+	}
+	if (S_ISDIR(st.st_mode))
+	{
+		if (snap_latest(manifest, store) < 0)
+			return -1;
+	}
+	else
+	{
+		// store is the parent of manifest's directory
+		snprintf(manifest, SNAP_PATHLEN, "%s", snapshot);
+		snprintf(parent, SNAP_PATHLEN - 3, "%s", snapshot);
+		if ((slash = strrchr(parent, '/')) != NULL)
+			strcpy(slash, "/..");
+		else
+			strcpy(parent, "..");
+		store = parent;
+	}
+
+	regions = snap_regions(region, cart_type, sram_size);
+	if ((block = snap_load(manifest, store, region, regions, &number)) == NULL)
+		return -1;
+	if (cart_verbose)
+		print("Restoring snapshot %s (%i blocks)\n", manifest, number);
+
+	if ((data = (unsigned char*)malloc(2 * CART_WRITE_BLOCK_SIZE)) == NULL)
+	{
+		printerrno("malloc(%i) for snapshot", 2 * CART_WRITE_BLOCK_SIZE);
+		free(block);
+		return -1;
+	}
+
+	// every object is checked before anything is written
+	for (i = 0; i < number; i++)
+	{
+		snap_block_s* b = &block[i];
+		unsigned char* cart = &data[CART_WRITE_BLOCK_SIZE];
+		char hex [41];
+		int size = b->size;
+
+		if (size > CART_WRITE_BLOCK_SIZE)
+		{
+			printerr("%s: block 0x%x is too large\n", manifest, b->address);
+			goto end;
+		}
+
+		// leave blocks which are already right
+		b->differs = 1;
+		if (!cart_burn_without_comparison && cart_io_sim < 2)
+		{
+			print("Checking %s 0x%x...\r", region[b->region].name, b->address);
+			printflush();
+			if (cart_read_mem(cart, b->address, size) < 0)
+				goto end;
+			snap_digest(cart, size, hex);
+			if (strcmp(hex, b->hex) == 0)
+			{
+				b->differs = 0;
+				continue;
+			}
+		}
+
+		snap_object_path(path, store, b->hex);
+		if (load_from_file(path, data, &size) == NULL)
+			goto end;
+		snap_digest(data, size, hex);
+		if (strcmp(hex, b->hex) != 0)
+		{
+			printerr("\nObject %s is corrupted, nothing is restored\n", path);
+			goto end;
+		}
+	}
+
+	for (i = 0; i < number; i++)
+	{
+		snap_block_s* b = &block[i];
+		char hex [41];
+		int size = b->size;
+
+		if (!b->differs)
+			continue;
+
+		// (store may have changed since it was checked)
+		snap_object_path(path, store, b->hex);
+		if (load_from_file(path, data, &size) == NULL)
+			goto end;
+		snap_digest(data, size, hex);
+		if (strcmp(hex, b->hex) != 0)
+		{
+			printerr("Object %s is corrupted\n", path);
+			goto end;
+		}
+
+		print("\n");
+		if (b->address >= GBA_ROM && b->address < GBA_SRAM)
+		{
+			if (cart_burn(GBA_ROM, b->address - GBA_ROM, data, 0, size) < 0)
+				goto end;
+		}
+		else
+		{
+			if (cart_direct_write(data, GBA_SRAM, b->address - GBA_SRAM, size, SIZE_1K, b->address - GBA_SRAM, size) < 0)
+				goto end;
+			print("\n");
+		}
+		written++;
+		written_bytes += size;
+	}
+	print("\n");
+	print("Snapshot restored: %i of %i blocks written (%ikB)\n", written, number, written_bytes >> 10);
+	ret = 0;
+
+end:
+	free(data);
+	free(block);
+	return ret;
+}
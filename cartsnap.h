@@ -0,0 +1,23 @@
+/*
+ * Based in f2a by Ulrich Hecht <uli@emulinks.de>
+ * if2a by D. Gauchard <deyv@free.fr>
+ * F2A Ultra support by Vincent Rubiolo <vincent.rubiolo@free.fr>
+ * Licensed under the terms of the GNU Public License version 2
+ */
+
+// Whole cart snapshots in a host side content addressed store
+
+#ifndef __CARTSNAP_H__
+#define __CARTSNAP_H__
+
+#include "libf2a.h"
+
+// read the whole cart (rom, sram, and descriptor on ultras) into store directory,
+// blocks already in store are not written again
+int		cart_snapshot_save	(const char* store, cart_type_e cart_type, int sram_size);
+
+// restore a snapshot (a manifest file, or the latest one of a store directory),
+// only blocks differing from cart contents are written (all of them with -f)
+int		cart_snapshot_restore	(const char* snapshot, cart_type_e cart_type, int sram_size);
+
+#endif // __CARTSNAP_H__
@@ -0,0 +1,214 @@
+/*
+ * Based in f2a by Ulrich Hecht <uli@emulinks.de>
+ * if2a by D. Gauchard <deyv@free.fr>
+ * F2A Ultra support by Vincent Rubiolo <vincent.rubiolo@free.fr>
+ * Licensed under the terms of the GNU Public License version 2
+ */
+
+#include <stdlib.h>
+#include <string.h>
+
+#include "cartspace.h"
+#include "libf2a.h"
+
+/*///////////////////////////////////////////////////////////////////////////
+
+Free extents are kept twice, in sorted arrays: by offset (to merge a freed
+range with its neighbours, or find the extent holding an offset) and by
+size then offset (best fit). Lookups are binary searches, updates move the
+end of the arrays.
+
+///////////////////////////////////////////////////////////////////////////*/
+
+struct cart_space_s
+{
+	cart_extent_s*	by_offset;
+	cart_extent_s*	by_size;
+	int		number;
+	int		max_number;
+};
+
+cart_space_s* cart_space_create (void)
+{
+	cart_space_s* space;
+
+	if ((space = (cart_space_s*)calloc(1, sizeof(cart_space_s))) == NULL)
+		printerrno("malloc(%i) for free space", (int)sizeof(cart_space_s));
+	return space;
+}
+
+void cart_space_destroy (cart_space_s* space)
+{
+	if (!space)
+		return;
+	free(space->by_offset);
+	free(space->by_size);
+	free(space);
+}
+
+// first extent whose offset is at least offset
+static int cart_space_lower_offset (const cart_space_s* space, int offset)
+{
+	int low = 0, high = space->number;
+
+	while (low < high)
+	{
+		int middle = (low + high) / 2;
+		if (space->by_offset[middle].offset < offset)
+			low = middle + 1;
+		else
+			high = middle;
+	}
+	return low;
+}
+
+// first extent not smaller than size (then offset)
+static int cart_space_lower_size (const cart_space_s* space, int size, int offset)
+{
+	int low = 0, high = space->number;
+
+	while (low < high)
+	{
+		int middle = (low + high) / 2;
+		const cart_extent_s* extent = &space->by_size[middle];
+		if (extent->size < size || (extent->size == size && extent->offset < offset))
+			low = middle + 1;
+		else
+			high = middle;
+	}
+	return low;
+}
+
+static int cart_space_insert (cart_space_s* space, int offset, int size)
+{
+	int i;
+
+	if (space->number == space->max_number)
+	{
+		int max_number = space->max_number? 2 * space->max_number: 16;
+		cart_extent_s* by_offset;
+		cart_extent_s* by_size;
+
+		by_offset = (cart_extent_s*)realloc(space->by_offset, max_number * sizeof(cart_extent_s));
+		if (by_offset)
+			space->by_offset = by_offset;
+		by_size = (cart_extent_s*)realloc(space->by_size, max_number * sizeof(cart_extent_s));
+		if (by_size)
+			space->by_size = by_size;
+		if (!by_offset || !by_size)
+		{
+			printerrno("realloc(%i) for free space", max_number * (int)sizeof(cart_extent_s));
+			return -1;
+		}
+		space->max_number = max_number;
+	}
+
+	i = cart_space_lower_offset(space, offset);
+	memmove(&space->by_offset[i + 1], &space->by_offset[i], (space->number - i) * sizeof(cart_extent_s));
+	space->by_offset[i].offset = offset;
+	space->by_offset[i].size = size;
+
+	i = cart_space_lower_size(space, size, offset);
+	memmove(&space->by_size[i + 1], &space->by_size[i], (space->number - i) * sizeof(cart_extent_s));
+	space->by_size[i].offset = offset;
+	space->by_size[i].size = size;
+
+	space->number++;
+	return 0;
+}
+
+// removes extent #index (offset order)
+static void cart_space_remove (cart_space_s* space, int index)
+{
+	int i = cart_space_lower_size(space, space->by_offset[index].size, space->by_offset[index].offset);
+
+	space->number--;
+	memmove(&space->by_size[i], &space->by_size[i + 1], (space->number - i) * sizeof(cart_extent_s));
+	memmove(&space->by_offset[index], &space->by_offset[index + 1], (space->number - index) * sizeof(cart_extent_s));
+}
+
+int cart_space_free (cart_space_s* space, int offset, int size)
+{
+	int i;
+
+	if (size <= 0)
+		return 0;
+
+	i = cart_space_lower_offset(space, offset);
+	if (   (i > 0 && space->by_offset[i - 1].offset + space->by_offset[i - 1].size > offset)
+	    || (i < space->number && offset + size > space->by_offset[i].offset))
+	{
+		printerr("0x%x..0x%x is already free\n", offset, offset + size - 1);
+		return -1;
+	}
+
+	// coalesce
+	if (i < space->number && offset + size == space->by_offset[i].offset)
+	{
+		size += space->by_offset[i].size;
+		cart_space_remove(space, i);
+	}
+	if (i > 0 && space->by_offset[i - 1].offset + space->by_offset[i - 1].size == offset)
+	{
+		offset = space->by_offset[i - 1].offset;
+		size += space->by_offset[i - 1].size;
+		cart_space_remove(space, i - 1);
+	}
+	return cart_space_insert(space, offset, size);
+}
+
+int cart_space_use (cart_space_s* space, int offset, int size)
+{
+	cart_extent_s extent;
+	int i;
+
+	if (size <= 0)
+		return 0;
+
+	if (   (i = cart_space_find(space, offset)) < 0
+	    || offset + size > space->by_offset[i].offset + space->by_offset[i].size)
+	{
+		printerr("0x%x..0x%x is not free\n", offset, offset + size - 1);
+		return -1;
+	}
+
+	// what is left on both sides
+	extent = space->by_offset[i];
+	cart_space_remove(space, i);
+	if (   (offset > extent.offset && cart_space_insert(space, extent.offset, offset - extent.offset) < 0)
+	    || (   offset + size < extent.offset + extent.size
+	        && cart_space_insert(space, offset + size, extent.offset + extent.size - offset - size) < 0))
+		return -1;
+	return 0;
+}
+
+int cart_space_best_fit (const cart_space_s* space, int size)
+{
+	int i = cart_space_lower_size(space, size, 0);
+
+	return i < space->number? space->by_size[i].offset: -1;
+}
+
+int cart_space_find (const cart_space_s* space, int offset)
+{
+	int i = cart_space_lower_offset(space, offset + 1) - 1;
+
+	if (i >= 0 && offset < space->by_offset[i].offset + space->by_offset[i].size)
+		return i;
+	return -1;
+}
+
+int cart_space_number (const cart_space_s* space)
+{
+	return space->number;
+}
+
+const cart_extent_s* cart_space_extent (const cart_space_s* space, int index)
+{
+	return &space->by_offset[index];
+}
+
+const cart_extent_s* cart_space_largest (const cart_space_s* space)
+{
+	return space->number? &space->by_size[space->number - 1]: NULL;
+}
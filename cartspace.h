@@ -0,0 +1,44 @@
+/*
+ * Based in f2a by Ulrich Hecht <uli@emulinks.de>
+ * if2a by D. Gauchard <deyv@free.fr>
+ * F2A Ultra support by Vincent Rubiolo <vincent.rubiolo@free.fr>
+ * Licensed under the terms of the GNU Public License version 2
+ */
+
+// Free space of the cart: ordered extents, coalesced when freed
+
+#ifndef __CARTSPACE_H__
+#define __CARTSPACE_H__
+
+typedef struct
+{
+	int		offset;
+	int		size;
+} cart_extent_s;
+
+typedef struct cart_space_s cart_space_s;
+
+// empty space (nothing free), returns NULL if error
+cart_space_s*		cart_space_create	(void);
+void			cart_space_destroy	(cart_space_s* space);
+
+// offset..offset+size-1 becomes free, merged with free neighbours
+// returns -1 if error (part of it is already free)
+int			cart_space_free		(cart_space_s* space, int offset, int size);
+
+// offset..offset+size-1 is used, returns -1 if error (part of it is not free)
+int			cart_space_use		(cart_space_s* space, int offset, int size);
+
+// offset of the smallest extent of at least size bytes (the first one of
+// them), -1 if none
+int			cart_space_best_fit	(const cart_space_s* space, int size);
+
+// index of the extent holding offset, -1 if offset is not free
+int			cart_space_find		(const cart_space_s* space, int offset);
+
+// extents in offset order, and the largest one (NULL when nothing is free)
+int			cart_space_number	(const cart_space_s* space);
+const cart_extent_s*	cart_space_extent	(const cart_space_s* space, int index);
+const cart_extent_s*	cart_space_largest	(const cart_space_s* space);
+
+#endif // __CARTSPACE_H__
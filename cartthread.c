@@ -0,0 +1,381 @@
+/*
+ * Based in f2a by Ulrich Hecht <uli@emulinks.de>
+ * if2a by D. Gauchard <deyv@free.fr>
+ * F2A Ultra support by Vincent Rubiolo <vincent.rubiolo@free.fr>
+ * Licensed under the terms of the GNU Public License version 2
+ */
+
+#include <stdlib.h>
+#include <string.h>
+#include <assert.h>
+#if !NOTHREADS
+#include <unistd.h>
+#include <pthread.h>
+#endif
+
+#include "cartthread.h"
+#include "libf2a.h"
+
+#define THREADS_MAX		64
+
+int cart_threads = 0;
+
+struct cart_jobs_s
+{
+	int		number;
+	int		next;			// next index to be taken
+	char*		done;			// done[index] = 1 when job #index is finished
+	cart_job_f	job;
+	void*		arg;
+#if !NOTHREADS
+	int		workers;
+	pthread_t	thread [THREADS_MAX];
+	pthread_mutex_t	lock;
+	pthread_cond_t	finished;
+#endif
+};
+
+int cart_thread_count (void)
+{
+	int count = cart_threads;
+
+#if NOTHREADS
+	count = 1;
+#else
+	if (count <= 0)
+		count = sysconf(_SC_NPROCESSORS_ONLN);
+#endif
+	if (count <= 0)
+		count = 1;
+	return MIN(count, THREADS_MAX);
+}
+
+#if !NOTHREADS
+static void* cart_jobs_worker (void* arg)
+{
+	cart_jobs_s* jobs = (cart_jobs_s*)arg;
+	int index;
+
+	pthread_mutex_lock(&jobs->lock);
+	while ((index = jobs->next) < jobs->number)
+	{
+		jobs->next++;
+		pthread_mutex_unlock(&jobs->lock);
+
+		jobs->job(jobs->arg, index);
+
+		pthread_mutex_lock(&jobs->lock);
+		jobs->done[index] = 1;
+		pthread_cond_broadcast(&jobs->finished);
+	}
+	pthread_mutex_unlock(&jobs->lock);
+	return NULL;
+}
+#endif
+
+cart_jobs_s* cart_jobs_start (int number, cart_job_f job, void* arg)
+{
+	cart_jobs_s* jobs;
+
+	if ((jobs = (cart_jobs_s*)malloc(sizeof(cart_jobs_s))) == NULL)
+	{
+		printerrno("malloc(%i) for jobs", (int)sizeof(cart_jobs_s));
+		return NULL;
+	}
+	if ((jobs->done = (char*)malloc(number + 1)) == NULL)
+	{
+		printerrno("malloc(%i) for jobs", number + 1);
+		free(jobs);
+		return NULL;
+	}
+	memset(jobs->done, 0, number + 1);
+	jobs->number = number;
+	jobs->next = 0;
+	jobs->job = job;
+	jobs->arg = arg;
+
+#if !NOTHREADS
+	pthread_mutex_init(&jobs->lock, NULL);
+	pthread_cond_init(&jobs->finished, NULL);
+	for (jobs->workers = 0; jobs->workers < MIN(cart_thread_count(), number); jobs->workers++)
+		if (pthread_create(&jobs->thread[jobs->workers], NULL, cart_jobs_worker, jobs) != 0)
+		{
+			// remaining jobs will be run by the ones we already have,
+			// or by cart_jobs_wait() if we have none
+			if (cart_verbose)
+				printerrno("pthread_create");
+			break;
+		}
+#endif
+
+	return jobs;
+}
+
+void cart_jobs_wait (cart_jobs_s* jobs, int index)
+{
+	assert(index >= 0 && index < jobs->number);
+
+#if !NOTHREADS
+	if (jobs->workers)
+	{
+		pthread_mutex_lock(&jobs->lock);
+		while (!jobs->done[index])
+			pthread_cond_wait(&jobs->finished, &jobs->lock);
+		pthread_mutex_unlock(&jobs->lock);
+		return;
+	}
+#endif
+
+	// no worker: jobs are run in order by the caller
+	while (jobs->next <= index)
+	{
+		jobs->job(jobs->arg, jobs->next);
+		jobs->done[jobs->next++] = 1;
+	}
+}
+
+void cart_jobs_finish (cart_jobs_s* jobs)
+{
+	if (jobs->number > 0)
+		cart_jobs_wait(jobs, jobs->number - 1);
+
+#if !NOTHREADS
+	{
+		int i;
+		for (i = 0; i < jobs->workers; i++)
+			pthread_join(jobs->thread[i], NULL);
+		pthread_cond_destroy(&jobs->finished);
+		pthread_mutex_destroy(&jobs->lock);
+	}
+#endif
+
+	free(jobs->done);
+	free(jobs);
+}
+
+int cart_jobs_run (int number, cart_job_f job, void* arg)
+{
+	cart_jobs_s* jobs;
+
+	if ((jobs = cart_jobs_start(number, job, arg)) == NULL)
+		return -1;
+	cart_jobs_finish(jobs);
+	return 0;
+}
+
+struct cart_lock_s
+{
+#if !NOTHREADS
+	pthread_mutex_t	mutex;
+#else
+	int		unused;
+#endif
+};
+
+cart_lock_s* cart_lock_create (void)
+{
+	cart_lock_s* lock;
+
+	if ((lock = (cart_lock_s*)malloc(sizeof(cart_lock_s))) == NULL)
+	{
+		printerrno("malloc(%i) for lock", (int)sizeof(cart_lock_s));
+		return NULL;
+	}
+#if !NOTHREADS
+	pthread_mutex_init(&lock->mutex, NULL);
+#endif
+	return lock;
+}
+
+void cart_lock (cart_lock_s* lock)
+{
+#if !NOTHREADS
+	pthread_mutex_lock(&lock->mutex);
+#else
+	(void)lock;
+#endif
+}
+
+void cart_unlock (cart_lock_s* lock)
+{
+#if !NOTHREADS
+	pthread_mutex_unlock(&lock->mutex);
+#else
+	(void)lock;
+#endif
+}
+
+void cart_lock_destroy (cart_lock_s* lock)
+{
+#if !NOTHREADS
+	pthread_mutex_destroy(&lock->mutex);
+#endif
+	free(lock);
+}
+
+struct cart_pipe_s
+{
+	int		slots;
+	int		slot_size;
+	unsigned char*	buffer;			// slots * slot_size bytes
+	int*		tag;
+	int*		size;
+	int		pushed;			// number of slots pushed by producer
+	int		consumed;		// number of slots consumed
+	int		ended;
+	int		status;			// -1 when consumer has stopped
+	cart_pipe_f	consumer;
+	void*		arg;
+#if !NOTHREADS
+	int		threaded;
+	pthread_t	thread;
+	pthread_mutex_t	lock;
+	pthread_cond_t	changed;
+#endif
+};
+
+static void cart_pipe_consume (cart_pipe_s* pipe, int index)
+{
+	if (   pipe->status >= 0
+	    && pipe->consumer(pipe->arg, pipe->tag[index], &pipe->buffer[index * pipe->slot_size], pipe->size[index]) < 0)
+		pipe->status = -1;
+}
+
+#if !NOTHREADS
+static void* cart_pipe_consumer (void* arg)
+{
+	cart_pipe_s* pipe = (cart_pipe_s*)arg;
+
+	pthread_mutex_lock(&pipe->lock);
+	for (;;)
+	{
+		int index;
+
+		while (pipe->consumed == pipe->pushed && !pipe->ended)
+			pthread_cond_wait(&pipe->changed, &pipe->lock);
+		if (pipe->consumed == pipe->pushed)
+			break;
+		index = pipe->consumed % pipe->slots;
+		pthread_mutex_unlock(&pipe->lock);
+
+		cart_pipe_consume(pipe, index);
+
+		pthread_mutex_lock(&pipe->lock);
+		pipe->consumed++;
+		pthread_cond_broadcast(&pipe->changed);
+	}
+	pthread_mutex_unlock(&pipe->lock);
+	return NULL;
+}
+#endif
+
+cart_pipe_s* cart_pipe_start (int slots, int slot_size, cart_pipe_f consumer, void* arg)
+{
+	cart_pipe_s* pipe;
+
+	if ((pipe = (cart_pipe_s*)malloc(sizeof(cart_pipe_s))) == NULL)
+	{
+		printerrno("malloc(%i) for pipe", (int)sizeof(cart_pipe_s));
+		return NULL;
+	}
+	pipe->buffer = (unsigned char*)malloc(slots * slot_size);
+	pipe->tag = (int*)malloc(slots * sizeof(int));
+	pipe->size = (int*)malloc(slots * sizeof(int));
+	if (!pipe->buffer || !pipe->tag || !pipe->size)
+	{
+		printerrno("malloc(%i) for pipe", slots * slot_size);
+		free(pipe->buffer);
+		free(pipe->tag);
+		free(pipe->size);
+		free(pipe);
+		return NULL;
+	}
+	pipe->slots = slots;
+	pipe->slot_size = slot_size;
+	pipe->pushed = pipe->consumed = 0;
+	pipe->ended = 0;
+	pipe->status = 0;
+	pipe->consumer = consumer;
+	pipe->arg = arg;
+
+#if !NOTHREADS
+	pthread_mutex_init(&pipe->lock, NULL);
+	pthread_cond_init(&pipe->changed, NULL);
+	// the consumer runs in caller's thread if a thread cannot be created
+	pipe->threaded = 1;
+	if (pthread_create(&pipe->thread, NULL, cart_pipe_consumer, pipe) != 0)
+	{
+		if (cart_verbose)
+			printerrno("pthread_create");
+		pipe->threaded = 0;
+	}
+#endif
+
+	return pipe;
+}
+
+unsigned char* cart_pipe_slot (cart_pipe_s* pipe)
+{
+#if !NOTHREADS
+	if (pipe->threaded)
+	{
+		pthread_mutex_lock(&pipe->lock);
+		while (pipe->pushed - pipe->consumed == pipe->slots)
+			pthread_cond_wait(&pipe->changed, &pipe->lock);
+		pthread_mutex_unlock(&pipe->lock);
+	}
+#endif
+	if (pipe->status < 0)
+		return NULL;
+	return &pipe->buffer[(pipe->pushed % pipe->slots) * pipe->slot_size];
+}
+
+void cart_pipe_push (cart_pipe_s* pipe, int tag, int size)
+{
+	int index = pipe->pushed % pipe->slots;
+
+	assert(size <= pipe->slot_size);
+	pipe->tag[index] = tag;
+	pipe->size[index] = size;
+
+#if !NOTHREADS
+	if (pipe->threaded)
+	{
+		pthread_mutex_lock(&pipe->lock);
+		pipe->pushed++;
+		pthread_cond_broadcast(&pipe->changed);
+		pthread_mutex_unlock(&pipe->lock);
+		return;
+	}
+#endif
+
+	// no thread: consume now
+	pipe->pushed++;
+	cart_pipe_consume(pipe, index);
+	pipe->consumed++;
+}
+
+int cart_pipe_finish (cart_pipe_s* pipe)
+{
+	int status;
+
+#if !NOTHREADS
+	if (pipe->threaded)
+	{
+		pthread_mutex_lock(&pipe->lock);
+		pipe->ended = 1;
+		pthread_cond_broadcast(&pipe->changed);
+		pthread_mutex_unlock(&pipe->lock);
+		pthread_join(pipe->thread, NULL);
+	}
+	pthread_cond_destroy(&pipe->changed);
+	pthread_mutex_destroy(&pipe->lock);
+#endif
+
+	status = pipe->status;
+	free(pipe->buffer);
+	free(pipe->tag);
+	free(pipe->size);
+	free(pipe);
+	return status;
+}
@@ -0,0 +1,60 @@
+/*
+ * Based in f2a by Ulrich Hecht <uli@emulinks.de>
+ * if2a by D. Gauchard <deyv@free.fr>
+ * F2A Ultra support by Vincent Rubiolo <vincent.rubiolo@free.fr>
+ * Licensed under the terms of the GNU Public License version 2
+ */
+
+// Host side worker threads (no threads at all when NOTHREADS is set)
+
+#ifndef __CARTTHREAD_H__
+#define __CARTTHREAD_H__
+
+// a job is called once for each index in 0..number-1, from any worker
+typedef void (*cart_job_f) (void* arg, int index);
+
+typedef struct cart_jobs_s cart_jobs_s;
+
+// number of workers to use (cart_threads, or number of online cpus when 0)
+int		cart_thread_count	(void);
+
+// start number jobs on the workers, indexes are taken in increasing order
+// returns NULL if error
+cart_jobs_s*	cart_jobs_start		(int number, cart_job_f job, void* arg);
+
+// wait until job #index is done (runs it in caller's thread without threads)
+void		cart_jobs_wait		(cart_jobs_s* jobs, int index);
+
+// wait for every job, then release workers and jobs
+void		cart_jobs_finish	(cart_jobs_s* jobs);
+
+// start, then finish: runs all jobs in parallel and return when all are done
+int		cart_jobs_run		(int number, cart_job_f job, void* arg);
+
+// a lock protects data shared by jobs (does nothing without threads)
+typedef struct cart_lock_s cart_lock_s;
+
+cart_lock_s*	cart_lock_create	(void);		// returns NULL if error
+void		cart_lock		(cart_lock_s* lock);
+void		cart_unlock		(cart_lock_s* lock);
+void		cart_lock_destroy	(cart_lock_s* lock);
+
+// a pipe hands buffers from the caller (producer) to a consumer thread, in order
+// the consumer returns -1 to stop consuming (the producer gets NULL slots then)
+typedef int (*cart_pipe_f) (void* arg, int tag, const unsigned char* data, int size);
+
+typedef struct cart_pipe_s cart_pipe_s;
+
+// start consumer thread with slots buffers of slot_size bytes, returns NULL if error
+cart_pipe_s*	cart_pipe_start		(int slots, int slot_size, cart_pipe_f consumer, void* arg);
+
+// current slot to fill (waits for a free one), NULL if consumer has stopped
+unsigned char*	cart_pipe_slot		(cart_pipe_s* pipe);
+
+// hand current slot to consumer
+void		cart_pipe_push		(cart_pipe_s* pipe, int tag, int size);
+
+// wait until every pushed slot is consumed, release pipe, returns -1 if consumer has stopped
+int		cart_pipe_finish	(cart_pipe_s* pipe);
+
+#endif // __CARTTHREAD_H__
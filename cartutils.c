@@ -14,6 +14,7 @@
 #include <assert.h>
 #include <stdarg.h>
 #include <sys/stat.h>
+#include <sys/time.h>
 
 #include "libf2a.h"
 
@@ -84,6 +85,66 @@ unsigned char* load_from_file(const char* filename, unsigned char* user_buffer,
 	return buffer;
 }
 
+#define PATHLEN	1024
+
+const char* cart_home_file (const char* name)
+{
+	// returns the path of if2a's host side file 'name', in $IF2A_HOME
+	// or in $HOME/.if2a (which is created if needed)
+	// returned path is a static buffer
+
+	static char path [PATHLEN];
+	const char* home;
+
+	if ((home = getenv("IF2A_HOME")) != NULL)
+		snprintf(path, PATHLEN, "%s", home);
+	else
+	{
+		if ((home = getenv("HOME")) == NULL && (home = getenv("USERPROFILE")) == NULL)
+			home = ".";
+		snprintf(path, PATHLEN, "%s/.if2a", home);
+	}
+
+#if _WIN32
+	mkdir(path);
+#else
+	mkdir(path, 0755);
+#endif
+
+	if (name)
+	{
+		strncat(path, "/", PATHLEN - strlen(path) - 1);
+		strncat(path, name, PATHLEN - strlen(path) - 1);
+	}
+	return path;
+}
+
+char* cart_absolute_path (const char* filename)
+{
+	// returns an allocated absolute path, NULL if file does not exist
+#if _WIN32
+	return _fullpath(NULL, filename, 0);
+#else
+	return realpath(filename, NULL);
+#endif
+}
+
+long long cart_time_ms (void)
+{
+	// host wall clock in milliseconds, for timings and budgets
+	struct timeval tv;
+	gettimeofday(&tv, NULL);
+	return (long long)tv.tv_sec * 1000 + tv.tv_usec / 1000;
+}
+
+long long cart_time_us (void)
+{
+	// host wall clock in microseconds, for short timings
+	struct timeval tv;
+	gettimeofday(&tv, NULL);
+	return (long long)tv.tv_sec * 1000000 + tv.tv_usec;
+}
+
 int buffer_from_file(const char* filename, unsigned char* buffer, int size_to_check)
 {
 	// fills in buffer with contents of file named 'filename'
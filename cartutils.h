@@ -13,6 +13,10 @@
 
 int		binware_load		(binware_s* dst, const binware_s binware[], const char* file, const char* name);
 unsigned char*	load_from_file		(const char* filename, unsigned char* user_buffer, int* size);
+const char*	cart_home_file		(const char* name);	// path of host side file in $IF2A_HOME or ~/.if2a
+char*		cart_absolute_path	(const char* filename);	// allocated, NULL if file does not exist
+long long	cart_time_ms		(void);			// host wall clock in milliseconds
+long long	cart_time_us		(void);			// host wall clock in microseconds
 void		check_endianness	(void);
 u_int16_t	ntoh16			(u_int16_t x);
 u_int16_t	hton16			(u_int16_t x);
@@ -0,0 +1,292 @@
+/*
+ * Based in f2a by Ulrich Hecht <uli@emulinks.de>
+ * if2a by D. Gauchard <deyv@free.fr>
+ * F2A Ultra support by Vincent Rubiolo <vincent.rubiolo@free.fr>
+ * Licensed under the terms of the GNU Public License version 2
+ */
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <signal.h>
+#include <time.h>
+#include <sys/stat.h>
+#if __linux__
+#include <unistd.h>
+#include <poll.h>
+#include <sys/inotify.h>
+#endif
+
+#include "cartwatch.h"
+#include "libf2a.h"
+#include "cartmap.h"
+#include "cartutils.h"
+#include "cartrom.h"
+#include "cartcatalog.h"
+
+/*///////////////////////////////////////////////////////////////////////////
+
+Watch mode keeps the linker connected and the cart map loaded while rom
+files are rebuilt. Each time one of them is saved:
+- if it fits in EWRAM, it is multibooted,
+- otherwise it is updated in place in cart (see cart_map_update()), or
+  added again if it has grown too much.
+The GBA is asked to be booted again in linker mode when needed (after a
+multiboot, or after the rom has been tried from cart).
+
+Files are watched with inotify on linux (their directories are, so that
+files replaced by a rename are seen), and checked every WATCH_POLL_MS
+elsewhere. Their modification time has a one second resolution: a file
+saved during the second of its previous check is compared by contents.
+
+///////////////////////////////////////////////////////////////////////////*/
+
+#define WATCH_POLL_MS		200	// checks for changes or interruption
+#define WATCH_SETTLE_MS		100	// a file is used when it has not changed for this long
+#define WATCH_PATHLEN		1024
+
+typedef struct
+{
+	const char*	spec;			// as given: "file" or "file,romname"
+	char		filename [WATCH_PATHLEN];
+	const char*	base;			// file name in its directory
+	long long	mtime;
+	long long	size;
+	int		recent;			// mtime was not over when checked
+	u_int32_t	crc;			// of contents when recent
+	int		wd;			// inotify watch of its directory
+	int		pending;		// inotify has seen it saved
+} cart_watch_s;
+
+static volatile int cart_watch_stopped = 0;
+
+static void cart_watch_stop (int sig)
+{
+	(void)sig;
+	cart_watch_stopped = 1;
+}
+
+// crc32 of file contents, 0 if it cannot be read
+static u_int32_t cart_watch_crc (const char* filename)
+{
+	unsigned char buffer [SIZE_64K];
+	u_int32_t crc = 0xffffffff;
+	FILE* f;
+	int size;
+
+	if ((f = fopen(filename, "rb")) == NULL)
+		return 0;
+	while ((size = fread(buffer, 1, sizeof(buffer), f)) > 0)
+		crc = cart_crc32_update(crc, buffer, size);
+	fclose(f);
+	return ~crc;
+}
+
+// returns 1 if file has changed since last call (size is -1 if it cannot be read)
+static int cart_watch_stat (cart_watch_s* watch)
+{
+	struct stat st;
+	long long now = time(NULL);
+	long long mtime = -1, size = -1;
+	u_int32_t crc = 0;
+	int changed;
+
+	if (stat(watch->filename, &st) == 0)
+	{
+		mtime = st.st_mtime;
+		size = st.st_size;
+	}
+	changed = mtime != watch->mtime || size != watch->size;
+
+	// saved again within the same second, maybe with the same size
+	if (size > 0 && (watch->recent || mtime >= now - 1))
+	{
+		crc = cart_watch_crc(watch->filename);
+		if (watch->recent && crc != watch->crc)
+			changed = 1;
+	}
+	watch->recent = size > 0 && mtime >= now - 1;
+	watch->crc = crc;
+	watch->mtime = mtime;
+	watch->size = size;
+	return changed;
+}
+
+// waits for a saved file, returns its index, -1 if stopped
+static int cart_watch_wait (cart_watch_s* watch, int number, int fd)
+{
+	int i;
+
+	while (!cart_watch_stopped)
+	{
+#if __linux__
+		if (fd >= 0)
+		{
+			char events [4096] __attribute__ ((aligned(__alignof__(struct inotify_event))));
+			struct pollfd pfd = { .fd = fd, .events = POLLIN };
+			int size, offset;
+
+			for (i = 0; i < number; i++)
+				if (watch[i].pending)
+				{
+					watch[i].pending = 0;
+					return i;
+				}
+			if (poll(&pfd, 1, WATCH_POLL_MS) <= 0 || (size = read(fd, events, sizeof(events))) <= 0)
+				continue;
+			for (offset = 0; offset < size; offset += sizeof(struct inotify_event) + ((struct inotify_event*)&events[offset])->len)
+			{
+				struct inotify_event* event = (struct inotify_event*)&events[offset];
+				if (event->len)
+					for (i = 0; i < number; i++)
+						if (event->wd == watch[i].wd && strcmp(event->name, watch[i].base) == 0)
+							watch[i].pending = 1;
+			}
+			continue;
+		}
+#else
+		(void)fd;
+#endif
+		msleep(WATCH_POLL_MS);
+		for (i = 0; i < number; i++)
+			if (cart_watch_stat(&watch[i]))
+				return i;
+	}
+	return -1;
+}
+
+// burn or multiboot a saved file, returns -1 if error
+static int cart_watch_apply (cart_watch_s* watch, int* map_loaded)
+{
+	char spec [WATCH_PATHLEN];
+	const char* files [1] = { spec };
+	int left;
+
+	if (watch->size <= GBA_EWRAM_SIZE)
+		return cart_user_multiboot(watch->filename);
+	if (!*map_loaded)
+	{
+		printerr("'%s' is too large for multiboot and there is no cart map to burn it.\n", watch->filename);
+		return -1;
+	}
+
+	// spec is cut at comma when files are prepared
+	snprintf(spec, sizeof(spec), "%s", watch->spec);
+	if ((left = cart_map_update(files, 1)) <= 0)
+		return left;
+
+	// does not fit in place anymore: added again (map is released after burning)
+	if (   cart_map_build_hole() < 0
+	    || cart_map_find_best_insertion_for_files(files, 1) < 0
+	    || cart_map_process_changes() < 0)
+		return -1;
+	if (load_cart_map() < 0)
+	{
+		*map_loaded = 0;
+		return -1;
+	}
+	return 0;
+}
+
+int cart_watch (int numfiles, char* files[])
+{
+	cart_watch_s watch [numfiles];
+	int map_loaded;
+	int fd = -1;
+	int i, ret = 0;
+
+	// files are rebuilt within the same second with the same size:
+	// the catalog cannot tell they changed
+	if (cart_catalog_select("none") < 0)
+		return -1;
+
+#if __linux__
+	if ((fd = inotify_init()) < 0)
+		printerrno("inotify_init (files will be polled)");
+#endif
+	for (i = 0; i < numfiles; i++)
+	{
+		char* slash;
+		char* comma;
+
+		watch[i].spec = files[i];
+		snprintf(watch[i].filename, WATCH_PATHLEN, "%s", files[i]);
+		if ((comma = strchr(watch[i].filename, ',')))
+			*comma = 0;
+		slash = strrchr(watch[i].filename, '/');
+		watch[i].base = slash? slash + 1: watch[i].filename;
+		watch[i].wd = -1;
+		watch[i].pending = 0;
+		watch[i].recent = 0;
+		cart_watch_stat(&watch[i]);
+#if __linux__
+		if (fd >= 0)
+		{
+			char dir [WATCH_PATHLEN];
+
+			snprintf(dir, WATCH_PATHLEN, "%.*s", slash? (int)(slash - watch[i].filename) + 1: 1, slash? watch[i].filename: ".");
+			if ((watch[i].wd = inotify_add_watch(fd, dir, IN_CLOSE_WRITE | IN_MOVED_TO)) < 0)
+			{
+				printerrno("inotify_add_watch(%s)", dir);
+				close(fd);
+				return -1;
+			}
+		}
+#endif
+	}
+
+	if (!(map_loaded = load_cart_map() >= 0))
+		print("No cart map: only files fitting in EWRAM (%ikB) can be multibooted.\n", GBA_EWRAM_SIZE >> 10);
+
+	signal(SIGINT, cart_watch_stop);
+	print("Watching %i file(s), interrupt (Ctrl-C) to stop.\n", numfiles);
+
+	while ((i = cart_watch_wait(watch, numfiles, fd)) >= 0)
+	{
+		long long saved = cart_time_ms();
+		long long linker = 0;
+
+		// wait for the end of writes
+		do
+			msleep(WATCH_SETTLE_MS);
+		while (cart_watch_stat(&watch[i]));
+		if (watch[i].size <= 0)
+			// removed, or being rebuilt
+			continue;
+
+		print("\n'%s' has changed\n", watch[i].filename);
+
+		// the GBA is running the previous rom
+		linker = cart_time_ms();
+		if (cart_check_or_init_linker() < 0)
+		{
+			ret = -1;
+			break;
+		}
+		linker = cart_time_ms() - linker;
+
+		if (cart_watch_apply(&watch[i], &map_loaded) < 0)
+		{
+			printerr("'%s' has not been sent, waiting for next change.\n", watch[i].filename);
+			if (map_loaded)
+			{
+				reset_cart_map();
+				map_loaded = load_cart_map() >= 0;
+			}
+			continue;
+		}
+		print("'%s' is ready %.2fs after being saved", watch[i].filename, (cart_time_ms() - saved) / 1000.0);
+		if (linker >= 1000)
+			print(" (%.2fs waiting for GBA)", linker / 1000.0);
+		print("\n");
+	}
+
+	signal(SIGINT, SIG_DFL);
+	print("Stopped watching.\n");
+	reset_cart_map();
+#if __linux__
+	if (fd >= 0)
+		close(fd);
+#endif
+	return ret;
+}
@@ -0,0 +1,18 @@
+/*
+ * Based in f2a by Ulrich Hecht <uli@emulinks.de>
+ * if2a by D. Gauchard <deyv@free.fr>
+ * F2A Ultra support by Vincent Rubiolo <vincent.rubiolo@free.fr>
+ * Licensed under the terms of the GNU Public License version 2
+ */
+
+// Watch mode: multiboot or update roms in cart each time they are saved
+
+#ifndef __CARTWATCH_H__
+#define __CARTWATCH_H__
+
+#include "libf2a.h"
+
+// watches files ("file" or "file,romname") until interrupted, returns -1 if error
+int		cart_watch		(int numfiles, char* files[]);
+
+#endif // __CARTWATCH_H__
@@ -0,0 +1,251 @@
+/*
+ * Based in f2a by Ulrich Hecht <uli@emulinks.de>
+ * if2a by D. Gauchard <deyv@free.fr>
+ * F2A Ultra support by Vincent Rubiolo <vincent.rubiolo@free.fr>
+ * Licensed under the terms of the GNU Public License version 2
+ */
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+
+#include "cartwear.h"
+#include "cartutils.h"
+
+/*///////////////////////////////////////////////////////////////////////////
+
+Flash wears out with erase/program cycles, which are done one write block
+(CART_WRITE_BLOCK_SIZE) at a time. Every write block programmed by if2a
+(cart_burn(), cart_direct_write()) is counted here. Counts are kept on host
+side, in if2a's home directory, one table per cart: carts are told apart by
+the identity burned in their map locator (cart_map_identity), so programs
+of a cart without IF2A-0003 map are not counted. They only know about
+burns made from this host.
+
+The placement of new roms can avoid the most programmed blocks
+(cart_plan_wear_weight, see cartmap.c) using cart_wear_cost().
+
+///////////////////////////////////////////////////////////////////////////*/
+
+#define WEAR_HEADER		"# if2a write blocks program counts v1\n"
+#define WEAR_LINELEN		64
+#define WEAR_ROWS		32	// report lines
+#define WEAR_BAR		40	// report bars width
+
+static unsigned int*	cart_wear = NULL;		// program count of each write block
+static long long*	cart_wear_sum = NULL;		// cart_wear_sum[i]: wear of blocks 0..i-1
+static int		cart_wear_sum_dirty = 0;	// counts changed since sums
+static int		cart_wear_blocks = 0;
+static int		cart_wear_changed = 0;
+static u_int32_t	cart_wear_identity = 0;		// cart counts are loaded for
+
+static const char* cart_wear_file (void)
+{
+	char name [32];
+
+	snprintf(name, sizeof(name), "wear-%08x", cart_wear_identity);
+	return cart_home_file(name);
+}
+
+// wear of a block is its count scaled between the least and the most programmed ones
+static void cart_wear_update_sums (void)
+{
+	unsigned int least = cart_wear[0];
+	unsigned int most = cart_wear[0];
+	int i;
+
+	for (i = 1; i < cart_wear_blocks; i++)
+	{
+		least = MIN(least, cart_wear[i]);
+		most = MAX(most, cart_wear[i]);
+	}
+	cart_wear_sum[0] = 0;
+	for (i = 0; i < cart_wear_blocks; i++)
+		cart_wear_sum[i + 1] = cart_wear_sum[i]
+			+ (most > least? (long long)(cart_wear[i] - least) * CART_WRITE_BLOCK_SIZE / (most - least): 0);
+	cart_wear_sum_dirty = 0;
+}
+
+int cart_wear_load (void)
+{
+	FILE* f;
+	char line [WEAR_LINELEN];
+	int lineno = 0;
+
+	// cart size, write block size and cart do not change once known
+	// (sums are up to date when the placement search shares them with workers)
+	if (cart_wear)
+	{
+		if (cart_wear_sum_dirty)
+			cart_wear_update_sums();
+		return 0;
+	}
+
+	if (cart_size_mbits <= 0 || cart_write_block_size_log2 <= 0)
+	{
+		printerr("cart size is unknown, cannot load write blocks wear\n");
+		return -1;
+	}
+	if (!cart_map_identity)
+	{
+		printerr("cart has no IF2A-0003 map yet, its write blocks wear is unknown\n");
+		return -1;
+	}
+	cart_wear_identity = cart_map_identity;
+	cart_wear_blocks = CART_SIZE_BYTES / CART_WRITE_BLOCK_SIZE;
+	cart_wear = (unsigned int*)calloc(cart_wear_blocks, sizeof(unsigned int));
+	cart_wear_sum = (long long*)malloc((cart_wear_blocks + 1) * sizeof(long long));
+	if (!cart_wear || !cart_wear_sum)
+	{
+		printerrno("malloc(%i) for write blocks wear", cart_wear_blocks);
+		free(cart_wear);
+		free(cart_wear_sum);
+		cart_wear = NULL;
+		cart_wear_sum = NULL;
+		return -1;
+	}
+
+	if ((f = fopen(cart_wear_file(), "r")) != NULL)
+	{
+		while (fgets(line, WEAR_LINELEN, f))
+		{
+			unsigned int offset, count;
+
+			lineno++;
+			if (line[0] == '#')
+				continue;
+			if (   sscanf(line, "%x %u", &offset, &count) != 2
+			    || offset % CART_WRITE_BLOCK_SIZE
+			    || offset / CART_WRITE_BLOCK_SIZE >= (unsigned int)cart_wear_blocks)
+			{
+				printerr("%s:%i: bad line ignored\n", cart_wear_file(), lineno);
+				continue;
+			}
+			cart_wear[offset / CART_WRITE_BLOCK_SIZE] = count;
+		}
+		fclose(f);
+	}
+	// else nothing programmed yet
+
+	cart_wear_changed = 0;
+	cart_wear_update_sums();
+	return 0;
+}
+
+void cart_wear_count (int offset, int size)
+{
+	int block;
+
+	// (a cart without map cannot be told apart)
+	if (size <= 0 || (!cart_wear && !cart_map_identity) || cart_wear_load() < 0)
+		return;
+	for (block = offset / CART_WRITE_BLOCK_SIZE;
+	     block <= (offset + size - 1) / CART_WRITE_BLOCK_SIZE && block < cart_wear_blocks;
+	     block++)
+		cart_wear[block]++;
+	cart_wear_changed = 1;
+	cart_wear_sum_dirty = 1;
+}
+
+int cart_wear_save (void)
+{
+	FILE* f;
+	char tmpname [1024];
+	int i;
+
+	if (!cart_wear_changed)
+		return 0;
+
+	snprintf(tmpname, sizeof(tmpname), "%s.new", cart_wear_file());
+	if ((f = fopen(tmpname, "w")) == NULL)
+	{
+		printerrno("fopen(%s)", tmpname);
+		return -1;
+	}
+	fputs(WEAR_HEADER, f);
+	for (i = 0; i < cart_wear_blocks; i++)
+		if (cart_wear[i])
+			fprintf(f, "0x%x %u\n", i * CART_WRITE_BLOCK_SIZE, cart_wear[i]);
+	if (fclose(f) != 0)
+	{
+		printerrno("write(%s)", tmpname);
+		return -1;
+	}
+
+#if _WIN32
+	remove(cart_wear_file());
+#endif
+	if (rename(tmpname, cart_wear_file()) != 0)
+	{
+		printerrno("rename(%s)", tmpname);
+		return -1;
+	}
+
+	cart_wear_changed = 0;
+	return 0;
+}
+
+long long cart_wear_cost (int offset, int size)
+{
+	int first = offset / CART_WRITE_BLOCK_SIZE;
+	int last = (offset + size - 1) / CART_WRITE_BLOCK_SIZE + 1;
+
+	// not loaded: no wear to avoid
+	if (!cart_wear || size <= 0)
+		return 0;
+	if (cart_wear_sum_dirty)
+		cart_wear_update_sums();
+	first = MIN(first, cart_wear_blocks);
+	last = MIN(last, cart_wear_blocks);
+	return cart_wear_sum[last] - cart_wear_sum[first];
+}
+
+int cart_wear_report (void)
+{
+	char bar [WEAR_BAR + 1];
+	unsigned int least, most;
+	long long total = 0;
+	int per_row;
+	int i, j;
+
+	if (cart_wear_load() < 0)
+		return -1;
+
+	least = most = cart_wear[0];
+	for (i = 0; i < cart_wear_blocks; i++)
+	{
+		least = MIN(least, cart_wear[i]);
+		most = MAX(most, cart_wear[i]);
+		total += cart_wear[i];
+	}
+
+	print("Write blocks wear (%i blocks of %iKB, programs made from this host, in %s):\n",
+	      cart_wear_blocks, CART_WRITE_BLOCK_SIZE / 1024, cart_wear_file());
+	print("\tleast programmed %u times, most %u times, %.4g on average\n",
+	      least, most, (double)total / cart_wear_blocks);
+
+	memset(bar, '#', WEAR_BAR);
+	bar[WEAR_BAR] = 0;
+	per_row = (cart_wear_blocks + WEAR_ROWS - 1) / WEAR_ROWS;
+	print("\t%-23s  average     most\n", "addresses");
+	for (i = 0; i < cart_wear_blocks; i += per_row)
+	{
+		int number = MIN(per_row, cart_wear_blocks - i);
+		unsigned int row_most = 0;
+		long long row_total = 0;
+
+		for (j = i; j < i + number; j++)
+		{
+			row_most = MAX(row_most, cart_wear[j]);
+			row_total += cart_wear[j];
+		}
+		print("\t0x%08x - 0x%08x  %7.1f  %7u  %.*s\n",
+		      GBA_ROM + i * CART_WRITE_BLOCK_SIZE,
+		      GBA_ROM + (i + number) * CART_WRITE_BLOCK_SIZE,
+		      (double)row_total / number,
+		      row_most,
+		      most? (int)(row_total * WEAR_BAR / ((long long)number * most)): 0,
+		      bar);
+	}
+	return 0;
+}
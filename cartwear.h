@@ -0,0 +1,33 @@
+/*
+ * Based in f2a by Ulrich Hecht <uli@emulinks.de>
+ * if2a by D. Gauchard <deyv@free.fr>
+ * F2A Ultra support by Vincent Rubiolo <vincent.rubiolo@free.fr>
+ * Licensed under the terms of the GNU Public License version 2
+ */
+
+// Write blocks wear: program counts of rom write blocks, kept on host side
+
+#ifndef __CARTWEAR_H__
+#define __CARTWEAR_H__
+
+#include "libf2a.h"
+
+// load counts of the cart whose map is loaded (once, later calls bring
+// wear up to date before workers share it), returns -1 if error
+int		cart_wear_load		(void);
+
+// one more program of write blocks holding rom bytes offset..offset+size-1
+void		cart_wear_count		(int offset, int size);
+
+// save counts if they changed, returns -1 if error
+int		cart_wear_save		(void);
+
+// wear of write blocks holding rom bytes offset..offset+size-1, in bytes:
+// each block counts from 0 (least programmed) to CART_WRITE_BLOCK_SIZE (most programmed),
+// 0 when counts are not loaded
+long long	cart_wear_cost		(int offset, int size);
+
+// display counts distribution over the cart, returns -1 if error
+int		cart_wear_report	(void);
+
+#endif // __CARTWEAR_H__
@@ -300,7 +300,7 @@ int f2a_multiboot (const char* fileName)
 		return -1;
 	}
    
-	// we cannot talk anymore to the linker
-   	cart_exit(0);
+	// the GBA does not run the linker multiboot anymore,
+	// it has to be booted again before talking to the linker
 	return 0;
 } 
@@ -227,8 +227,7 @@ int f2au_GameID_gen(const char* filename, int* game_id)
 	unsigned char buffer[189];
 	if (buffer_from_file(filename, buffer, 189) < 0)
 		return -1;
-	buffer[180] = buffer[188];
-	cart_crc32(buffer, game_id, 181);
+	*game_id = cart_game_id(buffer);
 #endif
 	
 	return 0;
@@ -39,6 +39,18 @@ void help(const char *name)
 	      "	   <r>,<n> will change the name of the rom [unsupported]\n"
 	      "	-X <r>	remove rom from cart (match map name - multiple -X allowed)\n"
 	      "	-Y	create (or overwrite) cart map\n"
+	      "	-y	search cart map in whole cart (default: where it was found last and after known loaders, then in first 8Mbits)\n"
+	      "	-i <f>	update rom in place (same map name, only changed blocks are burned) or add it again if it does not fit\n"
+	      "	-x	watch rom files: multiboot them (up to 256kB) or update them in cart each time they are saved\n"
+	      "	-D <s>	move fewest roms to make a hole of size <s> (suffix kb,mb,kB,mB) before other changes\n"
+	      "	-V <f>	make cart contents match manifest <f> (lines: '<r>[,<n>] [@offset]', 'loader <l>'): removes, keeps and adds roms in one burn\n"
+	      "	-q	resume an interrupted -A/-X/-Y/-V burn (roms not burned yet, then map), discard it if cart has changed since\n"
+	      "	-z	scan rom files or directories into rom catalog (no cart needed)\n"
+	      "	-Z <f>	use rom catalog file <f> (default: ~/.if2a/catalog, 'none' to disable)\n"
+	      "	-P <ms>	stop searching best placement after <ms> milliseconds (default: exact search)\n"
+	      "	-o <w>	weight burn time against holes sizes when placing roms (percent, 0..1000, default 0)\n"
+	      "	-J <w>	weight write blocks wear against holes sizes when placing roms (percent, 0..1000, default 0)\n"
+	      "	-g	display write blocks wear (program counts of burns made from this host)\n"
 	      "\nROM options:\n"
 	      "	-R	read ROMs from cart (and generate filenames)\n"
 	      "		Individual ordered ROM selection (optional):\n"
@@ -46,6 +58,8 @@ void help(const char *name)
 	      "		@	: automatically generate filename\n"
 	      "		<name>	: assign file<name> to ROM\n"
 	      "	-W	write ROMs to cart\n"
+	      "	-T	(with -R) trim ROMs padding like -a, and write long 0x00 runs as sparse holes\n"
+	      "	-O <t>	(with -R) write a checksum file along with each ROM (crc: .sfv, sha1: .sha1)\n"
 	      "	-M	display ROM map (scanning)\n"
 	      "	-s	do not try to reduce ROM size (default: reduce to fit loader)\n"
 	      "	-a	always try to reduce ROM size (default: reduce to fit loader)\n"
@@ -54,15 +68,19 @@ void help(const char *name)
 	      "\nSRAM options:\n"
 	      "	-r <f>  read SRAM from cart\n"
 	      "	-w <f>  write SRAM to cart\n"
+	      "\nSnapshot options:\n"
+	      "	-N <d>	snapshot whole cart (ROM, SRAM and Ultra's descriptor) into store directory <d>\n"
+	      "	-Q <s>	restore snapshot <s> (or latest one of store directory <s>), only differing blocks are written\n"
 	      "\nDebugging options:\n"
 	      "	-c	(with -W) check whole file (not just borders) before burning\n"
 	      "	-n	do not insert f2a loader (default is to insert one)\n"
 	      "	-H	do not check and correct ROM headers\n"
 	      "\nOther options:\n"
-	      "	-d	dummy - do not write -\n"
+	      "	-d	dummy - do not write - (EASYROM;: changes are listed with their estimated cost)\n"
 	      "	-d	(one more -d) - do not read -\n"
 	      "	-v	be more verbose (Max verbosity is -vv)\n"
 	      "	-m <f>	send multiboot file\n"
+	      "	-j <n>	use <n> host worker threads (default: number of cpus)\n"
 	      "\nLoader-PRO's (GBA-loader-3.x) SRAM manager specific:\n"
 	      "       -b <b>  specify bank in SRAM\n"
 	      "	A bank can be 'all', '1' or '2a' or '3b2' (same format as f2apro's cart loader)\n"
@@ -108,10 +126,16 @@ enum mode_e
 	MODE_READ_CD,
 	MODE_READ_DH,
 	MODE_SCANNED_MAP,
+	MODE_WEAR,
 	MODE_MB_USER,
 	MODE_EASYROM,
 	MODE_EASYROM_MAP,
 	MODE_GEN_ID,
+	MODE_CATALOG_SCAN,
+	MODE_SNAPSHOT,
+	MODE_RESTORE,
+	MODE_WATCH,
+	MODE_RESUME,
 	MODE_UNDEF,
 };
 
@@ -140,6 +164,7 @@ int main(int argc, char *argv[])
 #else
 	linker_t linker_type = LINKER_TEMPLATE;	// default
 #endif
+	const char *linker_name;
 
 	enum mode_e mode = MODE_UNDEF;
 	int autodetection = 1;
@@ -147,6 +172,7 @@ int main(int argc, char *argv[])
 	char *multiboot_user_file = NULL;
 	char *sram_file = NULL;
 	char *svd_file = NULL;
+	char *snapshot = NULL;
 
 	char *new_cart_size = NULL;
 	//int non_opt_idx = 0;
@@ -161,12 +187,18 @@ int main(int argc, char *argv[])
 	char *firmware_file = NULL;
 	char *splash_file = NULL;
 	char *loader_file = NULL;
+	char *catalog_file = NULL;
+	char *manifest_file = NULL;
 
 	int create_cart_map = 0;
-	const char *add_files[FILE_NUMBER_MAX];
+	// (there are less files than arguments)
+	const char *add_files[argc];
 	int add_files_number = 0;
-	const char *del_files[FILE_NUMBER_MAX];
+	const char *del_files[argc];
 	int del_files_number = 0;
+	char *compact_size = NULL;
+	const char *update_files[argc];
+	int update_files_number = 0;
 
 	int clean_cart = 0;
 	int cart_use_loader = 1;
@@ -196,7 +228,7 @@ int main(int argc, char *argv[])
 	{
 		// The first colon should stay here : it is a getopt() setting.
 		opt = getopt(argc, argv,
-			     ":dvhMfasRHCcpnb:S:m:t:e:E:u:U:k:K:G:L:F:B:I:A:X:l:r:w:YW");
+			     ":dvhMfasRTHCcpnzb:S:m:t:e:E:u:U:k:K:G:L:F:B:I:A:X:l:r:w:j:Z:O:N:Q:P:o:J:D:i:V:YyWgxq");
 		switch (opt)
 		{
 
@@ -370,21 +402,110 @@ int main(int argc, char *argv[])
 
 		case 'A':
 			mode = MODE_EASYROM;
-			assert(add_files_number < FILE_NUMBER_MAX);
 			add_files[add_files_number++] = optarg;
 			break;
 
 		case 'X':
 			mode = MODE_EASYROM;
-			assert(del_files_number < FILE_NUMBER_MAX);
 			del_files[del_files_number++] = optarg;
 			break;
 
+		case 'i':
+			mode = MODE_EASYROM;
+			update_files[update_files_number++] = optarg;
+			break;
+
+		case 'x':
+			mode = MODE_WATCH;
+			break;
+
+		case 'q':
+			mode = MODE_RESUME;
+			break;
+
+		case 'V':
+			mode = MODE_EASYROM;
+			manifest_file = optarg;
+			break;
+
+		case 'D':
+			mode = MODE_EASYROM;
+			compact_size = optarg;
+			break;
+
 		case 'Y':
 			mode = MODE_EASYROM;
 			create_cart_map = 1;
 			break;
 
+		case 'y':
+			cart_map_full_scan = 1;
+			break;
+
+		case 'z':
+			mode = MODE_CATALOG_SCAN;
+			break;
+
+		case 'Z':
+			catalog_file = optarg;
+			break;
+
+		case 'j':
+			cart_threads = atoi(optarg);
+			break;
+
+		case 'P':
+			cart_plan_budget_ms = atoi(optarg);
+			break;
+
+		case 'o':
+			cart_plan_burn_weight = atoi(optarg);
+			if (cart_plan_burn_weight < 0 || cart_plan_burn_weight > 1000)
+			{
+				printerr("Burn weight must be between 0 and 1000 (%s)\n", optarg);
+				exit(1);
+			}
+			break;
+
+		case 'J':
+			cart_plan_wear_weight = atoi(optarg);
+			if (cart_plan_wear_weight < 0 || cart_plan_wear_weight > 1000)
+			{
+				printerr("Wear weight must be between 0 and 1000 (%s)\n", optarg);
+				exit(1);
+			}
+			break;
+
+		case 'g':
+			mode = MODE_WEAR;
+			break;
+
+		case 'T':
+			cart_dump_trim = 1;
+			break;
+
+		case 'N':
+			mode = MODE_SNAPSHOT;
+			snapshot = optarg;
+			break;
+
+		case 'Q':
+			mode = MODE_RESTORE;
+			snapshot = optarg;
+			break;
+
+		case 'O':
+			if (strcmp(optarg, "crc") == 0)
+				cart_dump_sum = CART_SUM_CRC32;
+			else if (strcmp(optarg, "sha1") == 0)
+				cart_dump_sum = CART_SUM_SHA1;
+			else
+			{
+				printerr("Unknown checksum type '%s' (crc or sha1).\n", optarg);
+				exit(1);
+			}
+			break;
+
 		case 'h':
 			help(argv[0]);
 			exit(1);
@@ -425,20 +546,24 @@ int main(int argc, char *argv[])
 #if F2AL
 	case LINKER_F2A_USB_GBA:
 		cart_reinit_f2a_usb();
+		linker_name = "gba";
 		break;
 #endif
 #if F2AW
 	case LINKER_F2A_USB_WRITER:
 		cart_reinit_f2a_usb_writer();
+		linker_name = "writer";
 		break;
 #endif
 #if F2AP
 	case LINKER_F2A_PARALLEL_GBA:
 		cart_reinit_f2a_parallel();
+		linker_name = "par";
 		break;
 #endif
 	default:
 		cart_reinit_template();
+		linker_name = "template";
 		break;
 	}
 
@@ -507,7 +632,7 @@ int main(int argc, char *argv[])
 	 * On the other hand, we cannot allow any non-option argument if we are
 	 * using EASYROM;)
 	 */
-	if (mode == MODE_WRITE_ROM && non_opt_nb < 1)
+	if ((mode == MODE_WRITE_ROM || mode == MODE_CATALOG_SCAN || mode == MODE_WATCH) && non_opt_nb < 1)
 	{
 		printerr("A filename is missing here.\n");
 		cart_exit(1);
@@ -531,6 +656,30 @@ int main(int argc, char *argv[])
 		cart_exit(1);
 	}
 
+	// Rom catalog (host side only, no need to connect for scanning)
+	if (cart_catalog_select(catalog_file) < 0)
+		cart_exit(1);
+	if (mode == MODE_CATALOG_SCAN)
+		cart_exit(cart_catalog_scan(non_opt_nb, &argv[optind]) < 0? 1: 0);
+
+	// Manifest gives the whole cart contents (and maybe the loader)
+	if (manifest_file)
+	{
+		if (add_files_number || del_files_number || update_files_number)
+		{
+			printerr("A manifest (-V) cannot be used with -A, -X or -i.\n");
+			cart_exit(1);
+		}
+		if (cart_manifest_load(manifest_file, &loader_file) < 0)
+			cart_exit(1);
+	}
+
+	// Nothing is written in rom until an interrupted burn is resumed
+	if (   (mode == MODE_EASYROM || mode == MODE_WRITE_ROM || mode == MODE_WATCH || mode == MODE_RESTORE)
+	    && !cart_io_sim
+	    && cart_map_journal_pending())
+		cart_exit(1);
+
 	// Cart size settings
 	if (new_cart_size != NULL)	// user specified a size
 	{
@@ -555,6 +704,27 @@ int main(int argc, char *argv[])
 		}
 	}
 
+	/*
+	 * Roms are loaded, checked, trimmed and hashed by workers while the
+	 * linker connects and boots (which may include waiting for the user to
+	 * power-cycle the GBA). Missing files are reported right now.
+	 */
+	if (mode == MODE_WRITE_ROM && auto_loadandburn_prefetch(argc - optind, argv + optind) < 0)
+		cart_exit(1);
+	if (mode == MODE_EASYROM)
+	{
+		const char *prefetch_files[argc];
+		int prefetch_files_number = 0;
+		int i;
+
+		for (i = 0; i < add_files_number; i++)
+			prefetch_files[prefetch_files_number++] = add_files[i];
+		for (i = 0; i < update_files_number; i++)
+			prefetch_files[prefetch_files_number++] = update_files[i];
+		if ((manifest_file? cart_manifest_prefetch(): cart_map_prefetch(prefetch_files, prefetch_files_number)) < 0)
+			cart_exit(1);
+	}
+
 	// Connection. This means parsing the USB bus and uploading firmware.
 	if (cart_connect() < 0)
 		cart_exit(1);
@@ -596,6 +766,10 @@ int main(int argc, char *argv[])
 		cart_exit(1);
 	}
 
+	// Transfers are timed to estimate burns (-d)
+	if (cart_rate_select(linker_name, cart_type) < 0)
+		cart_exit(1);
+
 	/* 
 	 * To allow for enumerating loaders without being connected, we must
 	 * have a cart type specified.
@@ -620,6 +794,8 @@ int main(int argc, char *argv[])
 				 multiboot_user_file);
 			cart_exit(1);
 		}
+		// we cannot talk anymore to the linker
+		cart_exit(0);
 	}
 
 	/* 
@@ -694,6 +870,14 @@ int main(int argc, char *argv[])
 			cart_exit(1);
 	}
 
+	// Show write blocks wear (of the cart the map tells)
+	if (mode == MODE_WEAR)
+	{
+		if (load_cart_map() < 0 || cart_wear_report() < 0)
+			cart_exit(1);
+		reset_cart_map();
+	}
+
 	// Show cart map : EASYROM;)
 	if (mode == MODE_EASYROM_MAP)
 	{
@@ -746,6 +930,16 @@ int main(int argc, char *argv[])
 		}
 	}
 
+	// Snapshot whole cart
+	if (mode == MODE_SNAPSHOT
+	    && cart_snapshot_save(snapshot, cart_type, sram_size) < 0)
+		cart_exit(1);
+
+	// Restore snapshot
+	if (mode == MODE_RESTORE
+	    && cart_snapshot_restore(snapshot, cart_type, sram_size) < 0)
+		cart_exit(1);
+
 	// Write ROMs
 	if (mode == MODE_WRITE_ROM
 	    && auto_loadandburn_rom(cart_type, cart_use_loader, clean_cart,
@@ -843,6 +1037,17 @@ int main(int argc, char *argv[])
 		print("GameID for file %s is: %8X.\n", argv[optind], game_id);
 	}
 
+	// Watch mode
+	if (mode == MODE_WATCH)
+	{
+		if (cart_watch(argc - optind, argv + optind) < 0)
+			cart_exit(1);
+	}
+
+	// Finish an interrupted EASYROM;) burn
+	if (mode == MODE_RESUME && cart_map_resume() < 0)
+		cart_exit(1);
+
 	// EASYROM;)
 	if (mode == MODE_EASYROM)
 	{
@@ -857,10 +1062,60 @@ int main(int argc, char *argv[])
 		if (del_files_number)
 			cart_map_mark_for_remove(del_files, del_files_number);
 
-		if (loader_file)
+		if (compact_size)
+		{
+			int hole_size = convsize(compact_size);
+			int moves;
+
+			if (hole_size <= 0)
+			{
+				printerr("Invalid hole size '%s'.\n", compact_size);
+				cart_exit(1);
+			}
+			if (create_cart_map)
+			{
+				printerr("A new cart map has nothing to compact.\n");
+				cart_exit(1);
+			}
+			if ((moves = cart_map_compact(hole_size)) < 0)
+			{
+				reset_cart_map();
+				cart_exit(1);
+			}
+			// reload map: when roms have moved, removed roms are already out of it
+			reset_cart_map();
+			if (load_cart_map() < 0)
+				cart_exit(1);
+			if (moves)
+				del_files_number = 0;
+			else if (del_files_number)
+				cart_map_mark_for_remove(del_files, del_files_number);
+		}
+
+		if (update_files_number)
+		{
+			int left, i;
+
+			if (create_cart_map)
+			{
+				printerr("A new cart map has no rom to update.\n");
+				cart_exit(1);
+			}
+			if ((left = cart_map_update(update_files, update_files_number)) < 0)
+			{
+				reset_cart_map();
+				cart_exit(1);
+			}
+			// roms which did not fit are removed, and added again
+			for (i = 0; i < left; i++)
+				add_files[add_files_number++] = update_files[i];
+		}
+
+		// a manifest loader is burned only when it is not there yet
+		if (loader_file && (!manifest_file || create_cart_map || cart_manifest_loader_burned(&loader) != 1))
 			cart_map_replace_loader(&loader);
 
-		if ((del_files_number + add_files_number) == 0
+		if (((del_files_number + add_files_number) == 0 && !manifest_file)
 		    || cart_verbose > 0)
 		{
 			if (del_files_number)
@@ -868,7 +1123,15 @@ int main(int argc, char *argv[])
 			display_cart_map();
 		}
 
-		if (del_files_number || add_files_number || loader_file)
+		if (manifest_file)
+		{
+			if (cart_manifest_sync() < 0 || cart_map_process_changes() < 0)
+			{
+				reset_cart_map();
+				cart_exit(1);
+			}
+		}
+		else if (del_files_number || add_files_number || loader_file)
 		{
 			if (cart_map_build_hole() < 0)
 			{
@@ -898,6 +1161,7 @@ int main(int argc, char *argv[])
 		}
 
 		reset_cart_map();
+		cart_catalog_save();
 	}
 
 	// Cleanup after every action performed
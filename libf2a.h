@@ -22,8 +22,6 @@
 	#define msleep(n)	usleep(1000*(n))
 #endif
 
-#define FILE_NUMBER_MAX		32
-
 //////////////////////////////////////
 // general defines
 
@@ -50,6 +48,7 @@ enum read_type_e
 // GBA defines
 
 #define GBA_EWRAM		0x02000000		// ram address for multiboot files
+#define GBA_EWRAM_SIZE		(256 * 1024)		// largest multiboot file
 #define GBA_VRAM		0x06000000		// Video RAM for loader background image
 #define GBA_OAM			0x07000000		// OAM (Object Attribute Memory?)
 #define	GBA_ROM			0x08000000
@@ -117,6 +116,24 @@ extern int	cart_burn_without_comparison;
 extern int	cart_trim_always;
 extern int	cart_trim_allowed;
 
+// checksum files written along with dumps (-R)
+typedef enum
+{
+	CART_SUM_NONE,
+	CART_SUM_CRC32,				// <dump>.sfv
+	CART_SUM_SHA1,				// <dump>.sha1
+} cart_sum_e;
+extern cart_sum_e cart_dump_sum;
+extern int	cart_dump_trim;				// trim dumps (-R), 0x00 runs become sparse holes
+
+// host side
+extern int	cart_threads;				// worker threads (0: number of cpus)
+extern int	cart_plan_budget_ms;			// placement search time limit (0: none)
+extern int	cart_plan_burn_weight;			// burn cost weight in placement score (percent, 0: none)
+extern int	cart_plan_wear_weight;			// write blocks wear weight in placement score (percent, 0: none)
+extern int	cart_map_full_scan;			// search cart map locator in whole cart (default: likely places first, then first Mbits)
+extern u_int32_t cart_map_identity;			// cart whose map is loaded, keys host side records (0: no IF2A-0003 map, nothing is recorded)
+
 //////////////////////////////////////
 // cart I/O operations
 
@@ -152,6 +169,8 @@ int		convsize				(const char* size);
 int		display_scanned_cart_map		(void);
 int		cart_file2sram				(const char* file, int offset, int size);
 int		auto_loadandburn_rom			(cart_type_e cart_type, int cart_use_loader, int clean_cart, int numfiles, char* files[]);
+int		auto_loadandburn_prefetch		(int numfiles, char* files[]);	// prepares files for auto_loadandburn_rom() in background
+void		auto_loadandburn_prefetch_release	(void);	// stops preparations, frees those not used
 void		auto_readandsave_rom			(int numfiles, char* files[]);
 
 // f2a specifics
@@ -162,6 +181,9 @@ int		conv_f2apro_bank			(const char* block, int* offset, int* size);
 
 void		brand_new_empty_cart_map		(void);
 int		load_cart_map				(void);
+int		load_cart_map_at			(const unsigned char* small_cart, int offset);	// small_cart: last 1K of rom block at offset - returns 1 if map is loaded
+int		cart_map_locate				(void);	// load_cart_map() without complaining, returns 1 if map is loaded, 0 if not found
+int		cart_map_rom_size_at			(int offset);	// size of rom starting at offset in loaded map, 0 if none
 void		display_cart_map			(void);
 void		reset_cart_map				(void);
 void		cart_map_mark_for_remove		(const char* del_files[], int del_files_number);
@@ -171,6 +193,13 @@ void		display_cart_map_hole			(void);
 int		cart_map_find_best_insertion_for_files	(const char* add_files[], int add_files_number);
 void		cart_map_file_display_best_score	(void);
 int		cart_map_process_changes		(void);
+int		cart_map_compact			(int hole_size);	// moves roms until a hole is hole_size large, returns number of moves or -1
+int		cart_map_update				(const char* files[], int files_number);	// burns roms in place if they fit, returns number of files left in files[] to be added or -1
+int		cart_map_resume				(void);	// finishes an interrupted burn from its journal, returns -1 if error
+int		cart_map_journal_pending		(void);	// returns 1 (and tells it) if an interrupted burn has to be resumed first
+int		cart_map_sync				(const char* files[], const int offset[], int files_number);	// removes, keeps, adds roms so that cart holds files (offset[i] >= 0: fixed place), then cart_map_process_changes()
+int		cart_map_prefetch			(const char* files[], int files_number);	// prepares files to add or update in background (before connecting)
+void		cart_map_prefetch_release		(void);	// stops preparations, frees those not used
 
 //////////////////////////////////////
 // cartutils functions
@@ -179,6 +208,42 @@ int		buffer_from_file			(const char* filename, unsigned char* buffer, int size_t
 int		buffer_to_file				(const char* filename, const unsigned char* buffer, int size_to_write);
 unsigned char*	download_from_file			(const char* filename, int* size);
 
+//////////////////////////////////////
+// cartcatalog functions
+
+int		cart_catalog_select			(const char* file);	// NULL: default, "none": disabled
+int		cart_catalog_scan			(int numfiles, char* files[]);
+int		cart_catalog_save			(void);
+
+//////////////////////////////////////
+// cartsnap functions
+
+int		cart_snapshot_save			(const char* store, cart_type_e cart_type, int sram_size);
+int		cart_snapshot_restore			(const char* snapshot, cart_type_e cart_type, int sram_size);
+
+//////////////////////////////////////
+// cartwear functions
+
+int		cart_wear_report			(void);		// display write blocks program counts
+
+//////////////////////////////////////
+// cartrate functions
+
+int		cart_rate_select			(const char* linker, cart_type_e cart_type);	// throughput model of linker with cart type, measured by transfers
+
+//////////////////////////////////////
+// cartwatch functions
+
+int		cart_watch				(int numfiles, char* files[]);	// multiboot or update files in cart each time they are saved
+
+//////////////////////////////////////
+// cartmanifest functions
+
+int		cart_manifest_load			(const char* file, char** loader_file);	// sets *loader_file to the manifest's loader if it is NULL
+int		cart_manifest_loader_burned		(const binware_s* loader);	// 1 if cart already starts with loader, 0 if not, -1 if error
+int		cart_manifest_sync			(void);		// cart_map_sync() with the manifest roms
+int		cart_manifest_prefetch			(void);		// cart_map_prefetch() with the manifest roms
+
 //////////////////////////////////////
 // print functions called by libf2a
 // * print, printerr and printerrno have exactly the same syntax as printf()